@@ -0,0 +1,695 @@
+//
+// 2A03 APU: two pulse channels, triangle, noise, DMC and the frame counter
+//
+
+#include <string.h>
+
+#include "apu.h"
+#include "cpu.h"
+
+static const uint8_t LENGTH_TABLE[32] = {
+        10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+        12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+// Bit N is the output of step N
+static const uint8_t DUTY_TABLE[4] = {0b00000010, 0b00000110, 0b00011110, 0b11111001};
+
+static const uint8_t TRIANGLE_TABLE[32] = {
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+};
+
+// In CPU cycles (NTSC)
+static const uint16_t NOISE_PERIODS[16] = {
+        4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+};
+
+static const uint16_t DMC_PERIODS[16] = {
+        428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
+};
+
+// Frame counter steps in CPU cycles from the $4017 write, 4-step and 5-step sequences
+static const uint32_t FRAME_STEPS[2][4] = {
+        {7457, 14913, 22371, 29829},
+        {7457, 14913, 22371, 37281},
+};
+static const uint32_t FRAME_PERIODS[2] = {29830, 37282};
+
+/*
+ * Linear approximation of the mixer, in 1/65536 of full scale per output level:
+ *   pulse_out = 0.00752 * (pulse1 + pulse2)
+ *   tnd_out   = 0.00851 * triangle + 0.00494 * noise + 0.00335 * dmc
+ */
+#define GAIN_PULSE      493
+#define GAIN_TRIANGLE   558
+#define GAIN_NOISE      324
+#define GAIN_DMC        220
+
+// Samples kept when nobody reads them
+#define SAMPLE_BUFFER_MS 250
+
+FORCE_INLINE void fn_apu_output(apu_t* apu, int32_t* amp, int32_t out, uint64_t time) {
+    if (out != *amp) {
+        blip_add_delta(apu->blip, (uint32_t) (time - apu->frame_start), out - *amp);
+        *amp = out;
+    }
+}
+
+#pragma mark Units
+
+static void apu_envelope_clock(apu_envelope_t* env, uint8_t period, bool loop) {
+    if (env->start) {
+        env->start = false;
+        env->decay = 15;
+        env->divider = period;
+    } else if (env->divider == 0) {
+        env->divider = period;
+        if (env->decay > 0) {
+            --env->decay;
+        } else if (loop) {
+            env->decay = 15;
+        }
+    } else {
+        --env->divider;
+    }
+}
+
+static uint16_t apu_sweep_target(const apu_pulse_t* pulse, uint8_t channel) {
+    uint16_t change = pulse->period >> pulse->sweep_shift;
+    if (!pulse->sweep_negate) {
+        return pulse->period + change;
+    }
+    // Pulse 1 adds the ones' complement
+    change += channel == 0;
+    return change > pulse->period ? 0 : pulse->period - change;
+}
+
+static bool apu_pulse_muted(const apu_pulse_t* pulse, uint8_t channel) {
+    return pulse->period < 8 || (!pulse->sweep_negate && apu_sweep_target(pulse, channel) > 0x7FF);
+}
+
+static void apu_sweep_clock(apu_pulse_t* pulse, uint8_t channel) {
+    if (pulse->sweep_divider == 0 && pulse->sweep_enable && pulse->sweep_shift > 0 &&
+        !apu_pulse_muted(pulse, channel)) {
+        pulse->period = apu_sweep_target(pulse, channel);
+    }
+    if (pulse->sweep_divider == 0 || pulse->sweep_reload) {
+        pulse->sweep_divider = pulse->sweep_period;
+        pulse->sweep_reload = false;
+    } else {
+        --pulse->sweep_divider;
+    }
+}
+
+static void apu_quarter_frame(apu_t* apu) {
+    for (uint8_t i = 0; i < 2; ++i) {
+        apu_pulse_t* pulse = &apu->pulse[i];
+        apu_envelope_clock(&pulse->envelope, pulse->volume, pulse->halt);
+    }
+    apu_envelope_clock(&apu->noise.envelope, apu->noise.volume, apu->noise.halt);
+
+    apu_triangle_t* tri = &apu->triangle;
+    if (tri->linear_reload_flag) {
+        tri->linear = tri->linear_reload;
+    } else if (tri->linear > 0) {
+        --tri->linear;
+    }
+    if (!tri->halt) {
+        tri->linear_reload_flag = false;
+    }
+}
+
+static void apu_half_frame(apu_t* apu) {
+    for (uint8_t i = 0; i < 2; ++i) {
+        apu_pulse_t* pulse = &apu->pulse[i];
+        if (!pulse->halt && pulse->length > 0) {
+            --pulse->length;
+        }
+        apu_sweep_clock(pulse, i);
+    }
+    if (!apu->triangle.halt && apu->triangle.length > 0) {
+        --apu->triangle.length;
+    }
+    if (!apu->noise.halt && apu->noise.length > 0) {
+        --apu->noise.length;
+    }
+}
+
+#pragma mark Channels
+
+/*
+ * Each channel runs from apu->time to `end`, emitting its output changes
+ */
+
+static void apu_pulse_run(apu_t* apu, uint8_t channel, uint64_t end) {
+    apu_pulse_t* pulse = &apu->pulse[channel];
+    uint32_t period = (pulse->period + 1) * 2;
+    uint8_t volume = pulse->constant_volume ? pulse->volume : pulse->envelope.decay;
+    if (pulse->length == 0 || apu_pulse_muted(pulse, channel)) {
+        volume = 0;
+    }
+    uint8_t duty = DUTY_TABLE[pulse->duty];
+
+    // Envelope, length or register changes take effect now
+    fn_apu_output(apu, &pulse->amp, ((duty >> pulse->phase) & 1) * volume * GAIN_PULSE, apu->time);
+
+    uint64_t time = apu->time + pulse->delay;
+    if (time < end) {
+        if (volume == 0) {
+            // Silent, only the sequencer position matters
+            uint64_t count = (end - time + period - 1) / period;
+            pulse->phase = (pulse->phase + count) & 7;
+            time += count * period;
+        } else {
+            int32_t amp = pulse->amp;
+            do {
+                pulse->phase = (pulse->phase + 1) & 7;
+                fn_apu_output(apu, &amp, ((duty >> pulse->phase) & 1) * volume * GAIN_PULSE, time);
+                time += period;
+            } while (time < end);
+            pulse->amp = amp;
+        }
+    }
+    pulse->delay = (uint32_t) (time - end);
+}
+
+static void apu_triangle_run(apu_t* apu, uint64_t end) {
+    apu_triangle_t* tri = &apu->triangle;
+    uint32_t period = tri->period + 1;
+    fn_apu_output(apu, &tri->amp, TRIANGLE_TABLE[tri->phase] * GAIN_TRIANGLE, apu->time);
+
+    uint64_t time = apu->time + tri->delay;
+    if (time < end) {
+        // Ultrasonic periods are left frozen, as their average would be
+        if (tri->length == 0 || tri->linear == 0 || tri->period < 2) {
+            time += (end - time + period - 1) / period * period;
+        } else {
+            int32_t amp = tri->amp;
+            do {
+                tri->phase = (tri->phase + 1) & 31;
+                fn_apu_output(apu, &amp, TRIANGLE_TABLE[tri->phase] * GAIN_TRIANGLE, time);
+                time += period;
+            } while (time < end);
+            tri->amp = amp;
+        }
+    }
+    tri->delay = (uint32_t) (time - end);
+}
+
+static void apu_noise_run(apu_t* apu, uint64_t end) {
+    apu_noise_t* noise = &apu->noise;
+    uint32_t period = noise->period;
+    uint8_t volume = noise->length == 0 ? 0 : noise->constant_volume ? noise->volume : noise->envelope.decay;
+    uint8_t tap = noise->mode ? 6 : 1;
+    fn_apu_output(apu, &noise->amp, (~noise->lfsr & 1) * volume * GAIN_NOISE, apu->time);
+
+    uint64_t time = apu->time + noise->delay;
+    if (time < end) {
+        uint16_t lfsr = noise->lfsr;
+        int32_t amp = noise->amp;
+        do {
+            uint16_t feedback = (lfsr ^ (lfsr >> tap)) & 1;
+            lfsr = (lfsr >> 1) | (feedback << 14);
+            fn_apu_output(apu, &amp, (~lfsr & 1) * volume * GAIN_NOISE, time);
+            time += period;
+        } while (time < end);
+        noise->lfsr = lfsr;
+        noise->amp = amp;
+    }
+    noise->delay = (uint32_t) (time - end);
+}
+
+/*
+ * Memory reader: refills the sample buffer from CPU memory
+ */
+static void apu_dmc_fetch(apu_t* apu) {
+    apu_dmc_t* dmc = &apu->dmc;
+    if (dmc->buffer_full || dmc->remaining == 0) {
+        return;
+    }
+    dmc->buffer = cpu_mem_read(apu->cpu, dmc->addr);
+    dmc->buffer_full = true;
+    dmc->addr = dmc->addr == 0xFFFF ? 0x8000 : dmc->addr + 1;
+    if (--dmc->remaining == 0) {
+        if (dmc->loop) {
+            dmc->addr = dmc->sample_addr;
+            dmc->remaining = dmc->sample_length;
+        } else if (dmc->irq_enable) {
+            apu->dmc_irq = true;
+        }
+    }
+}
+
+static void apu_dmc_run(apu_t* apu, uint64_t end) {
+    apu_dmc_t* dmc = &apu->dmc;
+    fn_apu_output(apu, &dmc->amp, dmc->level * GAIN_DMC, apu->time);
+
+    uint64_t time = apu->time + dmc->delay;
+    while (time < end) {
+        if (!dmc->silence) {
+            if (dmc->shift & 1) {
+                if (dmc->level <= 125) {
+                    dmc->level += 2;
+                }
+            } else if (dmc->level >= 2) {
+                dmc->level -= 2;
+            }
+            fn_apu_output(apu, &dmc->amp, dmc->level * GAIN_DMC, time);
+        }
+        dmc->shift >>= 1;
+        if (--dmc->bits == 0) {
+            // Output cycle ends, the next one plays the sample buffer
+            dmc->bits = 8;
+            dmc->silence = !dmc->buffer_full;
+            if (dmc->buffer_full) {
+                dmc->shift = dmc->buffer;
+                dmc->buffer_full = false;
+                apu_dmc_fetch(apu);
+            }
+        }
+        time += dmc->period;
+    }
+    dmc->delay = (uint32_t) (time - end);
+}
+
+static void apu_channels_run(apu_t* apu, uint64_t end) {
+    if (end <= apu->time) {
+        return;
+    }
+    apu_pulse_run(apu, 0, end);
+    apu_pulse_run(apu, 1, end);
+    apu_triangle_run(apu, end);
+    apu_noise_run(apu, end);
+    apu_dmc_run(apu, end);
+    apu->time = end;
+}
+
+#pragma mark Frame counter and IRQ
+
+static void apu_update_irq(apu_t* apu) {
+    cpu_set_irq(apu->cpu, CPU_IRQ_APU, apu->frame_irq || apu->dmc_irq);
+
+    // The CPU comes back at each frame counter step that may raise the frame IRQ
+    uint64_t irq_time = UINT64_MAX;
+    if (!apu->mode5 && !apu->irq_inhibit && !apu->frame_irq) {
+        irq_time = apu->frame_next;
+    }
+
+    // Earliest time the DMC can fetch its last byte
+    const apu_dmc_t* dmc = &apu->dmc;
+    if (dmc->irq_enable && !dmc->loop && dmc->remaining > 0 && !apu->dmc_irq) {
+        uint64_t dmc_time = apu->time + dmc->delay + (uint64_t) (dmc->remaining - 1) * 8 * dmc->period;
+        if (dmc_time < irq_time) {
+            irq_time = dmc_time;
+        }
+    }
+    apu->irq_time = irq_time;
+}
+
+static void apu_frame_reset(apu_t* apu) {
+    apu->frame_step = 0;
+    apu->frame_next = apu->time + FRAME_STEPS[apu->mode5][0];
+}
+
+static void apu_frame_clock(apu_t* apu) {
+    uint8_t step = apu->frame_step;
+    apu_quarter_frame(apu);
+    if (step & 1) {
+        apu_half_frame(apu);
+    }
+    if (step == 3 && !apu->mode5 && !apu->irq_inhibit) {
+        apu->frame_irq = true;
+    }
+
+    uint64_t sequence_start = apu->frame_next - FRAME_STEPS[apu->mode5][step];
+    if (step == 3) {
+        sequence_start += FRAME_PERIODS[apu->mode5];
+        step = 0;
+    } else {
+        ++step;
+    }
+    apu->frame_step = step;
+    apu->frame_next = sequence_start + FRAME_STEPS[apu->mode5][step];
+}
+
+static bool apu_period_in(const uint16_t* periods, uint16_t period) {
+    for (int i = 0; i < 16; ++i) {
+        if (periods[i] == period) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool apu_periods_valid(uint16_t noise_period, uint16_t dmc_period) {
+    return apu_period_in(NOISE_PERIODS, noise_period) && apu_period_in(DMC_PERIODS, dmc_period);
+}
+
+void apu_run(apu_t* apu, uint64_t time) {
+    while (apu->frame_next <= time) {
+        apu_channels_run(apu, apu->frame_next);
+        apu_frame_clock(apu);
+    }
+    apu_channels_run(apu, time);
+    apu_update_irq(apu);
+}
+
+#pragma mark Registers
+
+static void apu_pulse_write(apu_pulse_t* pulse, uint8_t reg, uint8_t val, bool enabled) {
+    switch (reg) {
+        case 0:
+            pulse->duty = val >> 6;
+            pulse->halt = (val >> 5) & 1;
+            pulse->constant_volume = (val >> 4) & 1;
+            pulse->volume = val & 0x0F;
+            break;
+        case 1:
+            pulse->sweep_enable = val >> 7;
+            pulse->sweep_period = (val >> 4) & 0b111;
+            pulse->sweep_negate = (val >> 3) & 1;
+            pulse->sweep_shift = val & 0b111;
+            pulse->sweep_reload = true;
+            break;
+        case 2:
+            pulse->period = (pulse->period & 0x700) | val;
+            break;
+        case 3:
+            pulse->period = (pulse->period & 0xFF) | ((val & 0b111) << 8);
+            if (enabled) {
+                pulse->length = LENGTH_TABLE[val >> 3];
+            }
+            pulse->phase = 0;
+            pulse->envelope.start = true;
+            break;
+        default:
+            break;
+    }
+}
+
+uint8_t apu_read_status(apu_t* apu, uint64_t time) {
+    apu_run(apu, time);
+    uint8_t status = (apu->pulse[0].length > 0) |
+                     (apu->pulse[1].length > 0) << 1 |
+                     (apu->triangle.length > 0) << 2 |
+                     (apu->noise.length > 0) << 3 |
+                     (apu->dmc.remaining > 0) << 4 |
+                     apu->frame_irq << 6 |
+                     apu->dmc_irq << 7;
+    // Reading acknowledges the frame IRQ
+    apu->frame_irq = false;
+    apu_update_irq(apu);
+    return status;
+}
+
+void apu_write(apu_t* apu, uint64_t time, addr_t addr, uint8_t val) {
+    apu_run(apu, time);
+
+    switch (addr) {
+        case 0x4000:
+        case 0x4001:
+        case 0x4002:
+        case 0x4003:
+        case 0x4004:
+        case 0x4005:
+        case 0x4006:
+        case 0x4007: {
+            uint8_t channel = (addr >> 2) & 1;
+            apu_pulse_write(&apu->pulse[channel], addr & 3, val, apu->enabled & (1 << channel));
+            break;
+        }
+
+        case 0x4008:
+            apu->triangle.halt = val >> 7;
+            apu->triangle.linear_reload = val & 0x7F;
+            break;
+        case 0x400A:
+            apu->triangle.period = (apu->triangle.period & 0x700) | val;
+            break;
+        case 0x400B:
+            apu->triangle.period = (apu->triangle.period & 0xFF) | ((val & 0b111) << 8);
+            if (apu->enabled & 0b100) {
+                apu->triangle.length = LENGTH_TABLE[val >> 3];
+            }
+            apu->triangle.linear_reload_flag = true;
+            break;
+
+        case 0x400C:
+            apu->noise.halt = (val >> 5) & 1;
+            apu->noise.constant_volume = (val >> 4) & 1;
+            apu->noise.volume = val & 0x0F;
+            break;
+        case 0x400E:
+            apu->noise.mode = val >> 7;
+            apu->noise.period = NOISE_PERIODS[val & 0x0F];
+            break;
+        case 0x400F:
+            if (apu->enabled & 0b1000) {
+                apu->noise.length = LENGTH_TABLE[val >> 3];
+            }
+            apu->noise.envelope.start = true;
+            break;
+
+        case 0x4010:
+            apu->dmc.irq_enable = val >> 7;
+            apu->dmc.loop = (val >> 6) & 1;
+            apu->dmc.period = DMC_PERIODS[val & 0x0F];
+            if (!apu->dmc.irq_enable) {
+                apu->dmc_irq = false;
+            }
+            break;
+        case 0x4011:
+            apu->dmc.level = val & 0x7F;
+            break;
+        case 0x4012:
+            apu->dmc.sample_addr = 0xC000 | (val << 6);
+            break;
+        case 0x4013:
+            apu->dmc.sample_length = (val << 4) + 1;
+            break;
+
+        case 0x4015:
+            apu->enabled = val & 0x1F;
+            if (!(val & 0b0001)) apu->pulse[0].length = 0;
+            if (!(val & 0b0010)) apu->pulse[1].length = 0;
+            if (!(val & 0b0100)) apu->triangle.length = 0;
+            if (!(val & 0b1000)) apu->noise.length = 0;
+            if (!(val & 0b10000)) {
+                apu->dmc.remaining = 0;
+            } else if (apu->dmc.remaining == 0) {
+                apu->dmc.addr = apu->dmc.sample_addr;
+                apu->dmc.remaining = apu->dmc.sample_length;
+                apu_dmc_fetch(apu);
+            }
+            apu->dmc_irq = false;
+            break;
+
+        case 0x4017:
+            apu->mode5 = val >> 7;
+            apu->irq_inhibit = (val >> 6) & 1;
+            if (apu->irq_inhibit) {
+                apu->frame_irq = false;
+            }
+            apu_frame_reset(apu);
+            if (apu->mode5) {
+                // The 5-step sequence clocks the units immediately
+                apu_quarter_frame(apu);
+                apu_half_frame(apu);
+            }
+            break;
+
+        default:
+            break;
+    }
+    apu_update_irq(apu);
+}
+
+#pragma mark Samples
+
+/*
+ * Moves the synthesized samples through the resampling stage
+ */
+static void apu_resample(apu_t* apu) {
+    int16_t in[1024];
+    uint32_t count;
+    while (apu->resampled_count < apu->resampled_size / 2 &&
+           (count = blip_read_samples(apu->blip, in, 1024)) > 0) {
+        apu->resampled_count += resampler_process(apu->resampler, in, count,
+                                                  apu->resampled + apu->resampled_count);
+    }
+}
+
+void apu_end_frame(apu_t* apu, uint64_t time) {
+    apu_run(apu, time);
+    if (apu->resampler != NULL) {
+        apu_resample(apu);
+    }
+
+    uint32_t max = apu->sample_rate * SAMPLE_BUFFER_MS / 1000;
+    if (apu->resampler != NULL && apu->resampled_count > max / 2) {
+        // Not consumed, only the latest samples are kept
+        apu_read_samples(apu, NULL, apu->resampled_count - max / 2);
+    }
+    uint32_t avail = blip_samples_avail(apu->blip);
+    uint32_t blip_max = apu->resampler != NULL ? max * APU_RESAMPLER_OVERSAMPLING : max;
+    if (avail > blip_max / 2) {
+        blip_read_samples(apu->blip, NULL, avail - blip_max / 2);
+    }
+    blip_end_frame(apu->blip, (uint32_t) (time - apu->frame_start));
+    apu->frame_start = time;
+}
+
+uint32_t apu_samples_avail(apu_t* apu) {
+    if (apu->resampler != NULL) {
+        apu_resample(apu);
+        return apu->resampled_count;
+    }
+    return blip_samples_avail(apu->blip);
+}
+
+uint32_t apu_read_samples(apu_t* apu, int16_t* out, uint32_t count) {
+    if (apu->resampler == NULL) {
+        return blip_read_samples(apu->blip, out, count);
+    }
+
+    apu_resample(apu);
+    if (count > apu->resampled_count) {
+        count = apu->resampled_count;
+    }
+    if (out != NULL) {
+        memcpy(out, apu->resampled, count * sizeof(int16_t));
+    }
+    apu->resampled_count -= count;
+    memmove(apu->resampled, apu->resampled + count, apu->resampled_count * sizeof(int16_t));
+    return count;
+}
+
+#pragma mark Synthesis state
+
+typedef struct {
+    int32_t amp[5];
+    uint32_t resampled_count;
+    uint64_t frame_start;
+} apu_synth_t;
+
+size_t apu_synth_size(const apu_t* apu) {
+    size_t size = sizeof(apu_synth_t) + blip_state_size(apu->blip);
+    if (apu->resampler != NULL) {
+        size += apu->resampled_size * sizeof(int16_t) + resampler_state_size(apu->resampler);
+    }
+    return size;
+}
+
+void apu_save_synth(const apu_t* apu, uint8_t* out) {
+    apu_synth_t synth = {
+            {apu->pulse[0].amp, apu->pulse[1].amp, apu->triangle.amp, apu->noise.amp, apu->dmc.amp},
+            apu->resampled_count, apu->frame_start,
+    };
+    memcpy(out, &synth, sizeof(synth));
+    out += sizeof(synth);
+    out += blip_save(apu->blip, out);
+    if (apu->resampler != NULL) {
+        memcpy(out, apu->resampled, apu->resampled_count * sizeof(int16_t));
+        out += apu->resampled_count * sizeof(int16_t);
+        resampler_save(apu->resampler, out);
+    }
+}
+
+void apu_load_synth(apu_t* apu, const uint8_t* in) {
+    apu_synth_t synth;
+    memcpy(&synth, in, sizeof(synth));
+    in += sizeof(synth);
+    apu->pulse[0].amp = synth.amp[0];
+    apu->pulse[1].amp = synth.amp[1];
+    apu->triangle.amp = synth.amp[2];
+    apu->noise.amp = synth.amp[3];
+    apu->dmc.amp = synth.amp[4];
+    apu->frame_start = synth.frame_start;
+
+    in += blip_load(apu->blip, in);
+    if (apu->resampler != NULL) {
+        apu->resampled_count = synth.resampled_count;
+        memcpy(apu->resampled, in, apu->resampled_count * sizeof(int16_t));
+        in += apu->resampled_count * sizeof(int16_t);
+        resampler_load(apu->resampler, in);
+    }
+}
+
+/*
+ * (Re)creates the synthesis buffer and the resampling stage for the current settings
+ */
+static void apu_configure_output(apu_t* apu) {
+    uint32_t max = apu->sample_rate * SAMPLE_BUFFER_MS / 1000;
+    blip_destroy(apu->blip);
+    resampler_destroy(apu->resampler);
+    wn_free(apu->resampled);
+    apu->resampler = NULL;
+    apu->resampled = NULL;
+    apu->resampled_count = 0;
+    apu->rate_ratio = 1;
+
+    if (apu->resampler_quality == APU_RESAMPLER_NONE) {
+        apu->blip = blip_create(max);
+        blip_set_rates(apu->blip, APU_CLOCK_RATE, apu->sample_rate);
+    } else {
+        uint32_t rate = apu->sample_rate * APU_RESAMPLER_OVERSAMPLING;
+        apu->blip = blip_create(max * APU_RESAMPLER_OVERSAMPLING);
+        blip_set_rates(apu->blip, APU_CLOCK_RATE, rate);
+        apu->resampler = resampler_create(rate, apu->sample_rate, apu->resampler_quality);
+        // Room for one more block of resampled input above the fill limit
+        apu->resampled_size = max + 1024;
+        apu->resampled = wn_malloc(apu->resampled_size * sizeof(int16_t));
+    }
+}
+
+void apu_set_sample_rate(apu_t* apu, uint32_t sample_rate) {
+    apu->sample_rate = sample_rate;
+    apu_configure_output(apu);
+}
+
+void apu_set_resampler(apu_t* apu, int quality) {
+    apu->resampler_quality = quality;
+    apu_configure_output(apu);
+}
+
+void apu_set_rate_ratio(apu_t* apu, double ratio) {
+    if (ratio == apu->rate_ratio) {
+        return;
+    }
+    apu->rate_ratio = ratio;
+    if (apu->resampler != NULL) {
+        resampler_set_ratio(apu->resampler, ratio);
+    } else {
+        blip_set_rates(apu->blip, APU_CLOCK_RATE, apu->sample_rate * ratio);
+    }
+}
+
+apu_t* apu_create(cpu_t* cpu, wn_arena_t* arena) {
+    apu_t* apu = wn_arena_calloc(arena, sizeof(apu_t));
+    apu->arena = arena;
+    apu->cpu = cpu;
+    cpu->apu = apu;
+
+    apu->noise.lfsr = 1;
+    apu->noise.period = NOISE_PERIODS[0];
+    apu->dmc.period = DMC_PERIODS[0];
+    apu->dmc.bits = 8;
+    apu->dmc.silence = true;
+    apu->time = cpu->cycle_count;
+    apu->frame_start = apu->time;
+    apu_frame_reset(apu);
+    apu->resampler_quality = APU_RESAMPLER_NONE;
+    apu_set_sample_rate(apu, APU_DEFAULT_SAMPLE_RATE);
+    apu_update_irq(apu);
+    return apu;
+}
+
+void apu_destroy(apu_t* apu) {
+    if (apu != NULL) {
+        blip_destroy(apu->blip);
+        resampler_destroy(apu->resampler);
+        wn_free(apu->resampled);
+        wn_arena_free(apu->arena, apu);
+    }
+}
@@ -0,0 +1,237 @@
+//
+// 2A03 APU: two pulse channels, triangle, noise, DMC and the frame counter
+//
+
+#ifndef WINES_APU_H
+#define WINES_APU_H
+
+#include "common.h"
+#include "blip.h"
+#include "resampler.h"
+
+// NTSC CPU clock, the APU is clocked by the CPU
+#define APU_CLOCK_RATE 1789773.0
+
+#define APU_DEFAULT_SAMPLE_RATE 48000
+
+#define APU_RESAMPLER_OVERSAMPLING 2
+
+// No resampling stage
+#define APU_RESAMPLER_NONE (-1)
+
+typedef struct cpu cpu_t;
+
+/*
+ * Channels are not stepped every CPU cycle. Each one keeps the time of its next timer step and is
+ * caught up to the current CPU cycle only when it matters: on register accesses, when a frame of
+ * samples is requested, and when an IRQ may be due (irq_time). Every change of a channel output is
+ * recorded as a delta into a band-limited synthesis buffer, which produces the samples.
+ *
+ * Registers:
+ *   $4000-$4003  pulse 1      DDLC VVVV | EPPP NSSS | TTTT TTTT | LLLL LTTT
+ *   $4004-$4007  pulse 2
+ *   $4008-$400B  triangle     CRRR RRRR | ---- ---- | TTTT TTTT | LLLL LTTT
+ *   $400C-$400F  noise        --LC VVVV | ---- ---- | M--- PPPP | LLLL L---
+ *   $4010-$4013  DMC          IL-- RRRR | -DDD DDDD | AAAA AAAA | LLLL LLLL
+ *   $4015        status       write: ---D NT21 enables, read: IF-D NT21
+ *   $4017        frame counter MI-- ----
+ *
+ * Reference:
+ * https://www.nesdev.org/wiki/APU
+ */
+
+typedef struct {
+    bool start;
+    uint8_t divider;
+    uint8_t decay;
+} apu_envelope_t;
+
+typedef struct {
+    uint8_t duty;
+    // Length counter halt, also envelope loop
+    bool halt;
+    bool constant_volume;
+    // Constant volume or envelope period
+    uint8_t volume;
+    apu_envelope_t envelope;
+
+    bool sweep_enable;
+    bool sweep_negate;
+    bool sweep_reload;
+    uint8_t sweep_period;
+    uint8_t sweep_shift;
+    uint8_t sweep_divider;
+
+    // 11-bit timer period
+    uint16_t period;
+    uint8_t length;
+    // Position in the duty sequence
+    uint8_t phase;
+    // CPU cycles from the APU time to the next sequencer step
+    uint32_t delay;
+    int32_t amp;
+} apu_pulse_t;
+
+typedef struct {
+    // Length counter halt, also linear counter control
+    bool halt;
+    uint8_t linear_reload;
+    uint8_t linear;
+    bool linear_reload_flag;
+
+    uint16_t period;
+    uint8_t length;
+    uint8_t phase;
+    uint32_t delay;
+    int32_t amp;
+} apu_triangle_t;
+
+typedef struct {
+    bool halt;
+    bool constant_volume;
+    uint8_t volume;
+    apu_envelope_t envelope;
+
+    bool mode;
+    uint16_t period;
+    uint16_t lfsr;
+    uint8_t length;
+    uint32_t delay;
+    int32_t amp;
+} apu_noise_t;
+
+typedef struct {
+    bool irq_enable;
+    bool loop;
+    uint16_t period;
+    uint8_t level;
+
+    addr_t sample_addr;
+    uint16_t sample_length;
+    addr_t addr;
+    uint16_t remaining;
+
+    uint8_t buffer;
+    bool buffer_full;
+    uint8_t shift;
+    uint8_t bits;
+    bool silence;
+
+    uint32_t delay;
+    int32_t amp;
+} apu_dmc_t;
+
+typedef struct apu {
+    cpu_t* cpu;
+
+    apu_pulse_t pulse[2];
+    apu_triangle_t triangle;
+    apu_noise_t noise;
+    apu_dmc_t dmc;
+
+    // $4015 channel enables
+    uint8_t enabled;
+
+    // Frame counter
+    bool mode5;
+    bool irq_inhibit;
+    uint8_t frame_step;
+    // CPU cycle of the next frame counter step
+    uint64_t frame_next;
+
+    bool frame_irq;
+    bool dmc_irq;
+
+    // CPU cycle the channels are caught up to
+    uint64_t time;
+
+    // CPU cycle of the start of the current sample frame
+    uint64_t frame_start;
+
+    // Earliest CPU cycle an IRQ may be raised at, the CPU calls apu_run from there
+    uint64_t irq_time;
+
+    uint32_t sample_rate;
+    // Dynamic rate control, samples are produced at sample_rate * rate_ratio
+    double rate_ratio;
+    blip_t* blip;
+
+    /*
+     * Optional polyphase resampling stage: the blip buffer then synthesizes at
+     * APU_RESAMPLER_OVERSAMPLING times the sample rate and the resampler brings it down,
+     * with a steeper anti-aliasing filter than the synthesis kernel.
+     */
+    resampler_t* resampler;
+    int resampler_quality;
+    // Resampled samples not read yet
+    int16_t* resampled;
+    uint32_t resampled_count;
+    uint32_t resampled_size;
+
+    // Holds the APU, NULL when it is on the heap. The sample buffers are always on the heap.
+    wn_arena_t* arena;
+} apu_t;
+
+apu_t* apu_create(cpu_t* cpu, wn_arena_t* arena);
+
+void apu_set_sample_rate(apu_t* apu, uint32_t sample_rate);
+
+/**
+ * Adds a resampling stage of the given resampler_quality_t, or removes it with APU_RESAMPLER_NONE
+ */
+void apu_set_resampler(apu_t* apu, int quality);
+
+/**
+ * Produces sample_rate * ratio samples per second from now on, for dynamic rate control
+ */
+void apu_set_rate_ratio(apu_t* apu, double ratio);
+
+/**
+ * Whether the noise and DMC timer periods are ones their registers can select, for restored states
+ */
+bool apu_periods_valid(uint16_t noise_period, uint16_t dmc_period);
+
+/**
+ * Catches the APU up to CPU cycle `time`
+ */
+void apu_run(apu_t* apu, uint64_t time);
+
+/**
+ * $4015 read at CPU cycle `time`
+ */
+uint8_t apu_read_status(apu_t* apu, uint64_t time);
+
+/**
+ * Register write ($4000-$4013, $4015, $4017) at CPU cycle `time`
+ */
+void apu_write(apu_t* apu, uint64_t time, addr_t addr, uint8_t val);
+
+/**
+ * Makes the samples up to CPU cycle `time` available, called once per video frame
+ */
+void apu_end_frame(apu_t* apu, uint64_t time);
+
+uint32_t apu_samples_avail(apu_t* apu);
+
+/**
+ * Reads up to `count` signed 16-bit mono samples, returns the number read
+ */
+uint32_t apu_read_samples(apu_t* apu, int16_t* out, uint32_t count);
+
+/**
+ * Largest size of the state saved by apu_save_synth with the current output settings
+ */
+size_t apu_synth_size(const apu_t* apu);
+
+/*
+ * The sound output a save state leaves out: the channel levels, the samples and band-limited steps
+ * pending in the synthesis buffer, and the resampling stage. Saved after apu_end_frame, loaded back
+ * with the same output settings to continue the sound of a timeline after running another one.
+ */
+void apu_save_synth(const apu_t* apu, uint8_t* out);
+
+void apu_load_synth(apu_t* apu, const uint8_t* in);
+
+void apu_destroy(apu_t* apu);
+
+#endif //WINES_APU_H
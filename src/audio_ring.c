@@ -0,0 +1,105 @@
+//
+// Lock-free sample ring between the emulation thread and the audio callback
+//
+
+#include <string.h>
+
+#include "audio_ring.h"
+
+void audio_ring_init(audio_ring_t* ring, uint32_t capacity, uint32_t target_fill, double max_deviation) {
+    uint32_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    ring->samples = wn_calloc(size * sizeof(int16_t));
+    ring->capacity = size;
+    ring->last = 0;
+    ring->target_fill = target_fill < size ? target_fill : size / 2;
+    ring->max_deviation = max_deviation;
+
+    atomic_init(&ring->write_pos, 0);
+    atomic_init(&ring->read_pos, 0);
+    atomic_init(&ring->written, 0);
+    atomic_init(&ring->played, 0);
+    atomic_init(&ring->underruns, 0);
+    atomic_init(&ring->underrun_samples, 0);
+    atomic_init(&ring->overruns, 0);
+    atomic_init(&ring->overrun_samples, 0);
+}
+
+uint32_t audio_ring_write(audio_ring_t* ring, const int16_t* samples, uint32_t count) {
+    uint32_t write = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    // Acquire: the consumer is done with the slots before its index
+    uint32_t read = atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+    uint32_t space = ring->capacity - (write - read);
+
+    uint32_t n = count < space ? count : space;
+    uint32_t index = write & (ring->capacity - 1);
+    uint32_t first = ring->capacity - index < n ? ring->capacity - index : n;
+    memcpy(ring->samples + index, samples, first * sizeof(int16_t));
+    memcpy(ring->samples, samples + first, (n - first) * sizeof(int16_t));
+
+    // Release: the samples are visible to the consumer once it sees the new index
+    atomic_store_explicit(&ring->write_pos, write + n, memory_order_release);
+    atomic_fetch_add_explicit(&ring->written, n, memory_order_relaxed);
+    if (n < count) {
+        atomic_fetch_add_explicit(&ring->overruns, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&ring->overrun_samples, count - n, memory_order_relaxed);
+    }
+    return n;
+}
+
+void audio_ring_read(audio_ring_t* ring, int16_t* out, uint32_t count) {
+    uint32_t read = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+    uint32_t write = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+    uint32_t avail = write - read;
+
+    uint32_t n = count < avail ? count : avail;
+    uint32_t index = read & (ring->capacity - 1);
+    uint32_t first = ring->capacity - index < n ? ring->capacity - index : n;
+    memcpy(out, ring->samples + index, first * sizeof(int16_t));
+    memcpy(out + first, ring->samples, (n - first) * sizeof(int16_t));
+    atomic_store_explicit(&ring->read_pos, read + n, memory_order_release);
+
+    if (n > 0) {
+        ring->last = out[n - 1];
+    }
+    if (n < count) {
+        // Holding the last sample avoids a click
+        for (uint32_t i = n; i < count; ++i) {
+            out[i] = ring->last;
+        }
+        atomic_fetch_add_explicit(&ring->underruns, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&ring->underrun_samples, count - n, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&ring->played, count, memory_order_relaxed);
+}
+
+uint32_t audio_ring_fill(audio_ring_t* ring) {
+    return atomic_load_explicit(&ring->write_pos, memory_order_acquire) -
+           atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+}
+
+double audio_ring_rate_ratio(audio_ring_t* ring) {
+    double error = ((double) ring->target_fill - audio_ring_fill(ring)) / ring->target_fill;
+    if (error > 1) {
+        error = 1;
+    } else if (error < -1) {
+        error = -1;
+    }
+    return 1 + ring->max_deviation * error;
+}
+
+void audio_ring_stats(audio_ring_t* ring, audio_ring_stats_t* out) {
+    out->written = atomic_load_explicit(&ring->written, memory_order_relaxed);
+    out->played = atomic_load_explicit(&ring->played, memory_order_relaxed);
+    out->underruns = atomic_load_explicit(&ring->underruns, memory_order_relaxed);
+    out->underrun_samples = atomic_load_explicit(&ring->underrun_samples, memory_order_relaxed);
+    out->overruns = atomic_load_explicit(&ring->overruns, memory_order_relaxed);
+    out->overrun_samples = atomic_load_explicit(&ring->overrun_samples, memory_order_relaxed);
+}
+
+void audio_ring_free(audio_ring_t* ring) {
+    wn_free(ring->samples);
+    ring->samples = NULL;
+}
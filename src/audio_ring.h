@@ -0,0 +1,86 @@
+//
+// Lock-free sample ring between the emulation thread and the audio callback
+//
+
+#ifndef WINES_AUDIO_RING_H
+#define WINES_AUDIO_RING_H
+
+#include <stdatomic.h>
+
+#include "common.h"
+
+/*
+ * Single producer (emulation thread), single consumer (audio callback). Both sides only publish
+ * their own index, so the callback never waits for the emulation.
+ *
+ * The emulation runs on its own timer, which drifts against the audio clock. Dynamic rate control
+ * keeps the ring around its target fill: the producer resamples by a ratio that deviates from 1
+ * by at most max_deviation, proportionally to the fill error. The pitch change is inaudible and
+ * the ring neither runs dry (underrun, the callback repeats the last sample) nor overflows
+ * (overrun, new samples are dropped).
+ *
+ * Reference:
+ * https://docs.libretro.com/development/cores/dynamic-rate-control/
+ */
+typedef struct {
+    int16_t* samples;
+    // Power of two
+    uint32_t capacity;
+
+    // Free-running sample counts, each written by one side only
+    atomic_uint_fast32_t write_pos;
+    atomic_uint_fast32_t read_pos;
+
+    // Owned by the consumer, played on underrun
+    int16_t last;
+
+    uint32_t target_fill;
+    double max_deviation;
+
+    // Counters
+    atomic_uint_fast64_t written;
+    atomic_uint_fast64_t played;
+    // Callbacks that could not be filled entirely, and the samples missing
+    atomic_uint_fast64_t underruns;
+    atomic_uint_fast64_t underrun_samples;
+    // Writes that did not fit entirely, and the samples dropped
+    atomic_uint_fast64_t overruns;
+    atomic_uint_fast64_t overrun_samples;
+} audio_ring_t;
+
+typedef struct {
+    uint64_t written;
+    uint64_t played;
+    uint64_t underruns;
+    uint64_t underrun_samples;
+    uint64_t overruns;
+    uint64_t overrun_samples;
+} audio_ring_stats_t;
+
+/**
+ * `capacity` is rounded up to a power of two, `target_fill` samples are aimed at
+ */
+void audio_ring_init(audio_ring_t* ring, uint32_t capacity, uint32_t target_fill, double max_deviation);
+
+/**
+ * Producer: appends up to `count` samples, returns the number written
+ */
+uint32_t audio_ring_write(audio_ring_t* ring, const int16_t* samples, uint32_t count);
+
+/**
+ * Consumer: fills `out` with `count` samples, padding with the last sample on underrun
+ */
+void audio_ring_read(audio_ring_t* ring, int16_t* out, uint32_t count);
+
+uint32_t audio_ring_fill(audio_ring_t* ring);
+
+/**
+ * Producer: resampling ratio to apply to the next samples, > 1 produces more
+ */
+double audio_ring_rate_ratio(audio_ring_t* ring);
+
+void audio_ring_stats(audio_ring_t* ring, audio_ring_stats_t* out);
+
+void audio_ring_free(audio_ring_t* ring);
+
+#endif //WINES_AUDIO_RING_H
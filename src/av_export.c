@@ -0,0 +1,215 @@
+//
+// Headless video/audio export: Y4M or raw RGB24 video, WAV audio
+//
+// Frames are converted straight from the PPU frame buffer into a batch buffer allocated once,
+// which is handed to the file in one large write every VIDEO_BATCH_FRAMES frames.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "av_export.h"
+#include "platform.h"
+#include "wines.h"
+
+#define VIDEO_BATCH_FRAMES  16
+#define AUDIO_BATCH_SAMPLES (64 * 1024)
+
+#define FRAME_PIXELS        (PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT)
+
+// NTSC frame rate 60.0988 as an exact ratio
+#define Y4M_HEADER  "YUV4MPEG2 W256 H240 F39375000:655171 Ip A8:7 C444\n"
+#define Y4M_FRAME   "FRAME\n"
+
+#define WAV_HEADER_SIZE 44
+
+struct av_export {
+    video_export_format_t format;
+
+    wn_file_t* video;
+    uint8_t* video_batch;
+    size_t video_frame_size;
+    uint32_t video_batch_count;
+
+    // Palette index -> Y/U/V or R/G/B
+    uint8_t color_lut[64][3];
+
+    wn_file_t* wav;
+    uint32_t sample_rate;
+    int16_t* audio_batch;
+    size_t audio_batch_count;
+    uint32_t audio_samples;
+};
+
+static void video_lut_init(av_export_t* export) {
+    for (int i = 0; i < 64; ++i) {
+        int r = (DEFAULT_PALETTES[i] >> 16) & 0xFF;
+        int g = (DEFAULT_PALETTES[i] >> 8) & 0xFF;
+        int b = DEFAULT_PALETTES[i] & 0xFF;
+        if (export->format == VIDEO_EXPORT_RGB24) {
+            export->color_lut[i][0] = r;
+            export->color_lut[i][1] = g;
+            export->color_lut[i][2] = b;
+        } else {
+            // BT.601 limited range
+            export->color_lut[i][0] = (uint8_t) (16 + (65.481 * r + 128.553 * g + 24.966 * b) / 255 + 0.5);
+            export->color_lut[i][1] = (uint8_t) (128 + (-37.797 * r - 74.203 * g + 112.0 * b) / 255 + 0.5);
+            export->color_lut[i][2] = (uint8_t) (128 + (112.0 * r - 93.786 * g - 18.214 * b) / 255 + 0.5);
+        }
+    }
+}
+
+static void put_le16(uint8_t* p, uint16_t val) {
+    p[0] = val;
+    p[1] = val >> 8;
+}
+
+static void put_le32(uint8_t* p, uint32_t val) {
+    put_le16(p, val);
+    put_le16(p + 2, val >> 16);
+}
+
+static void wav_write_header(av_export_t* export) {
+    uint32_t data_size = export->audio_samples * sizeof(int16_t);
+    uint8_t header[WAV_HEADER_SIZE];
+    memcpy(header, "RIFF", 4);
+    put_le32(header + 4, 36 + data_size);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le32(header + 16, 16);                          // fmt chunk size
+    put_le16(header + 20, 1);                           // PCM
+    put_le16(header + 22, 1);                           // mono
+    put_le32(header + 24, export->sample_rate);
+    put_le32(header + 28, export->sample_rate * 2);     // byte rate
+    put_le16(header + 32, 2);                           // block align
+    put_le16(header + 34, 16);                          // bits per sample
+    memcpy(header + 36, "data", 4);
+    put_le32(header + 40, data_size);
+    export->wav->write(export->wav, header, sizeof(header));
+}
+
+static void video_flush(av_export_t* export) {
+    if (export->video_batch_count > 0) {
+        export->video->write(export->video, export->video_batch, export->video_frame_size * export->video_batch_count);
+        export->video_batch_count = 0;
+    }
+}
+
+static void audio_flush(av_export_t* export) {
+    if (export->audio_batch_count > 0) {
+        export->wav->write(export->wav, export->audio_batch, export->audio_batch_count * sizeof(int16_t));
+        export->audio_batch_count = 0;
+    }
+}
+
+av_export_t* av_export_open(const char* video_filename, video_export_format_t format,
+                            const char* wav_filename, uint32_t sample_rate) {
+    av_export_t* export = wn_calloc(sizeof(av_export_t));
+    export->format = format;
+    export->sample_rate = sample_rate;
+
+    if (video_filename != NULL) {
+        export->video = open_file(video_filename, "wb");
+        if (export->video == NULL) {
+            av_export_close(export);
+            return NULL;
+        }
+        export->video_frame_size = FRAME_PIXELS * 3;
+        if (format == VIDEO_EXPORT_Y4M) {
+            export->video_frame_size += strlen(Y4M_FRAME);
+            export->video->write(export->video, Y4M_HEADER, strlen(Y4M_HEADER));
+        }
+        export->video_batch = wn_malloc(export->video_frame_size * VIDEO_BATCH_FRAMES);
+        video_lut_init(export);
+    }
+
+    if (wav_filename != NULL) {
+        export->wav = open_file(wav_filename, "wb");
+        if (export->wav == NULL) {
+            av_export_close(export);
+            return NULL;
+        }
+        // Sizes are patched on close when the output is seekable
+        wav_write_header(export);
+        export->audio_batch = wn_malloc(AUDIO_BATCH_SAMPLES * sizeof(int16_t));
+    }
+    return export;
+}
+
+void av_export_frame(av_export_t* export, const ppu_t* ppu) {
+    if (export->video == NULL) {
+        return;
+    }
+
+    uint8_t* out = export->video_batch + export->video_frame_size * export->video_batch_count;
+    const uint8_t* pixels = &ppu->frame[0][0];
+    if (export->format == VIDEO_EXPORT_Y4M) {
+        memcpy(out, Y4M_FRAME, strlen(Y4M_FRAME));
+        out += strlen(Y4M_FRAME);
+        // Planar Y, U, V
+        for (int plane = 0; plane < 3; ++plane) {
+            for (int i = 0; i < FRAME_PIXELS; ++i) {
+                out[i] = export->color_lut[pixels[i] & 0x3F][plane];
+            }
+            out += FRAME_PIXELS;
+        }
+    } else {
+        for (int i = 0; i < FRAME_PIXELS; ++i) {
+            memcpy(out + i * 3, export->color_lut[pixels[i] & 0x3F], 3);
+        }
+    }
+
+    if (++export->video_batch_count == VIDEO_BATCH_FRAMES) {
+        video_flush(export);
+    }
+}
+
+void av_export_audio(av_export_t* export, const int16_t* samples, size_t count) {
+    if (export->wav == NULL) {
+        return;
+    }
+    export->audio_samples += count;
+    while (count > 0) {
+        size_t n = AUDIO_BATCH_SAMPLES - export->audio_batch_count;
+        if (n > count) {
+            n = count;
+        }
+        memcpy(export->audio_batch + export->audio_batch_count, samples, n * sizeof(int16_t));
+        export->audio_batch_count += n;
+        samples += n;
+        count -= n;
+        if (export->audio_batch_count == AUDIO_BATCH_SAMPLES) {
+            audio_flush(export);
+        }
+    }
+}
+
+void av_export_hook(wines_t* nes, void* userdata) {
+    av_export_t* export = userdata;
+    av_export_frame(export, nes->ppu);
+
+    int16_t samples[1024];
+    uint32_t count;
+    while ((count = apu_read_samples(nes->apu, samples, 1024)) > 0) {
+        av_export_audio(export, samples, count);
+    }
+}
+
+void av_export_close(av_export_t* export) {
+    if (export == NULL) {
+        return;
+    }
+    if (export->video != NULL) {
+        video_flush(export);
+        export->video->close(export->video);
+    }
+    if (export->wav != NULL) {
+        audio_flush(export);
+        if (export->wav->seek(export->wav, 0, SEEK_SET) == 0) {
+            wav_write_header(export);
+        }
+        export->wav->close(export->wav);
+    }
+    wn_free(export->video_batch);
+    wn_free(export->audio_batch);
+    wn_free(export);
+}
@@ -0,0 +1,47 @@
+//
+// Headless video/audio export: Y4M or raw RGB24 video, WAV audio
+//
+
+#ifndef WINES_AV_EXPORT_H
+#define WINES_AV_EXPORT_H
+
+#include "common.h"
+#include "ppu.h"
+
+typedef struct wines wines_t;
+
+typedef enum {
+    VIDEO_EXPORT_Y4M = 0,   // YUV 4:4:4, "ffmpeg -i out.y4m"
+    VIDEO_EXPORT_RGB24,     // "ffmpeg -f rawvideo -pixel_format rgb24 -video_size 256x240 -framerate 60.0988 -i out.rgb"
+} video_export_format_t;
+
+typedef struct av_export av_export_t;
+
+/**
+ * Opens the outputs, either filename may be NULL to skip that stream, "-" writes to stdout.
+ * Returns NULL if an output cannot be opened.
+ */
+av_export_t* av_export_open(const char* video_filename, video_export_format_t format,
+                            const char* wav_filename, uint32_t sample_rate);
+
+/**
+ * Appends the PPU frame buffer to the video stream
+ */
+void av_export_frame(av_export_t* export, const ppu_t* ppu);
+
+/**
+ * Appends signed 16-bit mono samples to the WAV stream
+ */
+void av_export_audio(av_export_t* export, const int16_t* samples, size_t count);
+
+/**
+ * Frame hook (see wines_set_frame_hook) exporting every frame and its samples, `userdata` is the av_export_t
+ */
+void av_export_hook(wines_t* nes, void* userdata);
+
+/**
+ * Flushes the pending data, finalizes the WAV header and closes the outputs
+ */
+void av_export_close(av_export_t* export);
+
+#endif //WINES_AV_EXPORT_H
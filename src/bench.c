@@ -0,0 +1,280 @@
+//
+// Benchmark harness, run with: WiNes --bench <rom> [frames]
+//
+
+#include <stdio.h>
+
+#include "bench.h"
+#include "frame_hash.h"
+#include "platform.h"
+#include "rewind_buffer.h"
+#include "run_ahead.h"
+#include "state.h"
+#include "wines.h"
+
+static void bench_report(const char* name, uint32_t frames, uint64_t ns) {
+    double fps = frames * 1e9 / (double) ns;
+    printf("%-24s %8u frames %10.3f ms %10.1f fps %8.2fx realtime\n",
+           name, frames, ns / 1e6, fps, fps / NES_FRAME_RATE);
+}
+
+static void bench_frame_skip(wines_t* nes, const char* name, uint32_t frames, uint8_t frame_skip) {
+    wines_set_frame_skip(nes, frame_skip);
+    uint64_t begin = wn_time_ns();
+    for (uint32_t i = 0; i < frames; ++i) {
+        wines_run_frame(nes);
+    }
+    bench_report(name, frames, wn_time_ns() - begin);
+}
+
+/*
+ * Emulation throughput with pixel generation, with frame skipping, with deferred rendering,
+ * from the nametable cache, in render-less mode and with cheats loaded
+ */
+static void bench_render(wines_t* nes, uint32_t frames) {
+    bench_frame_skip(nes, "render", frames, 0);
+    bench_frame_skip(nes, "render 1/4 (skip 3)", frames, 3);
+
+    wines_set_deferred(nes, true);
+    bench_frame_skip(nes, "render deferred", frames, 0);
+    wines_set_deferred(nes, false);
+
+    ppu_set_nt_cache(nes->ppu, true);
+    bench_frame_skip(nes, "render nametable cache", frames, 0);
+    ppu_set_nt_cache(nes->ppu, false);
+
+    ppu_set_render(nes->ppu, false);
+    uint64_t begin = wn_time_ns();
+    for (uint32_t i = 0; i < frames; ++i) {
+        wines_step_frame(nes);
+    }
+    bench_report("render-less", frames, wn_time_ns() - begin);
+
+    // A ROM code in every PRG slot and a RAM freeze, compare with the run above
+    wines_add_cheat(nes, "8000:EA");
+    wines_add_cheat(nes, "A000:EA");
+    wines_add_cheat(nes, "C000?00:EA");
+    wines_add_cheat(nes, "E000?00:EA");
+    wines_add_cheat(nes, "07FF:00");
+    begin = wn_time_ns();
+    for (uint32_t i = 0; i < frames; ++i) {
+        wines_step_frame(nes);
+    }
+    bench_report("render-less cheats", frames, wn_time_ns() - begin);
+    wines_clear_cheats(nes);
+}
+
+/*
+ * Cost of hashing frame buffer, CPU RAM and VRAM at the end of every frame
+ */
+static void bench_frame_hash(wines_t* nes, uint32_t frames) {
+    frame_hash_ctx_t ctx = {.flags = FRAME_HASH_FRAME | FRAME_HASH_RAM | FRAME_HASH_VRAM};
+    uint64_t begin = wn_time_ns();
+    for (uint32_t i = 0; i < frames; ++i) {
+        frame_hash_hook(nes, &ctx);
+    }
+    uint64_t ns = wn_time_ns() - begin;
+    printf("%-24s %8u frames %10.3f us/frame\n", "frame hash", frames, ns / 1e3 / frames);
+}
+
+/*
+ * Saving a state every frame, then loading it back as often
+ */
+static void bench_state(wines_t* nes, uint32_t frames) {
+    size_t size = wn_state_size(nes);
+    uint8_t* buf = wn_malloc(size);
+    uint64_t save_ns = 0;
+    for (uint32_t i = 0; i < frames; ++i) {
+        wines_step_frame(nes);
+        uint64_t begin = wn_time_ns();
+        wn_state_save(nes, buf, size);
+        save_ns += wn_time_ns() - begin;
+    }
+    uint64_t begin = wn_time_ns();
+    for (uint32_t i = 0; i < frames; ++i) {
+        wn_state_load(nes, buf, size);
+    }
+    uint64_t load_ns = wn_time_ns() - begin;
+    printf("%-24s %8u frames %10.3f us/save %8.3f us/load %8zu bytes\n", "save state", frames,
+           save_ns / 1e3 / frames, load_ns / 1e3 / frames, size);
+    wn_free(buf);
+}
+
+/*
+ * Rewind history of every frame: push cost against the emulation of the frame, ring space for a minute,
+ * then stepping all the way back
+ */
+static void bench_rewind(wines_t* nes, uint32_t frames) {
+    rewind_buffer_t* rewind = rewind_buffer_create(nes, frames, (size_t) REWIND_BUFFER_BYTES_PER_SECOND * 60);
+    uint64_t frame_ns = 0, push_ns = 0;
+    for (uint32_t i = 0; i < frames; ++i) {
+        uint64_t begin = wn_time_ns();
+        wines_step_frame(nes);
+        uint64_t end = wn_time_ns();
+        rewind_buffer_push(rewind);
+        frame_ns += end - begin;
+        push_ns += wn_time_ns() - end;
+    }
+    uint32_t kept = rewind_buffer_frames(rewind);
+    double per_frame = kept > 0 ? (double) rewind_buffer_used(rewind) / kept : 0;
+    printf("%-24s %8u frames %10.3f us/push %8.2f%% of render-less %8.0f bytes/frame %6.2f MB/minute\n",
+           "rewind push", frames, push_ns / 1e3 / frames, 100.0 * push_ns / frame_ns, per_frame,
+           per_frame * NES_FRAME_RATE * 60 / (1024 * 1024));
+
+    uint64_t begin = wn_time_ns();
+    while (rewind_buffer_back(rewind)) {
+    }
+    uint64_t ns = wn_time_ns() - begin;
+    printf("%-24s %8u frames %10.3f us/frame\n", "rewind back", kept, kept > 0 ? ns / 1e3 / kept : 0);
+    rewind_buffer_destroy(rewind);
+}
+
+/*
+ * Run-ahead by restoring the state and on a second console, cost of each frame run ahead
+ */
+static void bench_run_ahead(wines_t* nes, uint32_t frames) {
+    static const uint8_t AHEAD[] = {1, 2, 4};
+    for (int second = 0; second < 2; ++second) {
+        for (size_t i = 0; i < sizeof(AHEAD) / sizeof(AHEAD[0]); ++i) {
+            run_ahead_t* run_ahead = run_ahead_create(nes, AHEAD[i], second);
+            if (run_ahead == NULL) {
+                continue;
+            }
+            for (uint32_t k = 0; k < frames; ++k) {
+                run_ahead_frame(run_ahead);
+                run_ahead_read_samples(run_ahead, NULL, RUN_AHEAD_SAMPLE_BUFFER);
+            }
+            run_ahead_stats_t stats;
+            run_ahead_stats(run_ahead, &stats);
+            char name[32];
+            snprintf(name, sizeof(name), "run-ahead %u%s", AHEAD[i], second ? " 2nd instance" : "");
+            printf("%-24s %8u frames %10.3f us/frame %8.3f us/frame ahead\n", name, frames,
+                   (stats.frame_ns + stats.ahead_ns) / 1e3 / frames, run_ahead_frame_cost_ns(run_ahead) / 1e3);
+            run_ahead_destroy(run_ahead);
+        }
+    }
+}
+
+/*
+ * APU synthesis with the four tone channels playing notes that change every frame.
+ * The APU is driven directly, its time is advanced past the CPU's: run it last.
+ */
+static void bench_apu(wines_t* nes, uint32_t frames) {
+    apu_t* apu = nes->apu;
+    uint64_t time = apu->time;
+    int16_t samples[2048];
+
+    uint64_t begin = wn_time_ns();
+    apu_write(apu, time, 0x4015, 0x0F);
+    apu_write(apu, time, 0x4000, 0xBF);
+    apu_write(apu, time, 0x4004, 0x7F);
+    apu_write(apu, time, 0x4008, 0xFF);
+    apu_write(apu, time, 0x400C, 0x3F);
+    for (uint32_t i = 0; i < frames; ++i) {
+        uint16_t period = 200 + (i * 37) % 600;
+        apu_write(apu, time, 0x4002, period & 0xFF);
+        apu_write(apu, time, 0x4003, 0xF8 | (period >> 8));
+        apu_write(apu, time + 100, 0x4006, (period >> 1) & 0xFF);
+        apu_write(apu, time + 100, 0x4007, 0xF8 | (period >> 9));
+        apu_write(apu, time + 200, 0x400A, period & 0xFF);
+        apu_write(apu, time + 200, 0x400B, 0xF8 | (period >> 8));
+        apu_write(apu, time + 300, 0x400E, i & 0x0F);
+        apu_write(apu, time + 300, 0x400F, 0xF8);
+
+        // NTSC frame
+        time += 29781;
+        apu_end_frame(apu, time);
+        while (apu_read_samples(apu, samples, 2048) > 0) {
+        }
+    }
+    uint64_t ns = wn_time_ns() - begin;
+    printf("%-24s %8u frames %10.3f us/frame\n", "apu synthesis", frames, ns / 1e3 / frames);
+}
+
+/*
+ * Polyphase resampler throughput per quality preset, 2x oversampled synthesis rate to 48 kHz
+ */
+static void bench_resampler(void) {
+    static const char* NAMES[RESAMPLER_QUALITY_COUNT] = {"fast", "medium", "high", "best"};
+    const uint32_t in_rate = APU_DEFAULT_SAMPLE_RATE * APU_RESAMPLER_OVERSAMPLING;
+    const uint32_t block = 4096;
+    const uint32_t blocks = 512;
+
+    int16_t in[4096];
+    int16_t out[4096];
+    for (uint32_t i = 0; i < block; ++i) {
+        // Square wave with a bit of noise
+        in[i] = (int16_t) (((i / 109) & 1 ? 6000 : -6000) + (int16_t) (i * 7919 % 512));
+    }
+
+    for (uint8_t q = 0; q < RESAMPLER_QUALITY_COUNT; ++q) {
+        resampler_t* resampler = resampler_create(in_rate, APU_DEFAULT_SAMPLE_RATE, q);
+        uint64_t produced = 0;
+        uint64_t begin = wn_time_ns();
+        for (uint32_t i = 0; i < blocks; ++i) {
+            produced += resampler_process(resampler, in, block, out);
+        }
+        uint64_t ns = wn_time_ns() - begin;
+        resampler_destroy(resampler);
+
+        char name[32];
+        snprintf(name, sizeof(name), "resampler %s (%s)", NAMES[q], resampler_kernel_name());
+        printf("%-24s %8llu samples %8.2f Msamples/s %8.0fx realtime\n", name, (unsigned long long) produced,
+               produced * 1e3 / (double) ns, produced * 1e9 / (double) ns / APU_DEFAULT_SAMPLE_RATE);
+    }
+}
+
+/*
+ * Consoles of one process running a shared ROM image: creation cost and render-less throughput of all of them
+ */
+static void bench_shared(const char* rom_filename, uint32_t frames) {
+    enum { CONSOLES = 32 };
+    cart_image_t* image;
+    if (cart_image_load(rom_filename, &image) != ERR_OK) {
+        return;
+    }
+
+    wines_t* consoles[CONSOLES];
+    uint64_t begin = wn_time_ns();
+    for (uint32_t i = 0; i < CONSOLES; ++i) {
+        wines_create_shared(image, &consoles[i]);
+        ppu_set_render(consoles[i]->ppu, false);
+    }
+    uint64_t created = wn_time_ns() - begin;
+    cart_image_release(image);
+
+    begin = wn_time_ns();
+    for (uint32_t i = 0; i < frames; ++i) {
+        wines_step_frame(consoles[i % CONSOLES]);
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "render-less x%d shared", CONSOLES);
+    bench_report(name, frames, wn_time_ns() - begin);
+    printf("%-24s %8d consoles %10.3f us/console %8.1f KB/console\n", "shared image create", CONSOLES,
+           created / 1e3 / CONSOLES, consoles[0]->arena.size / 1024.0);
+
+    for (uint32_t i = 0; i < CONSOLES; ++i) {
+        wines_destroy(consoles[i]);
+    }
+}
+
+int wines_bench(const char* rom_filename, uint32_t frames) {
+    wines_t* nes;
+    err_t err = wines_create(rom_filename, &nes);
+    if (err != ERR_OK) {
+        printf("Failed to load %s: %d\n", rom_filename, err);
+        return err;
+    }
+
+    bench_render(nes, frames);
+    bench_shared(rom_filename, frames);
+    bench_frame_hash(nes, frames);
+    bench_state(nes, frames);
+    bench_rewind(nes, frames);
+    bench_run_ahead(nes, frames);
+    bench_apu(nes, frames);
+    bench_resampler();
+
+    wines_destroy(nes);
+    return 0;
+}
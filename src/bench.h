@@ -0,0 +1,12 @@
+//
+// Benchmark harness, run with: WiNes --bench <rom> [frames]
+//
+
+#ifndef WINES_BENCH_H
+#define WINES_BENCH_H
+
+#include "common.h"
+
+int wines_bench(const char* rom_filename, uint32_t frames);
+
+#endif //WINES_BENCH_H
@@ -0,0 +1,188 @@
+//
+// Band-limited step synthesis buffer
+//
+
+#include <math.h>
+#include <string.h>
+
+#include "blip.h"
+
+// Time -> sample position, 32.32 fixed point
+#define TIME_BITS       32
+#define TIME_UNIT       ((uint64_t) 1 << TIME_BITS)
+
+// Sub-sample phases of the kernel
+#define PHASE_BITS      5
+#define PHASE_COUNT     (1 << PHASE_BITS)
+
+// Kernel width in samples, a delta touches KERNEL_WIDTH samples of the buffer
+#define KERNEL_WIDTH    16
+
+#define KERNEL_BITS     15
+
+// Leaky integrator, removes DC (about 20 Hz high-pass at 48 kHz)
+#define BASS_SHIFT      9
+
+// Output samples are 16-bit, deltas are in units of 1/65536 full scale
+#define DELTA_SHIFT     1
+
+struct blip {
+    uint64_t factor;
+    // Position of the start of the current frame, from the first unread sample
+    uint64_t offset;
+    uint32_t avail;
+    uint32_t size;
+    int32_t integrator;
+    // Band-limited impulse per phase, each row sums to 1 << KERNEL_BITS
+    int16_t kernel[PHASE_COUNT][KERNEL_WIDTH];
+    // Differences of the output, size + KERNEL_WIDTH
+    int32_t* buf;
+};
+
+/*
+ * Blackman-windowed sinc impulse, low-passed a bit below Nyquist
+ */
+static void blip_init_kernel(blip_t* blip) {
+    const double cutoff = 0.9;
+    for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+        double taps[KERNEL_WIDTH];
+        double sum = 0;
+        for (int i = 0; i < KERNEL_WIDTH; ++i) {
+            // Distance of tap i to the step, in samples
+            double x = i - KERNEL_WIDTH / 2 + 1 - (double) phase / PHASE_COUNT;
+            double w = (x + KERNEL_WIDTH / 2.0) / KERNEL_WIDTH;
+            double window = w <= 0 || w >= 1 ? 0 : 0.42 - 0.5 * cos(2 * WN_PI * w) + 0.08 * cos(4 * WN_PI * w);
+            double sinc = x == 0 ? 1 : sin(WN_PI * cutoff * x) / (WN_PI * cutoff * x);
+            taps[i] = sinc * window;
+            sum += taps[i];
+        }
+
+        // Normalized with the rounding error spread over the taps, so each row adds exactly the delta
+        int32_t total = 0;
+        for (int i = 0; i < KERNEL_WIDTH; ++i) {
+            blip->kernel[phase][i] = (int16_t) lround(taps[i] / sum * (1 << KERNEL_BITS));
+            total += blip->kernel[phase][i];
+        }
+        blip->kernel[phase][KERNEL_WIDTH / 2 - 1] += (1 << KERNEL_BITS) - total;
+    }
+}
+
+blip_t* blip_create(uint32_t max_samples) {
+    blip_t* blip = wn_calloc(sizeof(blip_t));
+    blip->size = max_samples;
+    blip->buf = wn_calloc((max_samples + KERNEL_WIDTH) * sizeof(int32_t));
+    blip->factor = TIME_UNIT / 64;
+    blip_init_kernel(blip);
+    return blip;
+}
+
+void blip_set_rates(blip_t* blip, double clock_rate, double sample_rate) {
+    blip->factor = (uint64_t) ceil(sample_rate / clock_rate * (double) TIME_UNIT);
+}
+
+void blip_add_delta(blip_t* blip, uint32_t time, int32_t delta) {
+    uint64_t pos = time * blip->factor + blip->offset;
+    uint32_t index = (uint32_t) (pos >> TIME_BITS);
+    if (delta == 0 || index >= blip->size) {
+        // Past the end of the buffer, blip_clocks_left was not respected
+        return;
+    }
+
+    const int16_t* kernel = blip->kernel[(pos >> (TIME_BITS - PHASE_BITS)) & (PHASE_COUNT - 1)];
+    int32_t* out = blip->buf + index;
+    for (int i = 0; i < KERNEL_WIDTH; ++i) {
+        out[i] += (int32_t) (((int64_t) delta * kernel[i]) >> KERNEL_BITS);
+    }
+}
+
+void blip_end_frame(blip_t* blip, uint32_t clocks) {
+    blip->offset += clocks * blip->factor;
+    blip->avail = (uint32_t) (blip->offset >> TIME_BITS);
+    if (blip->avail > blip->size) {
+        blip->avail = blip->size;
+        blip->offset = (uint64_t) blip->size << TIME_BITS;
+    }
+}
+
+uint32_t blip_samples_avail(const blip_t* blip) {
+    return blip->avail;
+}
+
+uint32_t blip_clocks_left(const blip_t* blip) {
+    uint64_t needed = ((uint64_t) blip->size << TIME_BITS) - blip->offset;
+    return (uint32_t) (needed / blip->factor);
+}
+
+uint32_t blip_read_samples(blip_t* blip, int16_t* out, uint32_t count) {
+    if (count > blip->avail) {
+        count = blip->avail;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    int32_t sum = blip->integrator;
+    for (uint32_t i = 0; i < count; ++i) {
+        sum += blip->buf[i];
+        int32_t s = sum >> DELTA_SHIFT;
+        if (out != NULL) {
+            out[i] = (int16_t) (s < INT16_MIN ? INT16_MIN : s > INT16_MAX ? INT16_MAX : s);
+        }
+        sum -= sum >> BASS_SHIFT;
+    }
+    blip->integrator = sum;
+
+    // Shift out the samples read, deltas of the current frame may lie anywhere after them
+    uint32_t remain = blip->size + KERNEL_WIDTH - count;
+    memmove(blip->buf, blip->buf + count, remain * sizeof(int32_t));
+    memset(blip->buf + remain, 0, count * sizeof(int32_t));
+    blip->avail -= count;
+    blip->offset -= (uint64_t) count << TIME_BITS;
+    return count;
+}
+
+void blip_clear(blip_t* blip) {
+    blip->offset = 0;
+    blip->avail = 0;
+    blip->integrator = 0;
+    memset(blip->buf, 0, (blip->size + KERNEL_WIDTH) * sizeof(int32_t));
+}
+
+typedef struct {
+    uint64_t offset;
+    uint32_t avail;
+    int32_t integrator;
+    // Leading differences saved
+    uint32_t count;
+} blip_state_t;
+
+size_t blip_state_size(const blip_t* blip) {
+    return sizeof(blip_state_t) + (blip->size + KERNEL_WIDTH) * sizeof(int32_t);
+}
+
+size_t blip_save(const blip_t* blip, void* out) {
+    // The last step of the ended frames starts at the sample after the frame and spans the kernel
+    blip_state_t state = {blip->offset, blip->avail, blip->integrator,
+                          (uint32_t) (blip->offset >> TIME_BITS) + KERNEL_WIDTH};
+    memcpy(out, &state, sizeof(state));
+    memcpy((uint8_t*) out + sizeof(state), blip->buf, state.count * sizeof(int32_t));
+    return sizeof(state) + state.count * sizeof(int32_t);
+}
+
+size_t blip_load(blip_t* blip, const void* in) {
+    blip_state_t state;
+    memcpy(&state, in, sizeof(state));
+    blip->offset = state.offset;
+    blip->avail = state.avail;
+    blip->integrator = state.integrator;
+    memcpy(blip->buf, (const uint8_t*) in + sizeof(state), state.count * sizeof(int32_t));
+    memset(blip->buf + state.count, 0, (blip->size + KERNEL_WIDTH - state.count) * sizeof(int32_t));
+    return sizeof(state) + state.count * sizeof(int32_t);
+}
+
+void blip_destroy(blip_t* blip) {
+    if (blip != NULL) {
+        wn_free(blip->buf);
+        wn_free(blip);
+    }
+}
@@ -0,0 +1,72 @@
+//
+// Band-limited step synthesis buffer
+//
+
+#ifndef WINES_BLIP_H
+#define WINES_BLIP_H
+
+#include "common.h"
+
+/*
+ * Sound is described as amplitude changes (deltas) at clock times instead of one value per clock.
+ * Each delta is added as a band-limited step, so the output is alias-free at the sample rate
+ * and the cost only depends on the number of amplitude changes.
+ *
+ * Time is counted in source clocks from the start of the current frame; blip_end_frame makes
+ * the samples of the frame available and starts the next frame.
+ */
+typedef struct blip blip_t;
+
+/**
+ * Buffer holding up to `max_samples` output samples
+ */
+blip_t* blip_create(uint32_t max_samples);
+
+void blip_set_rates(blip_t* blip, double clock_rate, double sample_rate);
+
+/**
+ * Adds an amplitude change at `time` clocks into the current frame
+ */
+void blip_add_delta(blip_t* blip, uint32_t time, int32_t delta);
+
+/**
+ * Ends the current frame after `clocks` clocks
+ */
+void blip_end_frame(blip_t* blip, uint32_t clocks);
+
+/**
+ * Number of samples that can be read
+ */
+uint32_t blip_samples_avail(const blip_t* blip);
+
+/**
+ * Number of clocks the current frame can last before the buffer is full
+ */
+uint32_t blip_clocks_left(const blip_t* blip);
+
+/**
+ * Reads up to `count` samples, NULL discards them. Returns the number of samples read.
+ */
+uint32_t blip_read_samples(blip_t* blip, int16_t* out, uint32_t count);
+
+void blip_clear(blip_t* blip);
+
+/**
+ * Largest size of the state saved by blip_save
+ */
+size_t blip_state_size(const blip_t* blip);
+
+/**
+ * Saves the samples not read yet, the steps pending from the ended frames and the integrator,
+ * returns the size written. Steps added since the last blip_end_frame are not kept.
+ */
+size_t blip_save(const blip_t* blip, void* out);
+
+/**
+ * Restores a state of blip_save, returns its size
+ */
+size_t blip_load(blip_t* blip, const void* in);
+
+void blip_destroy(blip_t* blip);
+
+#endif //WINES_BLIP_H
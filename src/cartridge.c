@@ -2,20 +2,143 @@
 // Created by WangKZ on 2024/4/1.
 //
 
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
 #include "cartridge.h"
-#include "platform.h"
 
 #define PRG_ROM_BLOCK_SIZE 0x4000   // 16KB
 #define CHR_ROM_BLOCK_SIZE 0x2000   // 8KB
+#define TRAINER_SIZE       512
+#define PRG_RAM_MIN_SIZE   0x2000   // 8KB
+#define SAV_PAGE_SIZE      0x1000   // 4KB
 
-err_t cart_load_rom(const char* rom_filename, cart_t* cart) {
-    if (rom_filename == NULL || cart == NULL) {
-        return ERR_NULLPTR;
+/*
+ * NES 2.0 byte 10: PRG RAM (low nibble) and battery-backed PRG NVRAM (high nibble) sizes, 64 << shift bytes.
+ * iNES 1.0 headers get the customary 8KB.
+ */
+static uint32_t cart_prg_ram_size(const nes_header_t* header) {
+    uint32_t size = PRG_RAM_MIN_SIZE;
+    if (header->flags7.nes_20 == 2) {
+        uint8_t shift = header->flags6.battery_backed ? header->flag10 >> 4 : header->flag10 & 0x0F;
+        if (shift != 0 && (64u << shift) > size) {
+            size = 64u << shift;
+        }
     }
+    return size;
+}
 
+/**
+ * `<rom without extension>.sav`
+ */
+static char* cart_sav_filename(const char* rom_filename) {
+    size_t len = strlen(rom_filename);
+    const char* dot = strrchr(rom_filename, '.');
+    const char* slash = strrchr(rom_filename, '/');
+    if (dot != NULL && (slash == NULL || dot > slash)) {
+        len = dot - rom_filename;
+    }
+    char* sav_filename = wn_malloc(len + 5);
+    memcpy(sav_filename, rom_filename, len);
+    memcpy(sav_filename + len, ".sav", 5);
+    return sav_filename;
+}
+
+/**
+ * Maps the .sav file as the PRG RAM, falling back to plain memory when it cannot be mapped
+ */
+static void cart_map_sav(const char* rom_filename, cart_t* cart) {
+    char* sav_filename = cart_sav_filename(rom_filename);
+    cart->sav = wn_mmap_file(sav_filename, WN_MMAP_WRITE, cart->prg_ram_size);
+    if (cart->sav == NULL) {
+        fprintf(stderr, "Failed to map %s, the save will not persist\n", sav_filename);
+    } else {
+        cart->prg_ram = cart->sav->data;
+        cart->sav_shadow = wn_malloc(cart->prg_ram_size);
+        memcpy(cart->sav_shadow, cart->prg_ram, cart->prg_ram_size);
+    }
+    wn_free(sav_filename);
+}
+
+/**
+ * Copies what the .sav file holds into the PRG RAM, if there is one
+ */
+static void cart_read_sav(const char* rom_filename, cart_t* cart) {
+    char* sav_filename = cart_sav_filename(rom_filename);
+    wn_file_t* file = open_file(sav_filename, "rb");
+    if (file != NULL) {
+        file->read(file, cart->prg_ram, cart->prg_ram_size);
+        file->close(file);
+    }
+    wn_free(sav_filename);
+}
+
+/**
+ * Reads the whole file into memory, for what cannot be mapped (stdin, pipes)
+ */
+static uint8_t* cart_read_image(const char* rom_filename, size_t* out_size) {
     wn_file_t* file = open_file(rom_filename, "rb");
-    nes_header_t* header = &cart->header;
-    file->read(file, header, sizeof(nes_header_t));
+    if (file == NULL) {
+        return NULL;
+    }
+    size_t capacity = 0x10000;
+    size_t size = 0;
+    uint8_t* image = wn_malloc(capacity);
+    size_t n;
+    while ((n = file->read(file, image + size, capacity - size)) > 0) {
+        size += n;
+        if (size == capacity) {
+            uint8_t* grown = wn_malloc(capacity * 2);
+            memcpy(grown, image, size);
+            wn_free(image);
+            image = grown;
+            capacity *= 2;
+        }
+    }
+    file->close(file);
+    *out_size = size;
+    return image;
+}
+
+static void cart_image_free(cart_image_t* image) {
+    if (image->rom_map != NULL) {
+        wn_mmap_close(image->rom_map);
+    } else {
+        wn_free(image->rom_image);
+    }
+    wn_free(image->filename);
+    wn_free(image);
+}
+
+err_t cart_image_load(const char* rom_filename, cart_image_t** out) {
+    if (rom_filename == NULL || out == NULL) {
+        return ERR_NULLPTR;
+    }
+
+    // PRG and CHR ROM point straight into the read-only mapping
+    cart_image_t* image = wn_calloc(sizeof(cart_image_t));
+    const uint8_t* data;
+    size_t size;
+    image->rom_map = wn_mmap_file(rom_filename, WN_MMAP_READ, 0);
+    if (image->rom_map != NULL) {
+        data = image->rom_map->data;
+        size = image->rom_map->size;
+    } else {
+        image->rom_image = cart_read_image(rom_filename, &size);
+        if (image->rom_image == NULL) {
+            wn_free(image);
+            return ERR_FILE_NOT_EXISTS;
+        }
+        data = image->rom_image;
+    }
+
+    nes_header_t* header = &image->header;
+    if (size < sizeof(nes_header_t)) {
+        cart_image_free(image);
+        return ERR_INVALID_ROM;
+    }
+    memcpy(header, data, sizeof(nes_header_t));
 
     union {
         struct {
@@ -26,34 +149,138 @@ err_t cart_load_rom(const char* rom_filename, cart_t* cart) {
 
     // Check magic number
     if (*(uint32_t*) header->magic != NES_MAGIC.val) {
+        cart_image_free(image);
         return ERR_INVALID_ROM;
     }
 
     // Size of PRG ROM in 16 KB units
     if (header->pgr_blocks == 0) {
+        cart_image_free(image);
         return ERR_NES_FORMAT;
     }
 
-    cart->pgr_size = header->pgr_blocks * PRG_ROM_BLOCK_SIZE;
+    image->pgr_size = header->pgr_blocks * PRG_ROM_BLOCK_SIZE;
     // Size of CHR ROM in 8 KB units (value 0 means the board uses CHR RAM)
-    cart->chr_size = header->chr_blocks * CHR_ROM_BLOCK_SIZE;
+    image->chr_size = header->chr_blocks * CHR_ROM_BLOCK_SIZE;
 
-    cart->pgr_rom = wn_malloc(cart->pgr_size);
-    cart->chr_rom = wn_malloc(cart->chr_size);
+    // A 512-byte trainer may sit between the header and PRG ROM
+    size_t offset = sizeof(nes_header_t) + (header->flags6.trainer ? TRAINER_SIZE : 0);
+    if (size < offset + image->pgr_size + image->chr_size) {
+        cart_image_free(image);
+        return ERR_NES_FORMAT;
+    }
 
-    file->read(file, cart->pgr_rom, cart->pgr_size);
-    file->read(file, cart->chr_rom, cart->chr_size);
+    image->pgr_rom = data + offset;
+    image->chr_rom = image->chr_size > 0 ? data + offset + image->pgr_size : NULL;
 
-    cart->mapper_no = (header->flags7.mapper_no_upper_nybble << 4) | (header->flags6.mapper_no_lower_nybble);
+    if (header->flags6.alternative_nametables) {
+        image->mirroring = MIRRORING_FOUR_SCREEN;
+    } else {
+        // 0: vertical arrangement (horizontal mirroring), 1: horizontal arrangement (vertical mirroring)
+        image->mirroring = header->flags6.nametable_arrangement ? MIRRORING_VERTICAL : MIRRORING_HORIZONTAL;
+    }
 
-    file->close(file);
+    image->mapper_no = (header->flags7.mapper_no_upper_nybble << 4) | (header->flags6.mapper_no_lower_nybble);
+    image->prg_ram_size = cart_prg_ram_size(header);
+
+    size_t len = strlen(rom_filename);
+    image->filename = wn_malloc(len + 1);
+    memcpy(image->filename, rom_filename, len + 1);
+    atomic_init(&image->refs, 1);
+
+    *out = image;
+    return ERR_OK;
+}
+
+cart_image_t* cart_image_retain(cart_image_t* image) {
+    atomic_fetch_add_explicit(&image->refs, 1, memory_order_relaxed);
+    return image;
+}
+
+void cart_image_release(cart_image_t* image) {
+    if (image != NULL && atomic_fetch_sub_explicit(&image->refs, 1, memory_order_acq_rel) == 1) {
+        cart_image_free(image);
+    }
+}
+
+/**
+ * Points the cartridge at the image and allocates CHR RAM, the PRG RAM is left to the caller
+ */
+static void cart_attach_image(cart_image_t* image, cart_t* cart, wn_arena_t* arena) {
+    cart->image = cart_image_retain(image);
+    cart->arena = arena;
+    cart->pgr_size = image->pgr_size;
+    cart->pgr_rom = (uint8_t*) image->pgr_rom;
+    cart->chr_ram = image->chr_size == 0;
+    cart->chr_size = cart->chr_ram ? CHR_ROM_BLOCK_SIZE : image->chr_size;
+    cart->chr_rom = cart->chr_ram ? wn_arena_calloc(arena, cart->chr_size) : (uint8_t*) image->chr_rom;
+    cart->prg_ram_size = image->prg_ram_size;
+    cart->mirroring = image->mirroring;
+    cart->mapper_no = image->mapper_no;
+}
+
+size_t cart_arena_size(const cart_image_t* image) {
+    return WN_ARENA_ALIGN(image->prg_ram_size) + (image->chr_size == 0 ? WN_ARENA_ALIGN(CHR_ROM_BLOCK_SIZE) : 0);
+}
+
+void cart_init(cart_image_t* image, cart_t* cart, wn_arena_t* arena) {
+    cart_attach_image(image, cart, arena);
+    if (image->header.flags6.battery_backed) {
+        cart_map_sav(image->filename, cart);
+    }
+    if (cart->prg_ram == NULL) {
+        cart->prg_ram = wn_arena_calloc(arena, cart->prg_ram_size);
+    }
+}
+
+err_t cart_load_rom(const char* rom_filename, cart_t* cart) {
+    if (rom_filename == NULL || cart == NULL) {
+        return ERR_NULLPTR;
+    }
+
+    cart_image_t* image;
+    err_t err = cart_image_load(rom_filename, &image);
+    if (err != ERR_OK) {
+        return err;
+    }
+    cart_init(image, cart, NULL);
+    cart_image_release(image);
     return ERR_OK;
 }
 
+void cart_init_shared(cart_image_t* image, cart_t* cart, wn_arena_t* arena) {
+    cart_attach_image(image, cart, arena);
+    cart->prg_ram = wn_arena_calloc(arena, cart->prg_ram_size);
+    if (image->header.flags6.battery_backed) {
+        cart_read_sav(image->filename, cart);
+    }
+}
+
+void cart_sync_sav(cart_t* cart) {
+    if (cart->sav == NULL) {
+        return;
+    }
+    for (uint32_t offset = 0; offset < cart->prg_ram_size; offset += SAV_PAGE_SIZE) {
+        if (memcmp(cart->prg_ram + offset, cart->sav_shadow + offset, SAV_PAGE_SIZE) != 0) {
+            memcpy(cart->sav_shadow + offset, cart->prg_ram + offset, SAV_PAGE_SIZE);
+            wn_mmap_sync(cart->sav, offset, SAV_PAGE_SIZE);
+        }
+    }
+}
+
 void cart_free(cart_t* cart) {
     if (cart != NULL) {
-        wn_free(cart->pgr_rom);
-        wn_free(cart->chr_rom);
-        wn_free(cart);
+        if (cart->sav != NULL) {
+            cart_sync_sav(cart);
+            wn_mmap_close(cart->sav);
+            wn_free(cart->sav_shadow);
+        } else {
+            wn_arena_free(cart->arena, cart->prg_ram);
+        }
+        if (cart->chr_ram) {
+            wn_arena_free(cart->arena, cart->chr_rom);
+        }
+        cart_image_release(cart->image);
+        wn_arena_free(cart->arena, cart);
     }
-}
\ No newline at end of file
+}
@@ -6,6 +6,7 @@
 #define WINES_CARTRIDGE_H
 
 #include "common.h"
+#include "platform.h"
 
 // NES 2.0 File header structure
 typedef struct nes_header {
@@ -42,17 +43,108 @@ typedef struct nes_header {
     uint8_t flag15;
 } nes_header_t;
 
-typedef struct cart {
+/*
+ * Nametable mirroring, how the 4 nametables of the PPU bus map onto the 2KB CIRAM
+ *
+ * https://www.nesdev.org/wiki/Mirroring#Nametable_Mirroring
+ */
+typedef enum {
+    MIRRORING_HORIZONTAL = 0,   // $2000 = $2400, $2800 = $2C00
+    MIRRORING_VERTICAL,         // $2000 = $2800, $2400 = $2C00
+    MIRRORING_SINGLE_LOW,       // All nametables use the first 1KB of CIRAM
+    MIRRORING_SINGLE_HIGH,      // All nametables use the second 1KB of CIRAM
+    MIRRORING_FOUR_SCREEN,      // Extra 2KB VRAM on the cartridge
+} mirroring_t;
+
+/*
+ * Read-only contents of a ROM file and everything derived from them, shared by every console running
+ * the ROM in the process. Reference counted: the loader holds the first reference, each cart_t one more.
+ */
+typedef struct cart_image {
+    _Atomic uint32_t refs;
+    char* filename;
     nes_header_t header;
     uint32_t pgr_size;
+    // 0 when the board uses CHR RAM
+    uint32_t chr_size;
+    // Inside the ROM file
+    const uint8_t* pgr_rom;
+    const uint8_t* chr_rom;
+    uint32_t prg_ram_size;
+    mirroring_t mirroring;
+    uint8_t mapper_no;
+    // The ROM file, mapped read-only, or read into rom_image when it cannot be mapped
+    wn_mmap_t* rom_map;
+    uint8_t* rom_image;
+} cart_image_t;
+
+/*
+ * Cartridge of one console: the shared image plus its own writable memories
+ */
+typedef struct cart {
+    cart_image_t* image;
+    // Holds the cartridge and its RAM, NULL when they are on the heap
+    wn_arena_t* arena;
+    // From the image, CHR ROM or the console's CHR RAM
+    uint32_t pgr_size;
     uint32_t chr_size;
     uint8_t* pgr_rom;
     uint8_t* chr_rom;
+    bool chr_ram;
+    // PRG RAM at $6000-$7FFF, at least 8KB
+    uint8_t* prg_ram;
+    uint32_t prg_ram_size;
+    // Battery-backed PRG RAM lives in the mapped .sav file next to the ROM, NULL otherwise
+    wn_mmap_t* sav;
+    // Contents of the .sav pages as of the last sync
+    uint8_t* sav_shadow;
+    mirroring_t mirroring;
     uint8_t mapper_no;
 } cart_t;
 
+// Frames between two checks of the battery-backed PRG RAM for pages to write back, about one second
+#define CART_SAV_SYNC_FRAMES 60
+
+/**
+ * Loads and validates a ROM file. The caller owns the returned reference.
+ */
+err_t cart_image_load(const char* rom_filename, cart_image_t** out);
+
+cart_image_t* cart_image_retain(cart_image_t* image);
+
+/**
+ * Drops a reference, the last one unmaps the ROM
+ */
+void cart_image_release(cart_image_t* image);
+
+/**
+ * Arena space taken by the RAM of a cartridge running the image
+ */
+size_t cart_arena_size(const cart_image_t* image);
+
+/**
+ * Cartridge owning the game's save: battery-backed PRG RAM is mapped from the .sav file.
+ * The RAM comes from `arena`, or from the heap when it is NULL.
+ */
+void cart_init(cart_image_t* image, cart_t* out, wn_arena_t* arena);
+
+/**
+ * cart_init on a ROM image of its own, on the heap
+ */
 err_t cart_load_rom(const char* rom_filename, cart_t* out);
 
+/**
+ * Cartridge running a shared image. Only CHR RAM and PRG RAM are allocated; battery-backed PRG RAM
+ * starts as a copy of the .sav file and is never written back, so consoles sharing a game stay independent.
+ */
+void cart_init_shared(cart_image_t* image, cart_t* out, wn_arena_t* arena);
+
+/**
+ * Writes the 4KB pages of battery-backed PRG RAM modified since the last sync back to the .sav file.
+ * Stores go straight to the mapping, so finding the modified pages is left to this call.
+ */
+void cart_sync_sav(cart_t* cart);
+
 void cart_free(cart_t* cart);
 
 #endif //WINES_CARTRIDGE_H
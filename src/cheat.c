@@ -0,0 +1,188 @@
+//
+// Game Genie and RAM freeze codes
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "cheat.h"
+#include "cpu.h"
+
+/*
+ * Each letter is a nibble, the bits of the value (1-8, 1 is bit 7), address (A-O, A is bit 14)
+ * and compare value (!@#$%^&*) are spread over them:
+ *
+ *   6 letters: 1678 H234 -IJK LABC DMNO 5EFG
+ *   8 letters: 1678 H234 -IJK LABC DMNO %EFG !^&* 5@#$
+ *
+ * https://www.nesdev.org/wiki/Game_Genie
+ */
+static bool cheat_decode_genie(const char* code, size_t len, cheat_t* out) {
+    static const char LETTERS[] = "APZLGITYEOXUKSVN";
+    uint8_t n[8];
+    for (size_t i = 0; i < len; ++i) {
+        const char* letter = strchr(LETTERS, toupper((unsigned char) code[i]));
+        if (letter == NULL) {
+            return false;
+        }
+        n[i] = (uint8_t) (letter - LETTERS);
+    }
+
+    out->type = CHEAT_ROM;
+    out->addr = 0x8000 | ((n[3] & 7) << 12) | ((n[4] & 8) << 8) | ((n[5] & 7) << 8)
+                | ((n[1] & 8) << 4) | ((n[2] & 7) << 4) | (n[3] & 8) | (n[4] & 7);
+    out->value = ((n[0] & 8) << 4) | ((n[1] & 7) << 4) | (n[0] & 7);
+    out->has_compare = len == 8;
+    if (out->has_compare) {
+        out->value |= n[7] & 8;
+        out->compare = ((n[6] & 8) << 4) | ((n[7] & 7) << 4) | (n[5] & 8) | (n[6] & 7);
+    } else {
+        out->value |= n[5] & 8;
+        out->compare = 0;
+    }
+    return true;
+}
+
+bool cheat_parse(const char* code, cheat_t* out) {
+    size_t len = strlen(code);
+    memset(out, 0, sizeof(cheat_t));
+    out->enabled = true;
+    if ((len == 6 || len == 8) && strpbrk(code, ":?") == NULL) {
+        return cheat_decode_genie(code, len, out);
+    }
+
+    char* end;
+    unsigned long addr = strtoul(code, &end, 16);
+    if (end == code || addr > 0xFFFF) {
+        return false;
+    }
+    if (*end == '?') {
+        const char* compare = end + 1;
+        unsigned long val = strtoul(compare, &end, 16);
+        if (end == compare || val > 0xFF) {
+            return false;
+        }
+        out->compare = (uint8_t) val;
+        out->has_compare = true;
+    }
+    if (*end != ':') {
+        return false;
+    }
+    const char* value = end + 1;
+    unsigned long val = strtoul(value, &end, 16);
+    if (end == value || *end != '\0' || val > 0xFF) {
+        return false;
+    }
+    out->addr = (addr_t) addr;
+    out->value = (uint8_t) val;
+    out->type = addr >= 0x8000 ? CHEAT_ROM : CHEAT_RAM;
+
+    // Frozen bytes live in CPU RAM or PRG RAM
+    if (out->type == CHEAT_RAM) {
+        return !out->has_compare && (addr < 0x2000 || addr >= 0x6000);
+    }
+    return true;
+}
+
+#pragma mark - Cheat list
+
+/**
+ * Maps the unpatched bank of the slot, or a copy of it with the enabled codes of the slot applied
+ */
+static void cheats_patch_slot(cheats_t* cheats, uint8_t slot) {
+    uint8_t* source = cheats->source[slot];
+    if (source == NULL) {
+        return;
+    }
+
+    uint8_t* mem = source;
+    for (uint32_t i = 0; i < cheats->count; ++i) {
+        const cheat_t* cheat = &cheats->list[i];
+        if (!cheat->enabled || cheat->type != CHEAT_ROM || ((cheat->addr - 0x8000) >> 13) != slot) {
+            continue;
+        }
+        addr_t offset = cheat->addr & (MAPPER_PRG_BANK_SIZE - 1);
+        if (cheat->has_compare && source[offset] != cheat->compare) {
+            continue;
+        }
+        if (mem == source) {
+            if (cheats->shadow[slot] == NULL) {
+                cheats->shadow[slot] = wn_malloc(MAPPER_PRG_BANK_SIZE);
+            }
+            mem = cheats->shadow[slot];
+            memcpy(mem, source, MAPPER_PRG_BANK_SIZE);
+        }
+        mem[offset] = cheat->value;
+    }
+    cheats->mapped[slot] = mem;
+    cheats->mapper->prg_banks[slot] = mem;
+}
+
+cheats_t* cheats_create(mapper_t* mapper) {
+    cheats_t* cheats = wn_calloc(sizeof(cheats_t));
+    cheats->mapper = mapper;
+    memcpy(cheats->source, mapper->prg_banks, sizeof(cheats->source));
+    memcpy(cheats->mapped, mapper->prg_banks, sizeof(cheats->mapped));
+    mapper->cheats = cheats;
+    return cheats;
+}
+
+int32_t cheats_add(cheats_t* cheats, const char* code) {
+    if (cheats->count == CHEATS_MAX || !cheat_parse(code, &cheats->list[cheats->count])) {
+        return -1;
+    }
+    const cheat_t* cheat = &cheats->list[cheats->count++];
+    if (cheat->type == CHEAT_ROM) {
+        cheats_patch_slot(cheats, (cheat->addr - 0x8000) >> 13);
+    }
+    return (int32_t) cheats->count - 1;
+}
+
+void cheats_set_enabled(cheats_t* cheats, uint32_t index, bool enabled) {
+    if (index >= cheats->count) {
+        return;
+    }
+    cheat_t* cheat = &cheats->list[index];
+    cheat->enabled = enabled;
+    if (cheat->type == CHEAT_ROM) {
+        cheats_patch_slot(cheats, (cheat->addr - 0x8000) >> 13);
+    }
+}
+
+void cheats_map_prg(cheats_t* cheats, uint8_t slot, uint8_t* bank) {
+    if (cheats->source[slot] == bank) {
+        // Same bank again, the copy is still valid
+        cheats->mapper->prg_banks[slot] = cheats->mapped[slot];
+        return;
+    }
+    cheats->source[slot] = bank;
+    cheats_patch_slot(cheats, slot);
+}
+
+void cheats_apply_ram(cheats_t* cheats, cpu_t* cpu) {
+    uint8_t* prg_ram = cheats->mapper->prg_ram;
+    for (uint32_t i = 0; i < cheats->count; ++i) {
+        const cheat_t* cheat = &cheats->list[i];
+        if (!cheat->enabled || cheat->type != CHEAT_RAM) {
+            continue;
+        }
+        if (cheat->addr < 0x2000) {
+            cpu->ram[cheat->addr & (CPU_RAM_SIZE - 1)] = cheat->value;
+        } else if (prg_ram != NULL) {
+            prg_ram[cheat->addr & (MAPPER_PRG_RAM_SIZE - 1)] = cheat->value;
+        }
+    }
+}
+
+void cheats_destroy(cheats_t* cheats) {
+    if (cheats != NULL) {
+        mapper_t* mapper = cheats->mapper;
+        for (uint8_t slot = 0; slot < MAPPER_PRG_BANK_COUNT; ++slot) {
+            mapper->prg_banks[slot] = cheats->source[slot];
+            wn_free(cheats->shadow[slot]);
+        }
+        mapper->cheats = NULL;
+        wn_free(cheats);
+    }
+}
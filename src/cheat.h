@@ -0,0 +1,77 @@
+//
+// Game Genie and RAM freeze codes
+//
+
+#ifndef WINES_CHEAT_H
+#define WINES_CHEAT_H
+
+#include "common.h"
+#include "mapper.h"
+
+typedef struct cpu cpu_t;
+
+#define CHEATS_MAX 64
+
+typedef enum {
+    CHEAT_ROM = 0,  // Substitutes a PRG ROM byte, optionally only where the ROM holds the compare value
+    CHEAT_RAM,      // Freezes a CPU RAM or PRG RAM byte
+} cheat_type_t;
+
+typedef struct cheat {
+    cheat_type_t type;
+    addr_t addr;
+    uint8_t value;
+    uint8_t compare;
+    bool has_compare;
+    bool enabled;
+} cheat_t;
+
+/*
+ * Codes of one console. ROM codes cost nothing on reads: an 8KB PRG slot holding a code is redirected to
+ * a patched copy of its bank whenever the mapper maps a bank there (see mapper_set_prg_bank), so the
+ * copy is only made on bank switches. RAM codes are written back once per frame.
+ */
+typedef struct cheats {
+    cheat_t list[CHEATS_MAX];
+    uint32_t count;
+    mapper_t* mapper;
+    // Unpatched bank mapped in each PRG slot, its patched copy, and which of the two is mapped
+    uint8_t* source[MAPPER_PRG_BANK_COUNT];
+    uint8_t* shadow[MAPPER_PRG_BANK_COUNT];
+    uint8_t* mapped[MAPPER_PRG_BANK_COUNT];
+} cheats_t;
+
+/**
+ * Parses a 6 or 8-letter Game Genie code, or a raw code: "AAAA:VV" (RAM freeze below $8000, ROM patch
+ * above) or "AAAA?CC:VV" (ROM patch with a compare value), in hexadecimal
+ */
+bool cheat_parse(const char* code, cheat_t* out);
+
+/**
+ * Attaches to the mapper, whose PRG slots are then remapped through the codes
+ */
+cheats_t* cheats_create(mapper_t* mapper);
+
+/**
+ * Returns the index of the code, enabled, or -1 if it cannot be parsed or the list is full
+ */
+int32_t cheats_add(cheats_t* cheats, const char* code);
+
+void cheats_set_enabled(cheats_t* cheats, uint32_t index, bool enabled);
+
+/**
+ * Called by mapper_set_prg_bank: maps `bank`, or its patched copy, in the slot
+ */
+void cheats_map_prg(cheats_t* cheats, uint8_t slot, uint8_t* bank);
+
+/**
+ * Writes the frozen RAM values, once per frame
+ */
+void cheats_apply_ram(cheats_t* cheats, cpu_t* cpu);
+
+/**
+ * Detaches from the mapper, the PRG slots are mapped back to the ROM
+ */
+void cheats_destroy(cheats_t* cheats);
+
+#endif //WINES_CHEAT_H
@@ -2,6 +2,9 @@
 // Created by WangKZ on 2024/4/1.
 //
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "common.h"
 
 void* wn_malloc(size_t size) {
@@ -17,4 +20,51 @@ void wn_free(void* ptr) {
         free(ptr);
         ptr = NULL;
     }
-}
\ No newline at end of file
+}
+#pragma mark - Arena
+
+bool wn_arena_init(wn_arena_t* arena, size_t size) {
+    size = WN_ARENA_ALIGN(size);
+#if defined(_WIN32) || defined(_WIN64)
+    arena->base = _aligned_malloc(size, WN_CACHE_LINE);
+#else
+    arena->base = aligned_alloc(WN_CACHE_LINE, size);
+#endif
+    if (arena->base == NULL) {
+        arena->size = 0;
+        arena->used = 0;
+        return false;
+    }
+    memset(arena->base, 0, size);
+    arena->size = size;
+    arena->used = 0;
+    return true;
+}
+
+void* wn_arena_calloc(wn_arena_t* arena, size_t size) {
+    size_t aligned = WN_ARENA_ALIGN(size);
+    if (arena == NULL || arena->size - arena->used < aligned) {
+        return wn_calloc(size);
+    }
+    void* ptr = arena->base + arena->used;
+    arena->used += aligned;
+    return ptr;
+}
+
+void wn_arena_free(const wn_arena_t* arena, void* ptr) {
+    if (arena != NULL && (uint8_t*) ptr >= arena->base && (uint8_t*) ptr < arena->base + arena->size) {
+        return;
+    }
+    wn_free(ptr);
+}
+
+void wn_arena_destroy(wn_arena_t* arena) {
+#if defined(_WIN32) || defined(_WIN64)
+    _aligned_free(arena->base);
+#else
+    free(arena->base);
+#endif
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
@@ -31,11 +31,16 @@ typedef int err_t;
 #define BIT_FLAG_SET 0b1
 #define BIT_FLAG_CLR 0b0
 
+// M_PI is a POSIX extension, missing in strict C11 and on MSVC
+#define WN_PI 3.14159265358979323846
+
 #define ERR_OK              0
 #define ERR_NULLPTR         1
 #define ERR_FILE_NOT_EXISTS 2
 #define ERR_INVALID_ROM     3
 #define ERR_NES_FORMAT      4
+#define ERR_UNSUPPORTED_MAPPER 5
+#define ERR_INVALID_STATE   6
 
 
 void* wn_malloc(size_t size);
@@ -44,5 +49,37 @@ void* wn_calloc(size_t size);
 
 void wn_free(void* ptr);
 
+#define WN_CACHE_LINE 64
+
+#define WN_ARENA_ALIGN(size) (((size) + WN_CACHE_LINE - 1) & ~(size_t) (WN_CACHE_LINE - 1))
+
+/*
+ * Bump allocator over one cache-line-aligned block, for the state of a console instance.
+ * Blocks are zeroed and cache-line aligned, and only released with the whole arena.
+ * A request that does not fit anymore falls back to the heap.
+ */
+typedef struct wn_arena {
+    uint8_t* base;
+    size_t size;
+    size_t used;
+} wn_arena_t;
+
+/**
+ * Allocates the block, `size` being the sum of the WN_ARENA_ALIGN'ed sizes that will be requested
+ */
+bool wn_arena_init(wn_arena_t* arena, size_t size);
+
+/**
+ * wn_calloc when `arena` is NULL or full
+ */
+void* wn_arena_calloc(wn_arena_t* arena, size_t size);
+
+/**
+ * wn_free unless `ptr` was allocated from the arena
+ */
+void wn_arena_free(const wn_arena_t* arena, void* ptr);
+
+void wn_arena_destroy(wn_arena_t* arena);
+
 
 #endif //WINES_COMMON_H
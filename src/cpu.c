@@ -5,6 +5,7 @@
 #include "cpu.h"
 #include "mapper.h"
 #include "ppu.h"
+#include "apu.h"
 
 #include <stdbool.h>
 
@@ -1168,8 +1169,8 @@ CpuOperation op_table[] = {
 static void cpu_interrupt_nmi(cpu_t* cpu) {
     mem_push_stack16(PC);
     set_flag(BREAK_COMMAND, BIT_FLAG_CLR);
-    set_flag(INTERRUPT_DISABLE, BIT_FLAG_SET);
     mem_push_stack(P);
+    set_flag(INTERRUPT_DISABLE, BIT_FLAG_SET);
     PC = mem_read16(VECTOR_NIM);
     cpu->cycles = 8;
 }
@@ -1183,20 +1184,57 @@ static void cpu_reset(cpu_t* cpu) {
     CYCLES = 8;
 }
 
+static void cpu_interrupt_irq(cpu_t* cpu) {
+    mem_push_stack16(PC);
+    set_flag(BREAK_COMMAND, BIT_FLAG_CLR);
+    // RTI restores the interrupt disable flag of the interrupted code
+    mem_push_stack(P);
+    set_flag(INTERRUPT_DISABLE, BIT_FLAG_SET);
+    PC = mem_read16(VECTOR_IQR);
+    cpu->cycles = 7;
+}
+
 #include <stdio.h>
 
-uint64_t cycle_count = 0;
+/*
+ * OAM DMA: 256 reads from the page written to $4014, the CPU is suspended for 513 cycles
+ * (+1 on an odd CPU cycle)
+ */
+static void cpu_oam_dma(cpu_t* cpu) {
+    uint8_t page[256];
+    for (int i = 0; i < 256; ++i) {
+        page[i] = mem_read(cpu->oam_dma_addr + i);
+    }
+    ppu_oam_dma(cpu->ppu, page);
+    CYCLES += 513 + (cpu->cycle_count & 1);
+}
 
 void cpu_cycle(cpu_t* cpu) {
-    if (cpu->cycles == 0) {
+    if (cpu->cycles == 0 && cpu->oam_dma_flag) {
+        cpu->oam_dma_flag = false;
+        cpu_oam_dma(cpu);
+    } else if (cpu->cycles == 0) {
+
+        if (cpu->apu != NULL && cpu->cycle_count >= cpu->apu->irq_time) {
+            // Frame counter or DMC IRQ may be due
+            apu_run(cpu->apu, cpu->cycle_count);
+        }
+        if (cpu->cycle_count >= cpu->mapper->irq_time) {
+            // Scanline counter may have expired
+            cpu->mapper->func.irq_update(cpu->mapper);
+        }
 
         if (cpu->nmi) {
             cpu->nmi = false;
             cpu_interrupt_nmi(cpu);
+        } else if (cpu->irq && !(P & INTERRUPT_DISABLE)) {
+            cpu_interrupt_irq(cpu);
         }
 
         uint8_t opcode = mem_read_pc();
-        printf("opcode: %d, pc: %#x, cycle_count: %lld\n", opcode, PC, cycle_count);
+#ifdef CPU_TRACE
+        printf("opcode: %d, pc: %#x, cycle_count: %llu\n", opcode, PC, (unsigned long long) cpu->cycle_count);
+#endif
         CpuOperation operation = op_table[opcode];
         if (operation.am_func) {
             cpu->cycles += operation.cycles;
@@ -1206,14 +1244,25 @@ void cpu_cycle(cpu_t* cpu) {
         }
     }
 
-    ++cycle_count;
+    ++cpu->cycle_count;
     --cpu->cycles;
 }
 
-cpu_t* cpu_create(ppu_t* ppu, mapper_t* mapper) {
-    cpu_t* cpu = calloc(1, sizeof(cpu_t));
+void cpu_set_irq(cpu_t* cpu, cpu_irq_source_t source, bool asserted) {
+    if (asserted) {
+        cpu->irq |= source;
+    } else {
+        cpu->irq &= ~source;
+    }
+}
+
+cpu_t* cpu_create(ppu_t* ppu, mapper_t* mapper, wn_arena_t* arena) {
+    cpu_t* cpu = wn_arena_calloc(arena, sizeof(cpu_t));
     cpu->ppu = ppu;
     cpu->mapper = mapper;
+    if (ppu != NULL) {
+        ppu->cpu = cpu;
+    }
 
     cpu_reset(cpu);
     return cpu;
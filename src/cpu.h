@@ -41,6 +41,13 @@
 
 typedef struct mapper mapper_t;
 typedef struct ppu ppu_t;
+typedef struct apu apu_t;
+
+// Sources of the IRQ line, which stays asserted while any of them is
+typedef enum {
+    CPU_IRQ_APU = 1 << 0,
+    CPU_IRQ_MAPPER = 1 << 1,
+} cpu_irq_source_t;
 
 typedef struct cpu {
 
@@ -48,6 +55,9 @@ typedef struct cpu {
 
     bool nmi;
 
+    // Asserted IRQ sources (cpu_irq_source_t)
+    uint8_t irq;
+
     // Program counter
     uint16_t pc;
 
@@ -65,6 +75,9 @@ typedef struct cpu {
 
     uint32_t cycles;
 
+    // CPU cycles since power on
+    uint64_t cycle_count;
+
     // Accumulator addressing mode
     bool am_acc_flag;
 
@@ -75,6 +88,8 @@ typedef struct cpu {
     ppu_t* ppu;
 
     mapper_t* mapper;
+
+    apu_t* apu;
 } cpu_t;
 
 /**
@@ -109,7 +124,9 @@ uint8_t cpu_mem_read(cpu_t* cpu, addr_t addr);
 
 void cpu_mem_write(cpu_t* cpu, addr_t addr, uint8_t val);
 
-cpu_t* cpu_create(ppu_t* ppu, mapper_t* mapper);
+void cpu_set_irq(cpu_t* cpu, cpu_irq_source_t source, bool asserted);
+
+cpu_t* cpu_create(ppu_t* ppu, mapper_t* mapper, wn_arena_t* arena);
 
 void cpu_cycle(cpu_t* cpu);
 
@@ -4,6 +4,8 @@
 
 #include "cpu.h"
 #include "ppu.h"
+#include "apu.h"
+#include "mapper.h"
 
 /*
  * CPU Memory Map
@@ -44,12 +46,22 @@ uint8_t cpu_mem_read(cpu_t* cpu, addr_t addr) {
         }
         return cpu->ram[addr];
     } else if (addr < 0x4000) { // PPU registers
-        return ppu_reg_read(cpu->ppu, (ppu_reg_t) addr % 8);
+        if (cpu->ppu != NULL) {
+            return ppu_reg_read(cpu->ppu, (ppu_reg_t) addr % 8);
+        }
     } else if (addr < 0x4020) {
-
+        if (addr == 0x4015 && cpu->apu != NULL) {
+            return apu_read_status(cpu->apu, cpu->cycle_count);
+        }
     } else if (addr < 0x8000) {
-
+        if (addr >= 0x6000 && cpu->mapper->prg_ram != NULL) {
+            return cpu->mapper->prg_ram[addr - 0x6000];
+        }
     } else if (addr <= 0xFFFF) { // [0x8000, 0xFFFF]
+        const uint8_t* bank = cpu->mapper->prg_banks[(addr >> 13) & 3];
+        if (bank != NULL) {
+            return bank[addr & (MAPPER_PRG_BANK_SIZE - 1)];
+        }
         return mapper_cpu_read(cpu->mapper, addr - 0x8000);
     }
     return 0;
@@ -62,14 +74,21 @@ void cpu_mem_write(cpu_t* cpu, addr_t addr, uint8_t val) {
         }
         cpu->ram[addr] = val;
     } else if (addr < 0x4000) { // PPU registers
-        ppu_reg_write(cpu->ppu, (ppu_reg_t) addr % 8, val);
+        if (cpu->ppu != NULL) {
+            ppu_reg_write(cpu->ppu, (ppu_reg_t) addr % 8, val);
+        }
     } else if (addr < 0x4020) {
-        if (addr == 0x4014) {
+        if (addr == 0x4014 && cpu->ppu != NULL) {
             // OAM DMA
             cpu->oam_dma_flag = true;
             cpu->oam_dma_addr = val << 8;
+        } else if ((addr <= 0x4013 || addr == 0x4015 || addr == 0x4017) && cpu->apu != NULL) {
+            apu_write(cpu->apu, cpu->cycle_count, addr, val);
         }
     } else if (addr <= 0xFFFF) {
+        if (addr >= 0x6000 && addr < 0x8000 && cpu->mapper->prg_ram != NULL) {
+            cpu->mapper->prg_ram[addr - 0x6000] = val;
+        }
         mapper_cpu_write(cpu->mapper, addr, val);
     }
 }
@@ -0,0 +1,345 @@
+//
+// Post-processing filters, applied to completed frames on the presentation side
+//
+// Every filter works on a stripe of input rows, reading the whole (immutable) input frame
+// and writing only the output rows of its stripe, so stripes run in parallel without sharing.
+//
+
+#include <math.h>
+#include <string.h>
+
+#include "filter.h"
+#include "thread_pool.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FILTER_SSE2
+#endif
+
+#define STRIPE_ROWS     16
+#define STRIPE_COUNT    ((PPU_FRAME_HEIGHT + STRIPE_ROWS - 1) / STRIPE_ROWS)
+
+// NTSC: 8 signal samples per pixel, the color subcarrier has 12 phases
+#define NTSC_SAMPLES    8
+#define NTSC_PHASES     12
+#define NTSC_LINE       (PPU_FRAME_WIDTH * NTSC_SAMPLES)
+
+struct filter {
+    filter_type_t type;
+    uint8_t scale;
+    thread_pool_t* pool;
+
+    uint32_t argb[64];
+
+    // 2xBR: YUV distance between two palette colors
+    uint16_t distance[64][64];
+
+    // NTSC: cos/sin of the subcarrier at each phase
+    float ntsc_cos[NTSC_PHASES];
+    float ntsc_sin[NTSC_PHASES];
+
+    // Current job
+    const video_frame_t* frame;
+    uint32_t* out;
+    size_t pitch;
+};
+
+#pragma mark Nearest-integer scaling
+
+static void scale_row(const filter_t* filter, const uint8_t* src, uint32_t* dst) {
+    uint8_t scale = filter->scale;
+#ifdef FILTER_SSE2
+    if (scale == 2) {
+        for (int x = 0; x < PPU_FRAME_WIDTH; x += 4) {
+            __m128i px = _mm_setr_epi32(filter->argb[src[x]], filter->argb[src[x + 1]],
+                                        filter->argb[src[x + 2]], filter->argb[src[x + 3]]);
+            _mm_storeu_si128((__m128i*) (dst + x * 2), _mm_unpacklo_epi32(px, px));
+            _mm_storeu_si128((__m128i*) (dst + x * 2 + 4), _mm_unpackhi_epi32(px, px));
+        }
+        return;
+    }
+    if (scale == 4) {
+        for (int x = 0; x < PPU_FRAME_WIDTH; ++x) {
+            _mm_storeu_si128((__m128i*) (dst + x * 4), _mm_set1_epi32((int) filter->argb[src[x]]));
+        }
+        return;
+    }
+#endif
+    for (int x = 0; x < PPU_FRAME_WIDTH; ++x) {
+        uint32_t px = filter->argb[src[x]];
+        for (int i = 0; i < scale; ++i) {
+            dst[x * scale + i] = px;
+        }
+    }
+}
+
+static void scale_stripe(void* arg, uint32_t stripe) {
+    const filter_t* filter = arg;
+    uint8_t scale = filter->scale;
+    for (int y = stripe * STRIPE_ROWS; y < (int) (stripe + 1) * STRIPE_ROWS && y < PPU_FRAME_HEIGHT; ++y) {
+        uint32_t* dst = filter->out + y * scale * filter->pitch;
+        scale_row(filter, filter->frame->pixels[y], dst);
+        // The other rows are copies of the first one
+        for (int i = 1; i < scale; ++i) {
+            memcpy(dst + i * filter->pitch, dst, PPU_FRAME_WIDTH * scale * sizeof(uint32_t));
+        }
+    }
+}
+
+#pragma mark 2xBR
+
+/*
+ * xBR level 1 by Hyllian. For each corner of a pixel E, the edge strength along both diagonals
+ * is estimated from color distances in a 5x5 neighbourhood; when the edge runs across the corner,
+ * that output sub-pixel is blended with the closest neighbour along it.
+ *
+ *        A1 B1 C1
+ *     A0 A  B  C  C4
+ *     D0 D  E  F  F4
+ *     G0 G  H  I  I4
+ *        G5 H5 I5
+ *
+ * The rules below are written for the bottom-right corner; the other corners use the
+ * neighbourhood rotated by 90 degree steps.
+ */
+
+#define XBR_PX(dx, dy)  n[2 + rot[r][1][0] * (dx) + rot[r][1][1] * (dy)][2 + rot[r][0][0] * (dx) + rot[r][0][1] * (dy)]
+
+FORCE_INLINE uint32_t fn_blend_half(uint32_t a, uint32_t b) {
+    return ((a & 0xFEFEFEFE) >> 1) + ((b & 0xFEFEFEFE) >> 1);
+}
+
+static void xbr_pixel(const filter_t* filter, const uint8_t n[5][5], uint32_t out[2][2]) {
+    // Rotations (x' = m00*dx + m01*dy, y' = m10*dx + m11*dy): bottom-right, bottom-left, top-left, top-right
+    static const int8_t rot[4][2][2] = {
+            {{1,  0},  {0,  1}},
+            {{0,  -1}, {1,  0}},
+            {{-1, 0},  {0,  -1}},
+            {{0,  1},  {-1, 0}},
+    };
+    static const uint8_t corner_xy[4][2] = {{1, 1}, {0, 1}, {0, 0}, {1, 0}};
+
+#define df(a, b)  filter->distance[a][b]
+
+    uint8_t e = n[2][2];
+    uint32_t e_argb = filter->argb[e];
+    for (int r = 0; r < 4; ++r) {
+        uint32_t result = e_argb;
+
+        uint8_t f = XBR_PX(1, 0), h = XBR_PX(0, 1);
+        if (e != f && e != h) {
+            uint8_t i = XBR_PX(1, 1), c = XBR_PX(1, -1), g = XBR_PX(-1, 1);
+            uint8_t d = XBR_PX(-1, 0), b = XBR_PX(0, -1);
+            uint8_t f4 = XBR_PX(2, 0), i4 = XBR_PX(2, 1), h5 = XBR_PX(0, 2), i5 = XBR_PX(1, 2);
+
+            uint32_t wd_e = df(e, c) + df(e, g) + df(i, h5) + df(i, f4) + (df(h, f) << 2);
+            uint32_t wd_i = df(h, d) + df(h, i5) + df(f, i4) + df(f, b) + (df(e, i) << 2);
+            if (wd_e < wd_i && ((f != b && h != d) || (e == i && f != i4 && h != i5) || e == g || e == c)) {
+                uint8_t px = df(e, f) <= df(e, h) ? f : h;
+                result = fn_blend_half(e_argb, filter->argb[px]);
+            }
+        }
+        out[corner_xy[r][1]][corner_xy[r][0]] = result;
+    }
+#undef df
+}
+
+static void xbr_stripe(void* arg, uint32_t stripe) {
+    const filter_t* filter = arg;
+    const video_frame_t* frame = filter->frame;
+
+    for (int y = stripe * STRIPE_ROWS; y < (int) (stripe + 1) * STRIPE_ROWS && y < PPU_FRAME_HEIGHT; ++y) {
+        uint32_t* dst = filter->out + y * 2 * filter->pitch;
+        for (int x = 0; x < PPU_FRAME_WIDTH; ++x) {
+            // 5x5 neighbourhood, clamped at the borders
+            uint8_t n[5][5];
+            for (int dy = -2; dy <= 2; ++dy) {
+                int sy = y + dy < 0 ? 0 : y + dy >= PPU_FRAME_HEIGHT ? PPU_FRAME_HEIGHT - 1 : y + dy;
+                for (int dx = -2; dx <= 2; ++dx) {
+                    int sx = x + dx < 0 ? 0 : x + dx >= PPU_FRAME_WIDTH ? PPU_FRAME_WIDTH - 1 : x + dx;
+                    n[dy + 2][dx + 2] = frame->pixels[sy][sx] & 0x3F;
+                }
+            }
+
+            uint32_t out[2][2];
+            xbr_pixel(filter, n, out);
+            dst[x * 2] = out[0][0];
+            dst[x * 2 + 1] = out[0][1];
+            dst[filter->pitch + x * 2] = out[1][0];
+            dst[filter->pitch + x * 2 + 1] = out[1][1];
+        }
+    }
+}
+
+#pragma mark NTSC composite
+
+/*
+ * Composite video as generated by the 2C02: each pixel is 8 samples of a square wave whose phase
+ * encodes the hue and whose levels encode the brightness; the emphasis bits attenuate the signal
+ * during parts of the subcarrier cycle. The signal is then decoded back to YIQ with a 12-sample
+ * window (one subcarrier cycle), which produces the characteristic color bleeding and artifacts.
+ *
+ * https://www.nesdev.org/wiki/NTSC_video
+ */
+
+static const float NTSC_BLACK = 0.518f;
+static const float NTSC_WHITE = 1.962f;
+static const float NTSC_ATTENUATION = 0.746f;
+static const float NTSC_LEVELS[8] = {
+        0.350f, 0.518f, 0.962f, 1.550f, // Signal low
+        1.094f, 1.506f, 1.962f, 1.962f, // Signal high
+};
+
+FORCE_INLINE bool fn_in_color_phase(int color, int phase) {
+    return (color + phase) % 12 < 6;
+}
+
+static void ntsc_encode_line(const uint8_t* pixels, uint8_t emphasis, int phase, float* signal) {
+    for (int x = 0; x < PPU_FRAME_WIDTH; ++x) {
+        int color = pixels[x] & 0x0F;
+        int level = (pixels[x] >> 4) & 3;
+        if (color > 13) {
+            level = 1;
+        }
+        float low = NTSC_LEVELS[level];
+        float high = NTSC_LEVELS[4 + level];
+        if (color == 0) {
+            low = high;
+        }
+        if (color > 12) {
+            high = low;
+        }
+
+        for (int s = 0; s < NTSC_SAMPLES; ++s) {
+            int p = (phase + x * NTSC_SAMPLES + s) % NTSC_PHASES;
+            float sample = fn_in_color_phase(color, p) ? high : low;
+            // Emphasis bits: red, green, blue
+            if (((emphasis & 1) && fn_in_color_phase(0, p))
+                || ((emphasis & 2) && fn_in_color_phase(4, p))
+                || ((emphasis & 4) && fn_in_color_phase(8, p))) {
+                sample *= NTSC_ATTENUATION;
+            }
+            signal[x * NTSC_SAMPLES + s] = (sample - NTSC_BLACK) / (NTSC_WHITE - NTSC_BLACK);
+        }
+    }
+}
+
+FORCE_INLINE uint32_t fn_clamp_255(float val) {
+    return val < 0 ? 0 : val > 1 ? 255 : (uint32_t) (val * 255);
+}
+
+static void ntsc_stripe(void* arg, uint32_t stripe) {
+    const filter_t* filter = arg;
+    const video_frame_t* frame = filter->frame;
+
+    float signal[NTSC_LINE];
+    // Prefix sums of the luma and of the signal modulated by the subcarrier, for O(1) windows
+    float sum_y[NTSC_LINE + 1], sum_i[NTSC_LINE + 1], sum_q[NTSC_LINE + 1];
+
+    for (int y = stripe * STRIPE_ROWS; y < (int) (stripe + 1) * STRIPE_ROWS && y < PPU_FRAME_HEIGHT; ++y) {
+        // A scanline is 341 * 8 samples long, which shifts the phase by 4 each line (and each 262-line frame)
+        int phase = (int) ((y * 4 + frame->frame_count * 4) % NTSC_PHASES);
+        ntsc_encode_line(frame->pixels[y], frame->emphasis[y] >> 5, phase, signal);
+
+        // Demodulation products, independent per sample
+        float mod_i[NTSC_LINE], mod_q[NTSC_LINE];
+        for (int s = 0; s < NTSC_LINE; ++s) {
+            int p = (phase + s) % NTSC_PHASES;
+            mod_i[s] = signal[s] * filter->ntsc_cos[p];
+            mod_q[s] = signal[s] * filter->ntsc_sin[p];
+        }
+        sum_y[0] = sum_i[0] = sum_q[0] = 0;
+        for (int s = 0; s < NTSC_LINE; ++s) {
+            sum_y[s + 1] = sum_y[s] + signal[s];
+            sum_i[s + 1] = sum_i[s] + mod_i[s];
+            sum_q[s + 1] = sum_q[s] + mod_q[s];
+        }
+
+        // 2 output pixels per input pixel, one every 4 samples, each decoded from the 12 samples around it
+        uint32_t* dst = filter->out + y * 2 * filter->pitch;
+        for (int x = 0; x < PPU_FRAME_WIDTH * 2; ++x) {
+            int center = x * (NTSC_SAMPLES / 2) + NTSC_SAMPLES / 4;
+            int begin = center - NTSC_PHASES / 2 < 0 ? 0 : center - NTSC_PHASES / 2;
+            int end = center + NTSC_PHASES / 2 > NTSC_LINE ? NTSC_LINE : center + NTSC_PHASES / 2;
+
+            float yy = (sum_y[end] - sum_y[begin]) / NTSC_PHASES;
+            float ii = (sum_i[end] - sum_i[begin]) / NTSC_PHASES;
+            float qq = (sum_q[end] - sum_q[begin]) / NTSC_PHASES;
+
+            uint32_t r = fn_clamp_255(yy + 0.946882f * ii + 0.623557f * qq);
+            uint32_t g = fn_clamp_255(yy - 0.274788f * ii - 0.635691f * qq);
+            uint32_t b = fn_clamp_255(yy - 1.108545f * ii + 1.709007f * qq);
+            dst[x] = 0xFF000000 | (r << 16) | (g << 8) | b;
+        }
+        memcpy(dst + filter->pitch, dst, PPU_FRAME_WIDTH * 2 * sizeof(uint32_t));
+    }
+}
+
+#pragma mark Filter
+
+static void filter_distance_init(filter_t* filter) {
+    float yuv[64][3];
+    for (int i = 0; i < 64; ++i) {
+        float r = (DEFAULT_PALETTES[i] >> 16) & 0xFF;
+        float g = (DEFAULT_PALETTES[i] >> 8) & 0xFF;
+        float b = DEFAULT_PALETTES[i] & 0xFF;
+        yuv[i][0] = 0.299f * r + 0.587f * g + 0.114f * b;
+        yuv[i][1] = 0.492f * (b - yuv[i][0]);
+        yuv[i][2] = 0.877f * (r - yuv[i][0]);
+    }
+    for (int a = 0; a < 64; ++a) {
+        for (int b = 0; b < 64; ++b) {
+            // Luma weighs much more than chroma
+            float d = 48 * fabsf(yuv[a][0] - yuv[b][0]) + 7 * fabsf(yuv[a][1] - yuv[b][1])
+                      + 6 * fabsf(yuv[a][2] - yuv[b][2]);
+            filter->distance[a][b] = (uint16_t) (d / 16);
+        }
+    }
+}
+
+filter_t* filter_create(filter_type_t type, uint8_t scale, uint32_t workers) {
+    filter_t* filter = wn_calloc(sizeof(filter_t));
+    filter->type = type;
+    filter->scale = type == FILTER_SCALE ? (scale == 0 ? 1 : scale) : 2;
+    filter->pool = thread_pool_create(workers);
+
+    for (int i = 0; i < 64; ++i) {
+        filter->argb[i] = 0xFF000000 | DEFAULT_PALETTES[i];
+    }
+    if (type == FILTER_XBR) {
+        filter_distance_init(filter);
+    }
+    if (type == FILTER_NTSC) {
+        // Hue tweak of 3.9 degrees used by the reference decoder
+        for (int p = 0; p < NTSC_PHASES; ++p) {
+            filter->ntsc_cos[p] = cosf((float) WN_PI * (p + 3.9f) / 6);
+            filter->ntsc_sin[p] = sinf((float) WN_PI * (p + 3.9f) / 6);
+        }
+    }
+    return filter;
+}
+
+void filter_output_size(const filter_t* filter, int* width, int* height) {
+    *width = PPU_FRAME_WIDTH * filter->scale;
+    *height = PPU_FRAME_HEIGHT * filter->scale;
+}
+
+void filter_apply(filter_t* filter, const video_frame_t* frame, uint32_t* out, size_t pitch) {
+    static const thread_task_t STRIPE_TASKS[] = {
+            [FILTER_SCALE] = scale_stripe,
+            [FILTER_XBR] = xbr_stripe,
+            [FILTER_NTSC] = ntsc_stripe,
+    };
+
+    filter->frame = frame;
+    filter->out = out;
+    filter->pitch = pitch;
+    thread_pool_run(filter->pool, STRIPE_TASKS[filter->type], filter, STRIPE_COUNT);
+}
+
+void filter_destroy(filter_t* filter) {
+    if (filter != NULL) {
+        thread_pool_destroy(filter->pool);
+        wn_free(filter);
+    }
+}
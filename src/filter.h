@@ -0,0 +1,34 @@
+//
+// Post-processing filters, applied to completed frames on the presentation side
+//
+
+#ifndef WINES_FILTER_H
+#define WINES_FILTER_H
+
+#include "common.h"
+#include "video.h"
+
+typedef enum {
+    FILTER_SCALE = 0,   // Nearest-integer scaling
+    FILTER_XBR,         // Edge-directed 2xBR scaling
+    FILTER_NTSC,        // NTSC composite signal encode/decode, honours the emphasis bits
+} filter_type_t;
+
+typedef struct filter filter_t;
+
+/**
+ * `scale` only applies to FILTER_SCALE, the other filters output 2x.
+ * The frame is split into horizontal stripes run on `workers` threads (0 for one per extra processor).
+ */
+filter_t* filter_create(filter_type_t type, uint8_t scale, uint32_t workers);
+
+void filter_output_size(const filter_t* filter, int* width, int* height);
+
+/**
+ * Filters `frame` into 0xAARRGGBB pixels, `pitch` in pixels. Blocks until every stripe is done.
+ */
+void filter_apply(filter_t* filter, const video_frame_t* frame, uint32_t* out, size_t pitch);
+
+void filter_destroy(filter_t* filter);
+
+#endif //WINES_FILTER_H
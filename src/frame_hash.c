@@ -0,0 +1,138 @@
+//
+// Per-frame hashes for headless regression and determinism checks
+//
+
+#include <string.h>
+
+#include "frame_hash.h"
+#include "wines.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HASH_SSE2
+#endif
+
+/*
+ * The accumulator loop of XXH3: 8 lanes of 64 bits, each 64-byte stripe is mixed into
+ * the lanes with 32x32->64 multiplies of (data ^ secret), which vectorizes well.
+ * Every 16 stripes the lanes are scrambled, then merged and avalanched at the end.
+ *
+ * https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+ */
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+
+#define STRIPE_SIZE         64
+#define STRIPES_PER_BLOCK   16
+#define LANES               8
+
+static const uint64_t SECRET[LANES] = {
+        0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL,
+        0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL,
+};
+
+FORCE_INLINE uint64_t fn_read64(const uint8_t* p) {
+    // Little-endian load
+    uint64_t val = 0;
+    for (int i = 7; i >= 0; --i) {
+        val = (val << 8) | p[i];
+    }
+    return val;
+}
+
+#ifdef HASH_SSE2
+
+static void hash_accumulate(uint64_t acc[LANES], const uint8_t* stripe) {
+    __m128i* xacc = (__m128i*) acc;
+    for (int i = 0; i < LANES / 2; ++i) {
+        __m128i data = _mm_loadu_si128((const __m128i*) stripe + i);
+        __m128i key = _mm_xor_si128(data, _mm_loadu_si128((const __m128i*) SECRET + i));
+        // lo32(key) * hi32(key) of both lanes
+        __m128i product = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+        // acc[n ^ 1] += data[n]
+        __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        __m128i sum = _mm_add_epi64(_mm_loadu_si128(xacc + i), _mm_add_epi64(product, swapped));
+        _mm_storeu_si128(xacc + i, sum);
+    }
+}
+
+#else
+
+static void hash_accumulate(uint64_t acc[LANES], const uint8_t* stripe) {
+    for (int i = 0; i < LANES; ++i) {
+        uint64_t data = fn_read64(stripe + i * 8);
+        uint64_t key = data ^ SECRET[i];
+        acc[i ^ 1] += data;
+        acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+    }
+}
+
+#endif
+
+static void hash_scramble(uint64_t acc[LANES]) {
+    for (int i = 0; i < LANES; ++i) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= SECRET[LANES - 1 - i];
+        acc[i] = a * PRIME32_1;
+    }
+}
+
+static uint64_t hash_avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t wn_hash64(const void* data, size_t size, uint64_t seed) {
+    const uint8_t* p = data;
+    uint64_t acc[LANES] = {
+            seed ^ PRIME32_1, seed ^ PRIME64_1, seed ^ PRIME64_2, seed ^ PRIME64_3,
+            seed + PRIME64_1, seed + PRIME64_2, seed + PRIME64_3, seed + PRIME32_1,
+    };
+
+    size_t stripes = size / STRIPE_SIZE;
+    for (size_t n = 0; n < stripes; ++n) {
+        hash_accumulate(acc, p + n * STRIPE_SIZE);
+        if (n % STRIPES_PER_BLOCK == STRIPES_PER_BLOCK - 1) {
+            hash_scramble(acc);
+        }
+    }
+
+    // Zero padded last stripe
+    size_t rest = size % STRIPE_SIZE;
+    if (rest != 0) {
+        uint8_t last[STRIPE_SIZE] = {0};
+        memcpy(last, p + stripes * STRIPE_SIZE, rest);
+        hash_accumulate(acc, last);
+    }
+
+    uint64_t h = size * PRIME64_1;
+    for (int i = 0; i < LANES; i += 2) {
+        h += (acc[i] ^ SECRET[i]) * ((acc[i + 1] ^ SECRET[i + 1]) | 1);
+        h = (h << 27 | h >> 37) * PRIME64_2;
+    }
+    return hash_avalanche(h);
+}
+
+void frame_hash(const wines_t* nes, uint32_t flags, frame_hash_t* out) {
+    out->frame_count = nes->ppu->frame_count;
+    out->frame = flags & FRAME_HASH_FRAME ? wn_hash64(nes->ppu->frame, sizeof(nes->ppu->frame), 0) : 0;
+    out->ram = flags & FRAME_HASH_RAM ? wn_hash64(nes->cpu->ram, sizeof(nes->cpu->ram), 0) : 0;
+    out->vram = flags & FRAME_HASH_VRAM ? wn_hash64(nes->ppu->vram, sizeof(nes->ppu->vram), 0) : 0;
+}
+
+void frame_hash_hook(wines_t* nes, void* userdata) {
+    frame_hash_ctx_t* ctx = userdata;
+    frame_hash(nes, ctx->flags, &ctx->last);
+    if (ctx->out != NULL) {
+        fprintf(ctx->out, "%u %016llx %016llx %016llx\n", ctx->last.frame_count,
+                (unsigned long long) ctx->last.frame,
+                (unsigned long long) ctx->last.ram,
+                (unsigned long long) ctx->last.vram);
+    }
+}
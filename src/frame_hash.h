@@ -0,0 +1,49 @@
+//
+// Per-frame hashes for headless regression and determinism checks
+//
+
+#ifndef WINES_FRAME_HASH_H
+#define WINES_FRAME_HASH_H
+
+#include <stdio.h>
+
+#include "common.h"
+
+typedef struct wines wines_t;
+
+// What frame_hash covers
+#define FRAME_HASH_FRAME    (1 << 0)    // Indexed frame buffer
+#define FRAME_HASH_RAM      (1 << 1)    // CPU RAM
+#define FRAME_HASH_VRAM     (1 << 2)    // PPU nametable RAM
+
+typedef struct {
+    uint32_t frame_count;
+    uint64_t frame;
+    uint64_t ram;
+    uint64_t vram;
+} frame_hash_t;
+
+/**
+ * 64-bit xxHash-style hash (XXH3 accumulate/scramble loop).
+ * The SSE2 and scalar implementations give the same result on every host.
+ */
+uint64_t wn_hash64(const void* data, size_t size, uint64_t seed);
+
+/**
+ * Hashes the parts of the console state selected by `flags` (FRAME_HASH_*), 0 for the others
+ */
+void frame_hash(const wines_t* nes, uint32_t flags, frame_hash_t* out);
+
+typedef struct {
+    uint32_t flags;
+    frame_hash_t last;
+    // Hash stream output, NULL to only keep `last`
+    FILE* out;
+} frame_hash_ctx_t;
+
+/**
+ * Frame hook (see wines_set_frame_hook) hashing every frame, `userdata` is a frame_hash_ctx_t
+ */
+void frame_hash_hook(wines_t* nes, void* userdata);
+
+#endif //WINES_FRAME_HASH_H
@@ -0,0 +1,266 @@
+//
+// SDL2 frontend
+//
+// The emulation runs on its own thread, paced to the NTSC frame rate, and publishes every completed
+// frame into a triple buffer. The main thread is the presentation thread: it picks up the newest frame,
+// filters it (on the filter's worker pool) and waits for vsync in SDL_RenderPresent, without ever
+// blocking the emulation. Samples go through a lock-free ring to the SDL audio callback, with dynamic
+// rate control keeping the ring half full. With a rewind buffer, the emulation thread records every frame
+// and plays them back while the main thread reports Backspace held. With run-ahead, the frames published
+// are the ones run ahead and the samples come from the emulated frames.
+//
+
+#include <stdio.h>
+#include <SDL.h>
+
+#include "frontend_sdl.h"
+#include "platform.h"
+#include "audio_ring.h"
+#include "rewind_buffer.h"
+#include "run_ahead.h"
+#include "triple_buffer.h"
+#include "wines.h"
+
+#define WINDOW_SCALE 3
+
+#define AUDIO_SAMPLE_RATE   48000
+// Samples per callback
+#define AUDIO_DEVICE_BUFFER 512
+// About 85 ms of samples, 40 ms aimed at
+#define AUDIO_RING_SIZE     4096
+#define AUDIO_RING_TARGET   (AUDIO_SAMPLE_RATE / 25)
+// Up to 0.5% faster or slower
+#define AUDIO_MAX_DEVIATION 0.005
+
+typedef struct {
+    wines_t* nes;
+    triple_buffer_t* frames;
+    // NULL without an audio device
+    audio_ring_t* audio;
+    // NULL without rewind
+    rewind_buffer_t* rewind;
+    SDL_atomic_t rewinding;
+    // NULL without run-ahead
+    run_ahead_t* run_ahead;
+    SDL_atomic_t quit;
+} emu_thread_ctx_t;
+
+static void audio_callback(void* userdata, Uint8* stream, int len) {
+    audio_ring_read(userdata, (int16_t*) stream, len / sizeof(int16_t));
+}
+
+static void push_audio(wines_t* nes, run_ahead_t* run_ahead, audio_ring_t* audio) {
+    int16_t samples[1024];
+    uint32_t count;
+    while ((count = run_ahead != NULL ? run_ahead_read_samples(run_ahead, samples, 1024)
+                                      : apu_read_samples(nes->apu, samples, 1024)) > 0) {
+        audio_ring_write(audio, samples, count);
+    }
+    apu_set_rate_ratio(nes->apu, audio_ring_rate_ratio(audio));
+}
+
+static void publish_frame_hook(wines_t* nes, void* userdata) {
+    triple_buffer_t* frames = userdata;
+    if (!nes->ppu->frame_updated) {
+        // Skipped frame, nothing new to show
+        return;
+    }
+    video_frame_capture(triple_buffer_back(frames), nes->ppu);
+    triple_buffer_publish(frames);
+}
+
+static int emu_thread(void* data) {
+    emu_thread_ctx_t* ctx = data;
+    const uint64_t frame_ns = (uint64_t) (1e9 / NES_FRAME_RATE);
+
+    uint64_t deadline = wn_time_ns();
+    while (!SDL_AtomicGet(&ctx->quit)) {
+        if (ctx->rewind != NULL && SDL_AtomicGet(&ctx->rewinding)) {
+            // Two frames back and one forward, so the frame shown is rendered
+            rewind_buffer_back(ctx->rewind);
+            rewind_buffer_back(ctx->rewind);
+        }
+        if (ctx->run_ahead != NULL) {
+            run_ahead_frame(ctx->run_ahead);
+        } else {
+            wines_run_frame(ctx->nes);
+        }
+        if (ctx->rewind != NULL) {
+            rewind_buffer_push(ctx->rewind);
+        }
+        if (ctx->audio != NULL) {
+            push_audio(ctx->nes, ctx->run_ahead, ctx->audio);
+        }
+
+        deadline += frame_ns;
+        uint64_t now = wn_time_ns();
+        if (now < deadline) {
+            wn_nano_sleep((long) (deadline - now));
+        } else if (now - deadline > 4 * frame_ns) {
+            // Too far behind (debugger, suspended window), do not try to catch up
+            deadline = now;
+        }
+    }
+    return 0;
+}
+
+static void print_audio_stats(audio_ring_t* audio) {
+    audio_ring_stats_t stats;
+    audio_ring_stats(audio, &stats);
+    printf("audio samples written: %llu, played: %llu, underruns: %llu (%llu samples), "
+           "overruns: %llu (%llu samples)\n",
+           (unsigned long long) stats.written, (unsigned long long) stats.played,
+           (unsigned long long) stats.underruns, (unsigned long long) stats.underrun_samples,
+           (unsigned long long) stats.overruns, (unsigned long long) stats.overrun_samples);
+}
+
+static void print_run_ahead_stats(run_ahead_t* run_ahead, uint8_t frames) {
+    run_ahead_stats_t stats;
+    run_ahead_stats(run_ahead, &stats);
+    if (stats.frames == 0) {
+        return;
+    }
+    printf("run-ahead %u frames: %.1f us per emulated frame, %.1f us per frame ahead, %.1f%% of the frame time\n",
+           frames, stats.frame_ns / 1e3 / stats.frames, run_ahead_frame_cost_ns(run_ahead) / 1e3,
+           100.0 * (stats.frame_ns + stats.ahead_ns) / stats.frames / (1e9 / NES_FRAME_RATE));
+}
+
+static void print_stats(triple_buffer_t* frames) {
+    triple_buffer_stats_t stats;
+    triple_buffer_stats(frames, &stats);
+    printf("frames published: %llu, presented: %llu, dropped: %llu, repeated: %llu, "
+           "latency avg: %.2f ms, max: %.2f ms\n",
+           (unsigned long long) stats.published, (unsigned long long) stats.presented,
+           (unsigned long long) stats.dropped, (unsigned long long) stats.repeated,
+           stats.latency_avg_ns / 1e6, stats.latency_max_ns / 1e6);
+}
+
+int frontend_sdl_run(const char* rom_filename, const frontend_options_t* options) {
+    wines_t* nes;
+    err_t err = wines_create(rom_filename, &nes);
+    if (err != ERR_OK) {
+        printf("Failed to load %s: %d\n", rom_filename, err);
+        return err;
+    }
+    wines_set_frame_skip(nes, options->frame_skip);
+    wines_set_deferred(nes, options->deferred);
+    ppu_set_nt_cache(nes->ppu, options->nt_cache);
+    for (uint32_t i = 0; i < options->cheat_count; ++i) {
+        if (wines_add_cheat(nes, options->cheats[i]) < 0) {
+            printf("Invalid cheat code %s\n", options->cheats[i]);
+        }
+    }
+
+    filter_t* filter = filter_create(options->filter, options->scale, 0);
+    int width, height;
+    filter_output_size(filter, &width, &height);
+
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
+        printf("SDL_Init: %s\n", SDL_GetError());
+        wines_destroy(nes);
+        return -1;
+    }
+
+    SDL_Window* window = SDL_CreateWindow("WiNes", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                                          PPU_FRAME_WIDTH * WINDOW_SCALE, PPU_FRAME_HEIGHT * WINDOW_SCALE,
+                                          SDL_WINDOW_RESIZABLE);
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    SDL_RenderSetLogicalSize(renderer, PPU_FRAME_WIDTH, PPU_FRAME_HEIGHT);
+    SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                             width, height);
+
+    triple_buffer_t* frames = wn_malloc(sizeof(triple_buffer_t));
+    triple_buffer_init(frames);
+    wines_set_frame_hook(nes, publish_frame_hook, frames);
+
+    audio_ring_t* audio = wn_malloc(sizeof(audio_ring_t));
+    audio_ring_init(audio, AUDIO_RING_SIZE, AUDIO_RING_TARGET, AUDIO_MAX_DEVIATION);
+    SDL_AudioSpec want = {
+            .freq = AUDIO_SAMPLE_RATE,
+            .format = AUDIO_S16SYS,
+            .channels = 1,
+            .samples = AUDIO_DEVICE_BUFFER,
+            .callback = audio_callback,
+            .userdata = audio,
+    };
+    SDL_AudioSpec have;
+    SDL_AudioDeviceID device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (device == 0) {
+        printf("SDL_OpenAudioDevice: %s\n", SDL_GetError());
+    } else {
+        apu_set_sample_rate(nes->apu, have.freq);
+        SDL_PauseAudioDevice(device, 0);
+    }
+
+    rewind_buffer_t* rewind = NULL;
+    if (options->rewind_seconds > 0) {
+        rewind = rewind_buffer_create(nes, (uint32_t) (options->rewind_seconds * NES_FRAME_RATE),
+                                      (size_t) options->rewind_seconds * REWIND_BUFFER_BYTES_PER_SECOND);
+    }
+
+    run_ahead_t* run_ahead = NULL;
+    if (options->run_ahead > 0) {
+        run_ahead = run_ahead_create(nes, options->run_ahead, options->run_ahead_second_instance);
+        if (run_ahead == NULL) {
+            printf("Failed to create the run-ahead instance\n");
+        }
+    }
+
+    emu_thread_ctx_t ctx = {.nes = nes, .frames = frames, .audio = device != 0 ? audio : NULL, .rewind = rewind,
+                            .run_ahead = run_ahead};
+    SDL_AtomicSet(&ctx.rewinding, 0);
+    SDL_AtomicSet(&ctx.quit, 0);
+    SDL_Thread* thread = SDL_CreateThread(emu_thread, "emulation", &ctx);
+
+    bool running = true;
+    while (running) {
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                running = false;
+            } else if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP)
+                       && event.key.keysym.sym == SDLK_BACKSPACE) {
+                SDL_AtomicSet(&ctx.rewinding, event.type == SDL_KEYDOWN);
+            }
+        }
+
+        bool fresh;
+        const video_frame_t* frame = triple_buffer_acquire(frames, &fresh);
+        if (frame != NULL && fresh) {
+            void* pixels;
+            int pitch;
+            SDL_LockTexture(texture, NULL, &pixels, &pitch);
+            filter_apply(filter, frame, pixels, pitch / sizeof(uint32_t));
+            SDL_UnlockTexture(texture);
+        }
+
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, NULL, NULL);
+        // Waits for vsync on this thread only
+        SDL_RenderPresent(renderer);
+    }
+
+    SDL_AtomicSet(&ctx.quit, 1);
+    SDL_WaitThread(thread, NULL);
+    rewind_buffer_destroy(rewind);
+    if (run_ahead != NULL) {
+        print_run_ahead_stats(run_ahead, options->run_ahead);
+        run_ahead_destroy(run_ahead);
+    }
+    print_stats(frames);
+    if (device != 0) {
+        SDL_CloseAudioDevice(device);
+        print_audio_stats(audio);
+    }
+    audio_ring_free(audio);
+    wn_free(audio);
+
+    wn_free(frames);
+    filter_destroy(filter);
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    wines_destroy(nes);
+    return 0;
+}
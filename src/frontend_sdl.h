@@ -0,0 +1,36 @@
+//
+// SDL2 frontend
+//
+
+#ifndef WINES_FRONTEND_SDL_H
+#define WINES_FRONTEND_SDL_H
+
+#include "common.h"
+#include "filter.h"
+
+typedef struct {
+    uint8_t frame_skip;
+    filter_type_t filter;
+    // FILTER_SCALE factor
+    uint8_t scale;
+    // Render frames on worker threads, one frame of extra latency
+    bool deferred;
+    // Produce frames without scroll splits from pre-rendered nametables
+    bool nt_cache;
+    // Game Genie or raw codes (see cheat_parse)
+    const char* const* cheats;
+    uint32_t cheat_count;
+    // Seconds of history played back while Backspace is held, 0 for none
+    uint32_t rewind_seconds;
+    // Frames presented ahead of the emulated one, 0 for none
+    uint8_t run_ahead;
+    // Run ahead on a second console instead of restoring the state
+    bool run_ahead_second_instance;
+} frontend_options_t;
+
+/**
+ * Opens a window and runs the ROM until the window is closed
+ */
+int frontend_sdl_run(const char* rom_filename, const frontend_options_t* options);
+
+#endif //WINES_FRONTEND_SDL_H
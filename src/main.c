@@ -1,7 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "av_export.h"
+#include "bench.h"
+#include "filter.h"
+#include "frame_hash.h"
+#include "nsf.h"
+#include "platform.h"
+#include "rom_index.h"
+#include "thread_pool.h"
+#include "wines.h"
+#ifdef WINES_SDL_FRONTEND
+#include "frontend_sdl.h"
+#endif
 
-void pop_nes_init();
+#define DEFAULT_ROM "../test_nes/nestest.nes"
 
-int main() {
-    pop_nes_init();
-}
\ No newline at end of file
+#define EXPORT_SAMPLE_RATE 48000
+
+#define EXPORT_USAGE "WiNes --export <video> [--rgb] [--wav <wav>] [--resampler fast|medium|high|best] [rom] [frames]"
+
+static int usage_error(const char* option, const char* value, const char* usage) {
+    fprintf(stderr, "Invalid %s: %s\nUsage: %s\n", option, value, usage);
+    return 1;
+}
+
+/*
+ * Usage:
+ *   WiNes [rom] [--frame-skip N] [--filter scale|scale2|scale3|scale4|xbr|ntsc] [--deferred] [--nt-cache]
+ *         [--cheat <code>]...                     Game Genie, AAAA:VV or AAAA?CC:VV codes
+ *         [--rewind <seconds>]                    hold Backspace to play back the last seconds
+ *         [--run-ahead <frames>] [--second-instance]
+ *   WiNes --bench [rom] [frames]
+ *   WiNes --hash [rom] [frames]                   prints frame/RAM/VRAM hashes of every frame
+ *   WiNes --export <video> [--rgb] [--wav <wav>] [--resampler fast|medium|high|best] [rom] [frames]
+ *                                                 headless recording, "-" writes to stdout
+ *   WiNes --nsf <nsf> <wav> [song] [seconds]       renders a song (1-based) to WAV without the PPU
+ *   WiNes --index <dir> [index]                    indexes the ROMs of a directory, re-hashing changed files only
+ */
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+        const char* rom = argc >= 3 ? argv[2] : DEFAULT_ROM;
+        uint32_t frames = argc >= 4 ? strtoul(argv[3], NULL, 10) : 600;
+        return wines_bench(rom, frames);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--hash") == 0) {
+        const char* rom = argc >= 3 ? argv[2] : DEFAULT_ROM;
+        uint32_t frames = argc >= 4 ? strtoul(argv[3], NULL, 10) : 600;
+        wines_t* nes;
+        err_t err = wines_create(rom, &nes);
+        if (err != ERR_OK) {
+            return err;
+        }
+        frame_hash_ctx_t ctx = {.flags = FRAME_HASH_FRAME | FRAME_HASH_RAM | FRAME_HASH_VRAM, .out = stdout};
+        wines_set_frame_hook(nes, frame_hash_hook, &ctx);
+        for (uint32_t i = 0; i < frames; ++i) {
+            wines_run_frame(nes);
+        }
+        wines_destroy(nes);
+        return 0;
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--export") == 0) {
+        const char* video = argv[2];
+        const char* wav = NULL;
+        const char* rom = DEFAULT_ROM;
+        video_export_format_t format = VIDEO_EXPORT_Y4M;
+        uint32_t frames = 60 * 60;
+        int resampler = APU_RESAMPLER_NONE;
+        for (int i = 3; i < argc; ++i) {
+            if (strcmp(argv[i], "--rgb") == 0) {
+                format = VIDEO_EXPORT_RGB24;
+            } else if (strcmp(argv[i], "--resampler") == 0 && i + 1 < argc) {
+                const char* name = argv[++i];
+                resampler = strcmp(name, "fast") == 0 ? RESAMPLER_FAST :
+                            strcmp(name, "medium") == 0 ? RESAMPLER_MEDIUM :
+                            strcmp(name, "high") == 0 ? RESAMPLER_HIGH :
+                            strcmp(name, "best") == 0 ? RESAMPLER_BEST : -2;
+                if (resampler == -2) {
+                    return usage_error("--resampler", name, EXPORT_USAGE);
+                }
+            } else if (strcmp(argv[i], "--wav") == 0 && i + 1 < argc) {
+                wav = argv[++i];
+            } else if (argv[i][0] >= '0' && argv[i][0] <= '9') {
+                frames = strtoul(argv[i], NULL, 10);
+            } else {
+                rom = argv[i];
+            }
+        }
+
+        wines_t* nes;
+        err_t err = wines_create(rom, &nes);
+        if (err != ERR_OK) {
+            return err;
+        }
+        av_export_t* export = av_export_open(video, format, wav, EXPORT_SAMPLE_RATE);
+        if (export == NULL) {
+            fprintf(stderr, "Failed to open the export outputs\n");
+            wines_destroy(nes);
+            return ERR_FILE_NOT_EXISTS;
+        }
+        apu_set_sample_rate(nes->apu, EXPORT_SAMPLE_RATE);
+        apu_set_resampler(nes->apu, resampler);
+        wines_set_frame_hook(nes, av_export_hook, export);
+        for (uint32_t i = 0; i < frames; ++i) {
+            wines_run_frame(nes);
+        }
+        av_export_close(export);
+        wines_destroy(nes);
+        return 0;
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "--nsf") == 0) {
+        uint8_t song = argc >= 5 ? (uint8_t) strtoul(argv[4], NULL, 10) : 0;
+        double seconds = argc >= 6 ? strtod(argv[5], NULL) : 180.0;
+        nsf_player_t* player;
+        err_t err = nsf_player_create(argv[2], &player);
+        if (err != ERR_OK) {
+            return err;
+        }
+        av_export_t* export = av_export_open(NULL, VIDEO_EXPORT_Y4M, argv[3], EXPORT_SAMPLE_RATE);
+        if (export == NULL) {
+            fprintf(stderr, "Failed to open the export outputs\n");
+            nsf_player_destroy(player);
+            return ERR_FILE_NOT_EXISTS;
+        }
+        apu_set_sample_rate(player->apu, EXPORT_SAMPLE_RATE);
+        if (song > 0) {
+            nsf_player_start(player, song - 1);
+        }
+
+        uint64_t start = wn_time_ns();
+        uint32_t frames = nsf_player_frames(player, seconds);
+        int16_t samples[1024];
+        for (uint32_t i = 0; i < frames; ++i) {
+            nsf_player_run_frame(player);
+            uint32_t count;
+            while ((count = apu_read_samples(player->apu, samples, 1024)) > 0) {
+                av_export_audio(export, samples, count);
+            }
+        }
+        av_export_close(export);
+        double elapsed = (double) (wn_time_ns() - start) / 1e9;
+        fprintf(stderr, "%.32s - %.32s, song %u/%u: %.1f s in %.3f s (%.0fx real time)\n",
+                player->nsf->header.name, player->nsf->header.artist, player->song + 1,
+                player->nsf->header.total_songs, seconds, elapsed, seconds / elapsed);
+        nsf_player_destroy(player);
+        return 0;
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--index") == 0) {
+        const char* index_filename = argc >= 4 ? argv[3] : "wines_index.bin";
+        uint64_t start = wn_time_ns();
+        rom_index_t* index = rom_index_open(index_filename);
+        uint32_t previous = rom_index_count(index);
+        thread_pool_t* pool = thread_pool_create(0);
+        int32_t hashed = rom_index_scan(index, argv[2], pool);
+        thread_pool_destroy(pool);
+        if (hashed < 0) {
+            fprintf(stderr, "Failed to read %s\n", argv[2]);
+            rom_index_close(index);
+            return ERR_FILE_NOT_EXISTS;
+        }
+        err_t err = rom_index_save(index);
+        double elapsed = (double) (wn_time_ns() - start) / 1e6;
+
+        for (uint32_t i = 0; i < rom_index_count(index); ++i) {
+            const rom_index_entry_t* entry = rom_index_entry(index, i);
+            if (!(entry->flags & ROM_INDEX_VALID)) {
+                printf("-------- ---------------------------------------- %s\n", rom_index_path(index, entry));
+                continue;
+            }
+            printf("%08x ", entry->crc32);
+            for (int k = 0; k < 20; ++k) {
+                printf("%02x", entry->sha1[k]);
+            }
+            printf(" mapper %3u PRG %4uK CHR %4uK %s\n",
+                   entry->header.flags7.mapper_no_upper_nybble << 4 | entry->header.flags6.mapper_no_lower_nybble,
+                   entry->header.pgr_blocks * 16, entry->header.chr_blocks * 8, rom_index_path(index, entry));
+        }
+        fprintf(stderr, "%u ROMs (%u previously indexed), %d hashed in %.1f ms\n",
+                rom_index_count(index), previous, hashed, elapsed);
+        rom_index_close(index);
+        return err;
+    }
+
+    const char* rom = DEFAULT_ROM;
+    uint8_t frame_skip = 0;
+    filter_type_t filter = FILTER_SCALE;
+    uint8_t scale = 1;
+    bool deferred = false;
+    bool nt_cache = false;
+    const char* cheats[CHEATS_MAX];
+    uint32_t cheat_count = 0;
+    uint32_t rewind_seconds = 0;
+    uint8_t run_ahead = 0;
+    bool second_instance = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--frame-skip") == 0 && i + 1 < argc) {
+            frame_skip = (uint8_t) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (strncmp(name, "scale", 5) == 0) {
+                filter = FILTER_SCALE;
+                scale = name[5] >= '1' && name[5] <= '4' ? name[5] - '0' : 1;
+            } else if (strcmp(name, "xbr") == 0) {
+                filter = FILTER_XBR;
+            } else if (strcmp(name, "ntsc") == 0) {
+                filter = FILTER_NTSC;
+            }
+        } else if (strcmp(argv[i], "--deferred") == 0) {
+            deferred = true;
+        } else if (strcmp(argv[i], "--nt-cache") == 0) {
+            nt_cache = true;
+        } else if (strcmp(argv[i], "--cheat") == 0 && i + 1 < argc) {
+            const char* code = argv[++i];
+            if (cheat_count < CHEATS_MAX) {
+                cheats[cheat_count++] = code;
+            }
+        } else if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {
+            rewind_seconds = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc) {
+            run_ahead = (uint8_t) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--second-instance") == 0) {
+            second_instance = true;
+        } else {
+            rom = argv[i];
+        }
+    }
+#ifdef WINES_SDL_FRONTEND
+    frontend_options_t options = {.frame_skip = frame_skip, .filter = filter, .scale = scale, .deferred = deferred,
+                                  .nt_cache = nt_cache, .cheats = cheats, .cheat_count = cheat_count,
+                                  .rewind_seconds = rewind_seconds, .run_ahead = run_ahead,
+                                  .run_ahead_second_instance = second_instance};
+    return frontend_sdl_run(rom, &options);
+#else
+    (void) filter;
+    (void) scale;
+    (void) deferred;
+    (void) nt_cache;
+    (void) cheats;
+    (void) cheat_count;
+    (void) rewind_seconds;
+    (void) run_ahead;
+    (void) second_instance;
+    pop_nes_init(rom, frame_skip);
+#endif
+}
@@ -3,7 +3,11 @@
 //
 
 #include "mapper.h"
+#include "cheat.h"
 #include "mappers/mapper0_nrom.h"
+#include "mappers/mapper4_mmc3.h"
+#include "mappers/mapper_nsf.h"
+#include "ppu.h"
 
 uint8_t mapper_cpu_read(mapper_t* mapper, addr_t addr) {
     return mapper->func.cpu_read(mapper, addr);
@@ -13,35 +17,84 @@ void mapper_cpu_write(mapper_t* mapper, addr_t addr, uint8_t val) {
     mapper->func.cpu_write(mapper, addr, val);
 }
 
-uint8_t mapper_ppu_read(mapper_t* mapper, addr_t addr) {
-    return mapper->func.ppu_read(mapper, addr);
+void mapper_ppu_attach(mapper_t* mapper, ppu_t* ppu) {
+    mapper->ppu = ppu;
+    for (uint8_t slot = 0; slot < MAPPER_CHR_BANK_COUNT; ++slot) {
+        if (mapper->chr_banks[slot] != NULL) {
+            ppu_map_chr(ppu, slot, mapper->chr_banks[slot], mapper->cart->chr_ram);
+        }
+    }
+    mapper->func.ppu_attach(mapper);
 }
 
-void mapper_ppu_write(mapper_t* mapper, addr_t addr, uint8_t val) {
-    mapper->func.ppu_write(mapper, addr, val);
+void mapper_set_prg_bank(mapper_t* mapper, uint8_t slot, uint32_t bank) {
+    cart_t* cart = mapper->cart;
+    bank %= cart->pgr_size / MAPPER_PRG_BANK_SIZE;
+    mapper->prg_banks[slot] = cart->pgr_rom + bank * MAPPER_PRG_BANK_SIZE;
+    if (mapper->cheats != NULL) {
+        cheats_map_prg(mapper->cheats, slot, mapper->prg_banks[slot]);
+    }
 }
 
-mapper_t* mapper_create(cart_t* cart) {
-    mapper_t* mapper = wn_calloc(sizeof(mapper_t));
+void mapper_set_chr_bank(mapper_t* mapper, uint8_t slot, uint32_t bank) {
+    cart_t* cart = mapper->cart;
+    bank %= cart->chr_size / MAPPER_CHR_BANK_SIZE;
+    uint8_t* mem = cart->chr_rom + bank * MAPPER_CHR_BANK_SIZE;
+    if (mapper->chr_banks[slot] == mem) {
+        return;
+    }
+    mapper->chr_banks[slot] = mem;
+    if (mapper->ppu != NULL) {
+        ppu_map_chr(mapper->ppu, slot, mem, cart->chr_ram);
+    }
+}
+
+size_t mapper_arena_size(uint8_t mapper_no) {
+    switch (mapper_no) {
+        case MAPPER_000_NROM:
+            return WN_ARENA_ALIGN(sizeof(mapper_t));
+        case MAPPER_004_MMC3:
+            return WN_ARENA_ALIGN(sizeof(mapper_t)) + WN_ARENA_ALIGN(sizeof(mapper4_t));
+        default:
+            return 0;
+    }
+}
+
+mapper_t* mapper_create(cart_t* cart, wn_arena_t* arena) {
+    if (mapper_arena_size(cart->mapper_no) == 0) {
+        return NULL;
+    }
+
+    mapper_t* mapper = wn_arena_calloc(arena, sizeof(mapper_t));
+    mapper->arena = arena;
     mapper->cart = cart;
+    mapper->prg_ram = cart->prg_ram;
+    mapper->irq_time = UINT64_MAX;
 
     switch (cart->mapper_no) {
         case MAPPER_000_NROM:
             mapper->func = mapper0_nrom_init(mapper);
             break;
-        default:
-            wn_free(mapper);
+        case MAPPER_004_MMC3:
+            mapper->func = mapper4_mmc3_init(mapper);
             break;
     }
     return mapper;
 }
 
+mapper_t* mapper_create_nsf(nsf_t* nsf) {
+    mapper_t* mapper = wn_calloc(sizeof(mapper_t));
+    mapper->irq_time = UINT64_MAX;
+    mapper->func = mapper_nsf_init(mapper, nsf);
+    return mapper;
+}
+
 void mapper_destroy(mapper_t* mapper) {
     if (mapper != NULL) {
         if (mapper->func.destroy != NULL) {
             mapper->func.destroy(mapper);
         }
-        wn_free(mapper);
+        wn_arena_free(mapper->arena, mapper);
     }
 
 }
\ No newline at end of file
@@ -7,24 +7,72 @@
 
 #include "common.h"
 #include "cartridge.h"
+#include "state.h"
 
 typedef struct mapper mapper_t;
 
+typedef struct ppu ppu_t;
+
+typedef struct nsf nsf_t;
+
+typedef struct cheats cheats_t;
+
+#define MAPPER_PRG_RAM_SIZE 0x2000  // 8KB at $6000-$7FFF
+
+#define MAPPER_PRG_BANK_SIZE  0x2000    // 8KB
+#define MAPPER_PRG_BANK_COUNT 4         // $8000-$FFFF
+#define MAPPER_CHR_BANK_SIZE  0x400     // 1KB
+#define MAPPER_CHR_BANK_COUNT 8         // $0000-$1FFF
+
+/*
+ * The CPU bus reads PRG ROM straight from prg_banks and the PPU reads pattern tables through its own
+ * page table (see ppu_map_chr), so the callbacks only run on register writes, where a mapper
+ * recomputes the bank pointers with mapper_set_prg_bank/mapper_set_chr_bank.
+ */
 typedef struct {
+    // Fallback for the PRG banks left NULL, e.g. the 4KB banks of NSF
     uint8_t (* cpu_read)(mapper_t*, addr_t);
 
     void (* cpu_write)(mapper_t*, addr_t, uint8_t);
 
-    uint8_t (* ppu_read)(mapper_t*, addr_t);
-
-    void (* ppu_write)(mapper_t*, addr_t, uint8_t);
+    // Sets up the nametable mirroring of the PPU bus, the CHR banks are mapped by mapper_ppu_attach
+    void (* ppu_attach)(mapper_t*);
 
     void (* destroy)(mapper_t*);
+
+    // Called once cpu->cycle_count reaches irq_time to catch up and assert or reschedule the IRQ
+    void (* irq_update)(mapper_t*);
+
+    // Called by the PPU before PPUCTRL/PPUMASK writes and after PPUADDR/PPUDATA move v
+    void (* ppu_sync)(mapper_t*);
+
+    // A12 of the PPU address bus changed, only while ppu->a12_watch is set
+    void (* ppu_a12)(mapper_t*, bool);
+
+    // Registers and counters of the board in save states, state_size bytes, the banks are saved by the caller
+    uint32_t state_size;
+    void (* state_save)(mapper_t*, state_writer_t*);
+    void (* state_load)(mapper_t*, state_reader_t*);
 } mapper_func_t;
 
 struct mapper {
+    // CPU $8000-$FFFF, indexed by (addr - $8000) >> 13
+    uint8_t* prg_banks[MAPPER_PRG_BANK_COUNT];
+    // PPU $0000-$1FFF, mirrored into the PPU page table
+    uint8_t* chr_banks[MAPPER_CHR_BANK_COUNT];
     mapper_func_t func;
     cart_t* cart;
+    ppu_t* ppu;
+    // Work RAM at $6000-$7FFF, NULL when the board has none
+    uint8_t* prg_ram;
+    // CPU cycle of the next IRQ event, UINT64_MAX for none
+    uint64_t irq_time;
+    // Tracks the IRQ source exactly even where it can be predicted, to check the prediction
+    bool exact_irq;
+    // Game Genie codes remapping the PRG slots, NULL when none are loaded
+    cheats_t* cheats;
+    // Holds the mapper and its state, NULL when they are on the heap
+    wn_arena_t* arena;
     void* extra;
 };
 
@@ -32,12 +80,33 @@ uint8_t mapper_cpu_read(mapper_t* mapper, addr_t addr);
 
 void mapper_cpu_write(mapper_t* mapper, addr_t addr, uint8_t val);
 
-uint8_t mapper_ppu_read(mapper_t* mapper, addr_t addr);
+void mapper_ppu_attach(mapper_t* mapper, ppu_t* ppu);
+
+/**
+ * Maps the 8KB PRG ROM bank (wrapped to the ROM size) at CPU $8000 + slot * 8KB
+ */
+void mapper_set_prg_bank(mapper_t* mapper, uint8_t slot, uint32_t bank);
+
+/**
+ * Maps the 1KB CHR bank (wrapped to the CHR size) at PPU slot * 1KB
+ */
+void mapper_set_chr_bank(mapper_t* mapper, uint8_t slot, uint32_t bank);
+
 
-void mapper_ppu_write(mapper_t* mapper, addr_t addr, uint8_t val);
+/**
+ * Arena space taken by a mapper and its state, 0 when the mapper is not supported
+ */
+size_t mapper_arena_size(uint8_t mapper_no);
 
+/**
+ * Returns NULL when the mapper is not supported. Allocated from `arena`, or from the heap when it is NULL.
+ */
+mapper_t* mapper_create(cart_t* cart, wn_arena_t* arena);
 
-mapper_t* mapper_create(cart_t* cart);
+/**
+ * Bankswitching of an NSF player, which has no cartridge or PPU
+ */
+mapper_t* mapper_create_nsf(nsf_t* nsf);
 
 void mapper_destroy(mapper_t* mapper);
 
@@ -6,6 +6,7 @@
 #define WINES_MAPPER0_NROM_H
 
 #include "../mapper.h"
+#include "../ppu.h"
 
 /*
  * NROM-256 with 32 KiB PRG ROM and 8 KiB CHR ROM
@@ -22,41 +23,29 @@
 
 #define MAPPER_000_NROM 0
 
-#define IS_NROM_128 (*(bool*) mapper->extra)
-
-static uint8_t mapper0_cpu_read(mapper_t* mapper, addr_t addr) {
-    if (IS_NROM_128) {
-        addr %= (16 * 1024);
-    }
-    return mapper->cart->pgr_rom[addr];
-}
-
 static void mapper0_cpu_write(mapper_t* mapper, addr_t addr, uint8_t val) {
 
 }
 
-static uint8_t mapper0_ppu_read(mapper_t* mapper, addr_t addr) {
-    return mapper->cart->chr_rom[addr];
-}
-
-static void mapper0_ppu_write(mapper_t* mapper, addr_t addr, uint8_t val) {
-
-}
-
-static void mapper0_destroy(mapper_t* mapper) {
-    wn_free(mapper->extra);
+static void mapper0_ppu_attach(mapper_t* mapper) {
+    ppu_set_mirroring(mapper->ppu, mapper->cart->mirroring);
 }
 
 mapper_func_t mapper0_nrom_init(mapper_t* mapper) {
-    mapper->extra = wn_malloc(sizeof(bool));
-    IS_NROM_128 = (mapper->cart->header.pgr_blocks == 1);
+    // NROM-128 mirrors its 16KB at $C000, which the bank wrap-around takes care of
+    for (uint8_t slot = 0; slot < MAPPER_PRG_BANK_COUNT; ++slot) {
+        mapper_set_prg_bank(mapper, slot, slot);
+    }
+    // Fixed 8KB CHR
+    for (uint8_t slot = 0; slot < MAPPER_CHR_BANK_COUNT; ++slot) {
+        mapper_set_chr_bank(mapper, slot, slot);
+    }
 
     mapper_func_t ret = {
-            mapper0_cpu_read,
+            NULL,
             mapper0_cpu_write,
-            mapper0_ppu_read,
-            mapper0_ppu_write,
-            mapper0_destroy
+            mapper0_ppu_attach,
+            NULL
     };
     return ret;
 }
@@ -0,0 +1,330 @@
+//
+// MMC3 (TxROM)
+//
+
+#ifndef WINES_MAPPER4_MMC3_H
+#define WINES_MAPPER4_MMC3_H
+
+#include <string.h>
+
+#include "../mapper.h"
+#include "../ppu.h"
+#include "../cpu.h"
+
+/*
+ * CPU $6000-$7FFF: 8 KB PRG RAM bank
+ * CPU $8000-$9FFF: 8 KB switchable PRG ROM bank, or the second-last bank (PRG mode 1)
+ * CPU $A000-$BFFF: 8 KB switchable PRG ROM bank
+ * CPU $C000-$DFFF: Second-last bank, or 8 KB switchable PRG ROM bank (PRG mode 1)
+ * CPU $E000-$FFFF: Last bank
+ * PPU $0000-$0FFF: Two 2 KB switchable CHR banks (swapped with $1000-$1FFF by CHR A12 inversion)
+ * PPU $1000-$1FFF: Four 1 KB switchable CHR banks
+ *
+ * Registers, even/odd addresses of each range:
+ *   $8000/$8001: bank select/bank data
+ *   $A000/$A001: mirroring/PRG RAM protect
+ *   $C000/$C001: IRQ latch/IRQ reload
+ *   $E000/$E001: IRQ disable/IRQ enable
+ *
+ * The IRQ counter is clocked by rising edges of PPU A12 that follow at least ~3 CPU cycles of A12 low.
+ * In the usual configuration (background at $0000, 8x8 sprites at $1000) that is exactly one edge on dot 260
+ * of the pre-render and visible scanlines, where the first sprite pattern is fetched, so the expiry is
+ * predicted from the PPU position and posted as an IRQ event. Other configurations (8x16 sprites, background
+ * at $1000, a shared pattern table) switch the PPU to exact A12 tracking (see ppu_t.a12_watch).
+ *
+ * https://www.nesdev.org/wiki/MMC3
+ */
+
+#define MAPPER_004_MMC3 4
+
+// PPU dots A12 must stay low before a rising edge clocks the counter
+#define MMC3_A12_FILTER_DOTS    10
+
+// Dot of the predicted edge, the first sprite pattern fetch
+#define MMC3_CLOCK_TICK         260
+
+// Upper bound between two catch-ups of the predicted counter, about one frame
+#define MMC3_RESYNC_CYCLES      29781
+
+#define MMC3_FRAME_DOTS         (PPU_DOTS_PER_SCANLINE * PPU_SCANLINES)
+
+typedef struct {
+    uint8_t bank_select;
+    uint8_t regs[8];
+
+    uint8_t irq_latch;
+    uint8_t irq_counter;
+    bool irq_reload;
+    bool irq_enabled;
+
+    // The counter is clocked on MMC3_CLOCK_TICK of the pre-render and visible scanlines
+    bool predicted;
+
+    // ppu->dot_count the counter is up to date with, and the in-frame position of that dot
+    uint64_t sync_dot;
+    uint32_t sync_pos;
+
+    // A12 filter, for exact tracking and v moves outside rendering
+    bool a12;
+    uint64_t a12_low_dot;
+} mapper4_t;
+
+#define MMC3_STATE ((mapper4_t*) mapper->extra)
+
+static void mapper4_update_banks(mapper_t* mapper) {
+    mapper4_t* state = MMC3_STATE;
+    uint8_t* regs = state->regs;
+
+    uint32_t second_last = mapper->cart->pgr_size / MAPPER_PRG_BANK_SIZE - 2;
+    bool prg_mode = state->bank_select & 0x40;
+    mapper_set_prg_bank(mapper, 0, prg_mode ? second_last : regs[6]);
+    mapper_set_prg_bank(mapper, 1, regs[7]);
+    mapper_set_prg_bank(mapper, 2, prg_mode ? regs[6] : second_last);
+    mapper_set_prg_bank(mapper, 3, second_last + 1);
+
+    // CHR A12 inversion swaps the 2 KB and 1 KB halves
+    uint8_t invert = (state->bank_select & 0x80) ? 4 : 0;
+    mapper_set_chr_bank(mapper, 0 ^ invert, regs[0] & 0xFE);
+    mapper_set_chr_bank(mapper, 1 ^ invert, regs[0] | 0x01);
+    mapper_set_chr_bank(mapper, 2 ^ invert, regs[1] & 0xFE);
+    mapper_set_chr_bank(mapper, 3 ^ invert, regs[1] | 0x01);
+    for (uint8_t i = 0; i < 4; ++i) {
+        mapper_set_chr_bank(mapper, (4 + i) ^ invert, regs[2 + i]);
+    }
+}
+
+static void mapper4_clock(mapper_t* mapper) {
+    mapper4_t* state = MMC3_STATE;
+    if (state->irq_counter == 0 || state->irq_reload) {
+        state->irq_counter = state->irq_latch;
+        state->irq_reload = false;
+    } else {
+        --state->irq_counter;
+    }
+    if (state->irq_counter == 0 && state->irq_enabled) {
+        cpu_set_irq(mapper->ppu->cpu, CPU_IRQ_MAPPER, true);
+    }
+}
+
+/**
+ * Dots from the in-frame position `pos` to the next counter clock, 0 when `pos` is one
+ */
+static uint32_t mapper4_next_clock(uint32_t pos) {
+    // Line 0 is the pre-render scanline, 240 the last visible one
+    uint32_t line = pos / PPU_DOTS_PER_SCANLINE;
+    if (pos % PPU_DOTS_PER_SCANLINE > MMC3_CLOCK_TICK) {
+        ++line;
+    }
+    if (line > PPU_VISIBLE_SCANLINES) {
+        return MMC3_FRAME_DOTS - pos + MMC3_CLOCK_TICK;
+    }
+    return line * PPU_DOTS_PER_SCANLINE + MMC3_CLOCK_TICK - pos;
+}
+
+/**
+ * Clocks the counter for the predicted edges the PPU went through since the last sync
+ */
+static void mapper4_sync(mapper_t* mapper) {
+    mapper4_t* state = MMC3_STATE;
+    ppu_t* ppu = mapper->ppu;
+    uint64_t elapsed = ppu->dot_count - state->sync_dot;
+    if (state->predicted && elapsed > 0) {
+        uint32_t pos = state->sync_pos;
+        uint32_t next;
+        while ((next = mapper4_next_clock(pos)) < elapsed) {
+            mapper4_clock(mapper);
+            pos = (pos + next + 1) % MMC3_FRAME_DOTS;
+            elapsed -= next + 1;
+        }
+        // Rendering leaves A12 low
+        state->a12 = false;
+        state->a12_low_dot = 0;
+    }
+    state->sync_dot = ppu->dot_count;
+    state->sync_pos = (ppu->scanline + 1) * PPU_DOTS_PER_SCANLINE + ppu->tick;
+}
+
+/**
+ * Picks prediction or exact A12 tracking for the current rendering configuration and schedules the IRQ
+ */
+static void mapper4_schedule(mapper_t* mapper) {
+    mapper4_t* state = MMC3_STATE;
+    ppu_t* ppu = mapper->ppu;
+    bool render = ppu->mask.show_bgr || ppu->mask.show_spr;
+    bool usual = !ppu->ctrl.bgr_pattern_table && ppu->ctrl.spr_pattern_table && !ppu->ctrl.sprite_size;
+
+    state->predicted = render && usual && !mapper->exact_irq;
+    if (ppu->a12_watch != (render && !state->predicted)) {
+        ppu->a12_watch = !ppu->a12_watch;
+        ppu->a12 = state->a12;
+    }
+    mapper->irq_time = UINT64_MAX;
+    if (!state->predicted) {
+        return;
+    }
+
+    uint64_t now = ppu->cpu->cycle_count;
+    mapper->irq_time = now + MMC3_RESYNC_CYCLES;
+    if (!state->irq_enabled) {
+        return;
+    }
+
+    // Clocks until the counter reaches 0
+    uint32_t clocks = state->irq_counter;
+    if (state->irq_reload || state->irq_counter == 0) {
+        clocks = state->irq_latch == 0 ? 1 : state->irq_latch + 1;
+    }
+    // Position of the first clock, then whole scanlines and frames, one clock per line 0-240
+    uint32_t first = state->sync_pos + mapper4_next_clock(state->sync_pos);
+    uint32_t line = (first % MMC3_FRAME_DOTS) / PPU_DOTS_PER_SCANLINE + clocks - 1;
+    uint64_t last = first - (first % MMC3_FRAME_DOTS) / PPU_DOTS_PER_SCANLINE * PPU_DOTS_PER_SCANLINE
+                    + (uint64_t) (line / (PPU_VISIBLE_SCANLINES + 1)) * MMC3_FRAME_DOTS
+                    + (line % (PPU_VISIBLE_SCANLINES + 1)) * PPU_DOTS_PER_SCANLINE;
+    uint64_t dots = last - state->sync_pos + 1;
+    // Three PPU dots per CPU cycle, seen by the CPU at the following instruction boundary
+    uint64_t time = now + (dots + 2) / 3;
+    if (time < mapper->irq_time) {
+        mapper->irq_time = time;
+    }
+}
+
+static void mapper4_irq_update(mapper_t* mapper) {
+    mapper4_sync(mapper);
+    mapper4_schedule(mapper);
+}
+
+static void mapper4_ppu_a12(mapper_t* mapper, bool high) {
+    mapper4_t* state = MMC3_STATE;
+    uint64_t dot = mapper->ppu->dot_count;
+    if (high && !state->a12 && dot - state->a12_low_dot >= MMC3_A12_FILTER_DOTS) {
+        mapper4_clock(mapper);
+    } else if (!high && state->a12) {
+        state->a12_low_dot = dot;
+    }
+    state->a12 = high;
+}
+
+static void mapper4_ppu_sync(mapper_t* mapper) {
+    ppu_t* ppu = mapper->ppu;
+    mapper4_sync(mapper);
+    // Outside rendering PPUADDR/PPUDATA put v on the bus, which programs use to clock the counter by hand
+    bool rendering = (ppu->mask.show_bgr || ppu->mask.show_spr) && ppu->scanline < PPU_VISIBLE_SCANLINES;
+    if (!rendering) {
+        mapper4_ppu_a12(mapper, ppu->reg_v.addr & 0x1000);
+        ppu->a12 = MMC3_STATE->a12;
+    }
+    // The configuration is about to change, scheduled again at the next instruction boundary
+    mapper->irq_time = ppu->cpu->cycle_count;
+}
+
+static void mapper4_cpu_write(mapper_t* mapper, addr_t addr, uint8_t val) {
+    mapper4_t* state = MMC3_STATE;
+    if (addr < 0x8000) {
+        return;
+    }
+
+    bool odd = addr & 1;
+    switch (addr & 0xE000) {
+        case 0x8000:
+            if (odd) {
+                state->regs[state->bank_select & 0b111] = val;
+            } else {
+                state->bank_select = val;
+            }
+            mapper4_update_banks(mapper);
+            break;
+        case 0xA000:
+            if (!odd && mapper->cart->mirroring != MIRRORING_FOUR_SCREEN) {
+                ppu_set_mirroring(mapper->ppu, (val & 1) ? MIRRORING_HORIZONTAL : MIRRORING_VERTICAL);
+            }
+            break;
+        case 0xC000:
+            mapper4_sync(mapper);
+            if (odd) {
+                state->irq_counter = 0;
+                state->irq_reload = true;
+            } else {
+                state->irq_latch = val;
+            }
+            mapper4_schedule(mapper);
+            break;
+        case 0xE000:
+            mapper4_sync(mapper);
+            state->irq_enabled = odd;
+            if (!odd) {
+                cpu_set_irq(mapper->ppu->cpu, CPU_IRQ_MAPPER, false);
+            }
+            mapper4_schedule(mapper);
+            break;
+        default:
+            break;
+    }
+}
+
+// Size of what mapper4_state_save writes
+#define MMC3_STATE_SIZE 35
+
+static void mapper4_state_save(mapper_t* mapper, state_writer_t* w) {
+    mapper4_t* state = MMC3_STATE;
+    state_write_u8(w, state->bank_select);
+    state_write_bytes(w, state->regs, sizeof(state->regs));
+    state_write_u8(w, state->irq_latch);
+    state_write_u8(w, state->irq_counter);
+    state_write_u8(w, state->irq_reload);
+    state_write_u8(w, state->irq_enabled);
+    state_write_u8(w, state->predicted);
+    state_write_u64(w, state->sync_dot);
+    state_write_u32(w, state->sync_pos);
+    state_write_u8(w, state->a12);
+    state_write_u64(w, state->a12_low_dot);
+}
+
+static void mapper4_state_load(mapper_t* mapper, state_reader_t* r) {
+    mapper4_t* state = MMC3_STATE;
+    state->bank_select = state_read_u8(r);
+    state_read_bytes(r, state->regs, sizeof(state->regs));
+    state->irq_latch = state_read_u8(r);
+    state->irq_counter = state_read_u8(r);
+    state->irq_reload = state_read_u8(r);
+    state->irq_enabled = state_read_u8(r);
+    state->predicted = state_read_u8(r);
+    state->sync_dot = state_read_u64(r);
+    state->sync_pos = state_read_u32(r);
+    state->a12 = state_read_u8(r);
+    state->a12_low_dot = state_read_u64(r);
+    // The CPU and the PPU are restored after the mapper, synced and scheduled at the next instruction boundary
+    mapper->irq_time = 0;
+}
+
+static void mapper4_ppu_attach(mapper_t* mapper) {
+    ppu_set_mirroring(mapper->ppu, mapper->cart->mirroring);
+    mapper4_sync(mapper);
+}
+
+static void mapper4_destroy(mapper_t* mapper) {
+    wn_arena_free(mapper->arena, mapper->extra);
+}
+
+mapper_func_t mapper4_mmc3_init(mapper_t* mapper) {
+    mapper4_t* state = wn_arena_calloc(mapper->arena, sizeof(mapper4_t));
+    static const uint8_t INITIAL_REGS[8] = {0, 2, 4, 5, 6, 7, 0, 1};
+    memcpy(state->regs, INITIAL_REGS, sizeof(INITIAL_REGS));
+    mapper->extra = state;
+    mapper4_update_banks(mapper);
+
+    mapper_func_t ret = {
+            NULL,
+            mapper4_cpu_write,
+            mapper4_ppu_attach,
+            mapper4_destroy,
+            mapper4_irq_update,
+            mapper4_ppu_sync,
+            mapper4_ppu_a12,
+            MMC3_STATE_SIZE,
+            mapper4_state_save,
+            mapper4_state_load
+    };
+    return ret;
+}
+
+#endif //WINES_MAPPER4_MMC3_H
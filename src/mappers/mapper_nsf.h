@@ -0,0 +1,65 @@
+//
+// NSF bankswitching
+//
+
+#ifndef WINES_MAPPER_NSF_H
+#define WINES_MAPPER_NSF_H
+
+#include "../mapper.h"
+#include "../nsf.h"
+
+/*
+ * CPU $5FF8-$5FFF: Write-only, selects the 4 KB bank mapped at $8000, $9000, ..., $F000.
+ * CPU $6000-$7FFF: 8 KB work RAM.
+ * CPU $8000-$FFFF: Program data. Without bankswitching the data is loaded at load_addr and never moves.
+ *
+ * https://www.nesdev.org/wiki/NSF#Bankswitching
+ */
+
+typedef struct {
+    nsf_t* nsf;
+    uint8_t banks[8];
+} mapper_nsf_t;
+
+#define NSF_STATE ((mapper_nsf_t*) mapper->extra)
+
+static uint8_t mapper_nsf_cpu_read(mapper_t* mapper, addr_t addr) {
+    mapper_nsf_t* state = NSF_STATE;
+    return state->nsf->data[state->banks[addr >> 12] * NSF_BANK_SIZE + (addr & (NSF_BANK_SIZE - 1))];
+}
+
+static void mapper_nsf_cpu_write(mapper_t* mapper, addr_t addr, uint8_t val) {
+    mapper_nsf_t* state = NSF_STATE;
+    if (addr >= 0x5FF8 && addr <= 0x5FFF && state->nsf->bankswitched) {
+        state->banks[addr - 0x5FF8] = val % state->nsf->bank_count;
+    }
+}
+
+static void mapper_nsf_ppu_attach(mapper_t* mapper) {
+
+}
+
+static void mapper_nsf_destroy(mapper_t* mapper) {
+    wn_free(mapper->prg_ram);
+    wn_free(mapper->extra);
+}
+
+mapper_func_t mapper_nsf_init(mapper_t* mapper, nsf_t* nsf) {
+    mapper_nsf_t* state = wn_calloc(sizeof(mapper_nsf_t));
+    state->nsf = nsf;
+    for (uint8_t i = 0; i < 8; ++i) {
+        state->banks[i] = nsf->bankswitched ? nsf->header.bankswitch[i] % nsf->bank_count : i;
+    }
+    mapper->extra = state;
+    mapper->prg_ram = wn_calloc(MAPPER_PRG_RAM_SIZE);
+
+    mapper_func_t ret = {
+            mapper_nsf_cpu_read,
+            mapper_nsf_cpu_write,
+            mapper_nsf_ppu_attach,
+            mapper_nsf_destroy
+    };
+    return ret;
+}
+
+#endif //WINES_MAPPER_NSF_H
@@ -0,0 +1,200 @@
+//
+// NES Sound Format: loader and headless player driving the CPU and APU without a PPU
+//
+
+#include <string.h>
+
+#include "nsf.h"
+#include "apu.h"
+#include "cpu.h"
+#include "mapper.h"
+#include "platform.h"
+
+_Static_assert(sizeof(nsf_header_t) == 0x80, "NSF header is 128 bytes");
+
+#define NSF_CPU_CLOCK       1789773     // NTSC
+#define NSF_DEFAULT_SPEED   16639       // ~60.1 Hz, in microseconds
+
+/*
+ * INIT and PLAY return with RTS to this address. Nothing is mapped there, so the CPU is never
+ * allowed to execute it: reaching it on an instruction boundary means the routine is done.
+ */
+#define NSF_RETURN_ADDR     0x4100
+
+err_t nsf_load(const char* nsf_filename, nsf_t* nsf) {
+    if (nsf_filename == NULL || nsf == NULL) {
+        return ERR_NULLPTR;
+    }
+
+    wn_file_t* file = open_file(nsf_filename, "rb");
+    if (file == NULL) {
+        return ERR_FILE_NOT_EXISTS;
+    }
+
+    nsf_header_t* header = &nsf->header;
+    if (file->read(file, header, sizeof(nsf_header_t)) != sizeof(nsf_header_t)
+        || memcmp(header->magic, "NESM\x1A", 5) != 0) {
+        file->close(file);
+        return ERR_INVALID_ROM;
+    }
+
+    // Program data runs to the end of the file
+    size_t capacity = 0x8000;
+    size_t size = 0;
+    uint8_t* program = wn_malloc(capacity);
+    size_t n;
+    while ((n = file->read(file, program + size, capacity - size)) > 0) {
+        size += n;
+        if (size == capacity) {
+            uint8_t* grown = wn_malloc(capacity * 2);
+            memcpy(grown, program, size);
+            wn_free(program);
+            program = grown;
+            capacity *= 2;
+        }
+    }
+    file->close(file);
+
+    for (int i = 0; i < 8; ++i) {
+        nsf->bankswitched |= header->bankswitch[i] != 0;
+    }
+
+    if (size == 0 || header->load_addr < 0x8000 || header->total_songs == 0
+        || (!nsf->bankswitched && header->load_addr + size > 0x10000)) {
+        wn_free(program);
+        return ERR_NES_FORMAT;
+    }
+
+    // Bankswitched data is padded in front to the load address offset within its bank
+    size_t offset = nsf->bankswitched ? header->load_addr & (NSF_BANK_SIZE - 1) : header->load_addr - 0x8000;
+    nsf->bank_count = (offset + size + NSF_BANK_SIZE - 1) / NSF_BANK_SIZE;
+    if (!nsf->bankswitched) {
+        nsf->bank_count = 8;
+    }
+    nsf->data = wn_calloc(nsf->bank_count * NSF_BANK_SIZE);
+    memcpy(nsf->data + offset, program, size);
+    wn_free(program);
+
+    if (header->ntsc_speed == 0) {
+        header->ntsc_speed = NSF_DEFAULT_SPEED;
+    }
+    if (header->starting_song == 0 || header->starting_song > header->total_songs) {
+        header->starting_song = 1;
+    }
+    return ERR_OK;
+}
+
+void nsf_free(nsf_t* nsf) {
+    if (nsf != NULL) {
+        wn_free(nsf->data);
+        wn_free(nsf);
+    }
+}
+
+#pragma mark - Player
+
+/**
+ * Calls the subroutine at `addr` as a JSR from NSF_RETURN_ADDR would
+ */
+static void nsf_call(cpu_t* cpu, addr_t addr) {
+    addr_t ret = NSF_RETURN_ADDR - 1;
+    cpu->ram[0x100 + cpu->sp--] = ret >> 8;
+    cpu->ram[0x100 + cpu->sp--] = ret & 0xFF;
+    cpu->pc = addr;
+    cpu->cycles = 0;
+}
+
+FORCE_INLINE static bool nsf_returned(const cpu_t* cpu) {
+    return cpu->pc == NSF_RETURN_ADDR && cpu->cycles == 0;
+}
+
+err_t nsf_player_create(const char* nsf_filename, nsf_player_t** out) {
+    if (nsf_filename == NULL || out == NULL) {
+        return ERR_NULLPTR;
+    }
+
+    nsf_t* nsf = wn_calloc(sizeof(nsf_t));
+    err_t err = nsf_load(nsf_filename, nsf);
+    if (err != ERR_OK) {
+        wn_free(nsf);
+        return err;
+    }
+
+    nsf_player_t* player = wn_calloc(sizeof(nsf_player_t));
+    player->nsf = nsf;
+    player->mapper = mapper_create_nsf(nsf);
+    player->cpu = cpu_create(NULL, player->mapper, NULL);
+    player->apu = apu_create(player->cpu, NULL);
+    nsf_player_start(player, nsf->header.starting_song - 1);
+
+    *out = player;
+    return ERR_OK;
+}
+
+void nsf_player_start(nsf_player_t* player, uint8_t song) {
+    cpu_t* cpu = player->cpu;
+    nsf_t* nsf = player->nsf;
+
+    memset(cpu->ram, 0, sizeof(cpu->ram));
+    memset(player->mapper->prg_ram, 0, MAPPER_PRG_RAM_SIZE);
+    for (addr_t addr = 0x4000; addr <= 0x4013; ++addr) {
+        cpu_mem_write(cpu, addr, 0);
+    }
+    cpu_mem_write(cpu, 0x4015, 0x00);
+    cpu_mem_write(cpu, 0x4015, 0x0F);
+    cpu_mem_write(cpu, 0x4017, 0x40);
+    if (nsf->bankswitched) {
+        for (addr_t i = 0; i < 8; ++i) {
+            cpu_mem_write(cpu, 0x5FF8 + i, nsf->header.bankswitch[i]);
+        }
+    }
+
+    player->song = song < nsf->header.total_songs ? song : 0;
+    player->frame = 0;
+    player->start_cycle = cpu->cycle_count;
+
+    cpu->a = player->song;
+    cpu->x = 0; // NTSC
+    cpu->y = 0;
+    cpu->sp = 0xFD;
+    cpu->p = INTERRUPT_DISABLE | UNUSED;
+    cpu->irq = 0;
+    cpu->nmi = false;
+    nsf_call(cpu, nsf->header.init_addr);
+}
+
+void nsf_player_run_frame(nsf_player_t* player) {
+    cpu_t* cpu = player->cpu;
+    ++player->frame;
+    uint64_t end = player->start_cycle
+                   + (uint64_t) player->frame * player->nsf->header.ntsc_speed * NSF_CPU_CLOCK / 1000000;
+
+    while (cpu->cycle_count < end) {
+        if (nsf_returned(cpu)) {
+            // Idle until the next PLAY call
+            cpu->cycle_count = end;
+            break;
+        }
+        cpu_cycle(cpu);
+    }
+    apu_end_frame(player->apu, cpu->cycle_count);
+
+    // A routine still running (e.g. an INIT that never returns) skips this PLAY call
+    if (nsf_returned(cpu)) {
+        nsf_call(cpu, player->nsf->header.play_addr);
+    }
+}
+
+uint32_t nsf_player_frames(const nsf_player_t* player, double seconds) {
+    return (uint32_t) (seconds * 1000000.0 / player->nsf->header.ntsc_speed);
+}
+
+void nsf_player_destroy(nsf_player_t* player) {
+    if (player != NULL) {
+        apu_destroy(player->apu);
+        wn_arena_free(NULL, player->cpu);
+        mapper_destroy(player->mapper);
+        nsf_free(player->nsf);
+        wn_free(player);
+    }
+}
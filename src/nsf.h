@@ -0,0 +1,82 @@
+//
+// NES Sound Format: loader and headless player driving the CPU and APU without a PPU
+//
+
+#ifndef WINES_NSF_H
+#define WINES_NSF_H
+
+#include "common.h"
+
+typedef struct cpu cpu_t;
+typedef struct apu apu_t;
+typedef struct mapper mapper_t;
+
+#define NSF_BANK_SIZE 0x1000   // 4KB
+
+// NSF file header, the program data follows at offset $80
+typedef struct nsf_header {
+    uint8_t magic[5];           // "NESM", $1A
+    uint8_t version;
+    uint8_t total_songs;
+    uint8_t starting_song;      // 1-based
+    uint16_t load_addr;
+    uint16_t init_addr;
+    uint16_t play_addr;
+    char name[32];
+    char artist[32];
+    char copyright[32];
+    uint16_t ntsc_speed;        // Microseconds between PLAY calls
+    uint8_t bankswitch[8];      // Initial values of $5FF8-$5FFF, all zero when not bankswitched
+    uint16_t pal_speed;
+    uint8_t pal_ntsc;
+    uint8_t extra_sound_chips;
+    uint8_t reserved[4];
+} nsf_header_t;
+
+typedef struct nsf {
+    nsf_header_t header;
+    // Program data laid out in 4KB banks, the first bank starts at (load_addr & $FFF) when bankswitched
+    uint8_t* data;
+    uint32_t bank_count;
+    bool bankswitched;
+} nsf_t;
+
+err_t nsf_load(const char* nsf_filename, nsf_t* out);
+
+void nsf_free(nsf_t* nsf);
+
+/*
+ * Headless player: INIT and PLAY are called as subroutines in place of the vblank NMI. While the routine
+ * has returned the CPU idles and the clock jumps straight to the next PLAY call, so rendering runs far
+ * faster than real time.
+ */
+typedef struct nsf_player {
+    nsf_t* nsf;
+    mapper_t* mapper;
+    cpu_t* cpu;
+    apu_t* apu;
+    uint8_t song;               // 0-based
+    uint32_t frame;             // PLAY calls since INIT
+    uint64_t start_cycle;
+} nsf_player_t;
+
+err_t nsf_player_create(const char* nsf_filename, nsf_player_t** out);
+
+/**
+ * Resets the machine and calls INIT for the 0-based song
+ */
+void nsf_player_start(nsf_player_t* player, uint8_t song);
+
+/**
+ * Runs one PLAY period and ends the APU frame, samples are then available through apu_read_samples
+ */
+void nsf_player_run_frame(nsf_player_t* player);
+
+/**
+ * Number of PLAY periods in the given duration
+ */
+uint32_t nsf_player_frames(const nsf_player_t* player, double seconds);
+
+void nsf_player_destroy(nsf_player_t* player);
+
+#endif //WINES_NSF_H
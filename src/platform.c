@@ -6,6 +6,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #if defined(_WIN32) || defined(_WIN64)
 
@@ -20,6 +21,11 @@
 
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define MSLEEP(MS) usleep(MS*1000)
 #define ACCESS access
@@ -35,8 +41,8 @@ static size_t file_write(wn_file_t* this, const void* in_data, size_t size) {
     return fwrite(in_data, 1, size, this->handle);
 }
 
-static void file_seek(wn_file_t* this, long offset, int whence) {
-    fseek(this->handle, offset, whence);
+static int file_seek(wn_file_t* this, long offset, int whence) {
+    return fseek(this->handle, offset, whence);
 }
 
 static void file_close(wn_file_t* this) {
@@ -45,12 +51,19 @@ static void file_close(wn_file_t* this) {
 }
 
 wn_file_t* open_file(const char* filename, const char* mode) {
-    FILE* file;
+    FILE* file = NULL;
+    if (strcmp(filename, "-") == 0) {
+        file = strchr(mode, 'r') ? stdin : stdout;
+    } else {
 #if defined(_WIN32) || defined(_WIN64)
-    fopen_s(&file, filename, mode);
+        fopen_s(&file, filename, mode);
 #else
-    file = fopen(filename, mode);
+        file = fopen(filename, mode);
 #endif
+    }
+    if (file == NULL) {
+        return NULL;
+    }
     wn_file_t* ret = malloc(sizeof(wn_file_t));
 
     ret->handle = file;
@@ -68,6 +81,68 @@ bool file_exists(const char* filename) {
     return ACCESS(filename, F_OK) != -1;
 }
 
+bool file_stat(const char* filename, uint64_t* mtime, uint64_t* size) {
+#if defined(_WIN32) || defined(_WIN64)
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &data)
+        || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        return false;
+    }
+    // 100ns intervals since 1601
+    uint64_t time = ((uint64_t) data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    *mtime = (time - 116444736000000000ULL) * 100;
+    *size = ((uint64_t) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+#else
+    struct stat st;
+    if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+#if defined(__APPLE__)
+    *mtime = (uint64_t) st.st_mtimespec.tv_sec * 1000000000ULL + st.st_mtimespec.tv_nsec;
+#else
+    *mtime = (uint64_t) st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+#endif
+    *size = (uint64_t) st.st_size;
+#endif
+    return true;
+}
+
+bool file_replace(const char* from, const char* to) {
+#if defined(_WIN32) || defined(_WIN64)
+    // rename fails when the target exists
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+bool wn_list_dir(const char* dirname, wn_dir_func_t func, void* userdata) {
+#if defined(_WIN32) || defined(_WIN64)
+    char pattern[MAX_PATH];
+    snprintf(pattern, sizeof(pattern), "%s\\*", dirname);
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    do {
+        func(userdata, data.cFileName);
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR* dir = opendir(dirname);
+    if (dir == NULL) {
+        return false;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        func(userdata, entry->d_name);
+    }
+    closedir(dir);
+#endif
+    return true;
+}
+
 void wn_msleep(long milliseconds) {
     MSLEEP(milliseconds);
 }
@@ -81,4 +156,273 @@ void wn_nano_sleep(long nanoseconds) {
     req.tv_nsec = nanoseconds % 1000000000L;
     nanosleep(&req, &rem);
 #endif
-}
\ No newline at end of file
+}
+
+uint64_t wn_time_ns(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t) (count.QuadPart / freq.QuadPart) * 1000000000ULL
+           + (uint64_t) (count.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+struct wn_thread {
+    wn_thread_func_t func;
+    void* arg;
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+};
+
+struct wn_mutex {
+#if defined(_WIN32) || defined(_WIN64)
+    SRWLOCK lock;
+#else
+    pthread_mutex_t lock;
+#endif
+};
+
+struct wn_cond {
+#if defined(_WIN32) || defined(_WIN64)
+    CONDITION_VARIABLE cond;
+#else
+    pthread_cond_t cond;
+#endif
+};
+
+#if defined(_WIN32) || defined(_WIN64)
+
+static DWORD WINAPI thread_entry(LPVOID param) {
+    wn_thread_t* thread = param;
+    thread->func(thread->arg);
+    return 0;
+}
+
+wn_thread_t* wn_thread_create(wn_thread_func_t func, void* arg) {
+    wn_thread_t* thread = malloc(sizeof(wn_thread_t));
+    thread->func = func;
+    thread->arg = arg;
+    thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL);
+    return thread;
+}
+
+void wn_thread_join(wn_thread_t* thread) {
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    free(thread);
+}
+
+wn_mutex_t* wn_mutex_create(void) {
+    wn_mutex_t* mutex = malloc(sizeof(wn_mutex_t));
+    InitializeSRWLock(&mutex->lock);
+    return mutex;
+}
+
+void wn_mutex_lock(wn_mutex_t* mutex) {
+    AcquireSRWLockExclusive(&mutex->lock);
+}
+
+void wn_mutex_unlock(wn_mutex_t* mutex) {
+    ReleaseSRWLockExclusive(&mutex->lock);
+}
+
+void wn_mutex_destroy(wn_mutex_t* mutex) {
+    free(mutex);
+}
+
+wn_cond_t* wn_cond_create(void) {
+    wn_cond_t* cond = malloc(sizeof(wn_cond_t));
+    InitializeConditionVariable(&cond->cond);
+    return cond;
+}
+
+void wn_cond_wait(wn_cond_t* cond, wn_mutex_t* mutex) {
+    SleepConditionVariableSRW(&cond->cond, &mutex->lock, INFINITE, 0);
+}
+
+void wn_cond_broadcast(wn_cond_t* cond) {
+    WakeAllConditionVariable(&cond->cond);
+}
+
+void wn_cond_destroy(wn_cond_t* cond) {
+    free(cond);
+}
+
+uint32_t wn_cpu_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+
+#else
+
+static void* thread_entry(void* param) {
+    wn_thread_t* thread = param;
+    thread->func(thread->arg);
+    return NULL;
+}
+
+wn_thread_t* wn_thread_create(wn_thread_func_t func, void* arg) {
+    wn_thread_t* thread = malloc(sizeof(wn_thread_t));
+    thread->func = func;
+    thread->arg = arg;
+    if (pthread_create(&thread->handle, NULL, thread_entry, thread) != 0) {
+        free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+void wn_thread_join(wn_thread_t* thread) {
+    pthread_join(thread->handle, NULL);
+    free(thread);
+}
+
+wn_mutex_t* wn_mutex_create(void) {
+    wn_mutex_t* mutex = malloc(sizeof(wn_mutex_t));
+    pthread_mutex_init(&mutex->lock, NULL);
+    return mutex;
+}
+
+void wn_mutex_lock(wn_mutex_t* mutex) {
+    pthread_mutex_lock(&mutex->lock);
+}
+
+void wn_mutex_unlock(wn_mutex_t* mutex) {
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+void wn_mutex_destroy(wn_mutex_t* mutex) {
+    pthread_mutex_destroy(&mutex->lock);
+    free(mutex);
+}
+
+wn_cond_t* wn_cond_create(void) {
+    wn_cond_t* cond = malloc(sizeof(wn_cond_t));
+    pthread_cond_init(&cond->cond, NULL);
+    return cond;
+}
+
+void wn_cond_wait(wn_cond_t* cond, wn_mutex_t* mutex) {
+    pthread_cond_wait(&cond->cond, &mutex->lock);
+}
+
+void wn_cond_broadcast(wn_cond_t* cond) {
+    pthread_cond_broadcast(&cond->cond);
+}
+
+void wn_cond_destroy(wn_cond_t* cond) {
+    pthread_cond_destroy(&cond->cond);
+    free(cond);
+}
+
+uint32_t wn_cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t) count : 1;
+}
+
+#endif
+
+#if defined(_WIN32) || defined(_WIN64)
+
+wn_mmap_t* wn_mmap_file(const char* filename, wn_mmap_mode_t mode, size_t size) {
+    bool write = mode == WN_MMAP_WRITE;
+    HANDLE file = CreateFileA(filename, write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, write ? OPEN_ALWAYS : OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    if (!write && (size == 0 || size > (uint64_t) file_size.QuadPart)) {
+        size = (size_t) file_size.QuadPart;
+    }
+    // A read-write mapping larger than the file grows it
+    HANDLE mapping = size == 0 ? NULL : CreateFileMappingA(file, NULL, write ? PAGE_READWRITE : PAGE_READONLY,
+                                                           (DWORD) ((uint64_t) size >> 32), (DWORD) size, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) {
+        return NULL;
+    }
+    void* data = MapViewOfFile(mapping, write ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+    CloseHandle(mapping);
+    if (data == NULL) {
+        return NULL;
+    }
+
+    wn_mmap_t* map = wn_malloc(sizeof(wn_mmap_t));
+    map->data = data;
+    map->size = size;
+    return map;
+}
+
+void wn_mmap_sync(wn_mmap_t* map, size_t offset, size_t size) {
+    FlushViewOfFile(map->data + offset, size);
+}
+
+void wn_mmap_close(wn_mmap_t* map) {
+    if (map != NULL) {
+        UnmapViewOfFile(map->data);
+        wn_free(map);
+    }
+}
+
+#else
+
+wn_mmap_t* wn_mmap_file(const char* filename, wn_mmap_mode_t mode, size_t size) {
+    bool write = mode == WN_MMAP_WRITE;
+    int fd = open(filename, write ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if (write) {
+        if ((size_t) st.st_size < size && ftruncate(fd, (off_t) size) != 0) {
+            close(fd);
+            return NULL;
+        }
+    } else if (size == 0 || size > (size_t) st.st_size) {
+        size = (size_t) st.st_size;
+    }
+    void* data = size == 0 ? MAP_FAILED : mmap(NULL, size, write ? PROT_READ | PROT_WRITE : PROT_READ,
+                                              MAP_SHARED, fd, 0);
+    // The mapping keeps its own reference to the file
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    wn_mmap_t* map = wn_malloc(sizeof(wn_mmap_t));
+    map->data = data;
+    map->size = size;
+    return map;
+}
+
+void wn_mmap_sync(wn_mmap_t* map, size_t offset, size_t size) {
+    // msync wants a page aligned start
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(page - 1);
+    msync(map->data + start, size + offset - start, MS_SYNC);
+}
+
+void wn_mmap_close(wn_mmap_t* map) {
+    if (map != NULL) {
+        munmap(map->data, map->size);
+        wn_free(map);
+    }
+}
+
+#endif
@@ -16,19 +16,108 @@ struct wn_file {
 
     size_t (* write)(wn_file_t* this, const void* in_data, size_t size);
 
-    void (* seek)(wn_file_t* this, long offset, int whence);
+    // 0 on success, fails on pipes
+    int (* seek)(wn_file_t* this, long offset, int whence);
 
     void (* close)(wn_file_t* this);
 
     void* handle;
 };
 
+/**
+ * Returns NULL if the file cannot be opened, "-" opens stdout/stdin
+ */
 wn_file_t* open_file(const char* filename, const char* mode);
 
 bool file_exists(const char* filename);
 
+/**
+ * Modification time (nanoseconds since the epoch) and size of a regular file, false if it is not one
+ */
+bool file_stat(const char* filename, uint64_t* mtime, uint64_t* size);
+
+/**
+ * Renames `from` to `to`, replacing `to` in one step if it exists
+ */
+bool file_replace(const char* from, const char* to);
+
+typedef void (* wn_dir_func_t)(void* userdata, const char* name);
+
+/**
+ * Calls `func` with the name of every entry of the directory, false if it cannot be opened
+ */
+bool wn_list_dir(const char* dirname, wn_dir_func_t func, void* userdata);
+
 void wn_msleep(long millisecond);
 
 void wn_nano_sleep(long nanosecond);
 
+/**
+ * Monotonic clock in nanoseconds, for measuring intervals
+ */
+uint64_t wn_time_ns(void);
+
+//
+// Threads
+//
+
+typedef struct wn_thread wn_thread_t;
+
+typedef struct wn_mutex wn_mutex_t;
+
+typedef struct wn_cond wn_cond_t;
+
+typedef void (* wn_thread_func_t)(void* arg);
+
+wn_thread_t* wn_thread_create(wn_thread_func_t func, void* arg);
+
+void wn_thread_join(wn_thread_t* thread);
+
+wn_mutex_t* wn_mutex_create(void);
+
+void wn_mutex_lock(wn_mutex_t* mutex);
+
+void wn_mutex_unlock(wn_mutex_t* mutex);
+
+void wn_mutex_destroy(wn_mutex_t* mutex);
+
+wn_cond_t* wn_cond_create(void);
+
+void wn_cond_wait(wn_cond_t* cond, wn_mutex_t* mutex);
+
+void wn_cond_broadcast(wn_cond_t* cond);
+
+void wn_cond_destroy(wn_cond_t* cond);
+
+/**
+ * Number of logical processors
+ */
+uint32_t wn_cpu_count(void);
+
+//
+// Memory-mapped files
+//
+
+typedef enum {
+    WN_MMAP_READ = 0,   // Read-only, a size of 0 maps the whole file
+    WN_MMAP_WRITE,      // Shared read-write, the file is created or grown to the size (new bytes read as zero)
+} wn_mmap_mode_t;
+
+typedef struct wn_mmap {
+    uint8_t* data;
+    size_t size;
+} wn_mmap_t;
+
+/**
+ * Returns NULL if the file cannot be opened or mapped
+ */
+wn_mmap_t* wn_mmap_file(const char* filename, wn_mmap_mode_t mode, size_t size);
+
+/**
+ * Writes the modified pages of the range back to the file
+ */
+void wn_mmap_sync(wn_mmap_t* map, size_t offset, size_t size);
+
+void wn_mmap_close(wn_mmap_t* map);
+
 #endif //WINES_PLATFORM_H
@@ -2,10 +2,11 @@
 // Created by WangKZ on 2024/3/28.
 //
 
-#include <stdio.h>
+#include <string.h>
 
 #include "ppu.h"
 #include "cpu.h"
+#include "ppu_deferred.h"
 
 /*
  * PPU Memory Map
@@ -65,27 +66,672 @@ const uint32_t DEFAULT_PALETTES[64] = {
 #define ARG_PPU         ppu
 #define DECL_ARG_PPU    ppu_t* ARG_PPU
 
-#define ppu_read(addr)          mapper_ppu_read(ARG_PPU->mapper, addr)
-#define ppu_write(addr, val)    mapper_ppu_write(ARG_PPU->mapper, addr, val)
+/*
+ * Palette RAM index of $3F00-$3FFF
+ *
+ * $3F10/$3F14/$3F18/$3F1C are mirrors of $3F00/$3F04/$3F08/$3F0C
+ */
+FORCE_INLINE uint8_t fn_palette_index(addr_t addr) {
+    addr &= 0x1F;
+    return (addr & 0x13) == 0x10 ? addr & 0x0F : addr;
+}
+
+FORCE_INLINE uint8_t fn_ppu_read(DECL_ARG_PPU, addr_t addr) {
+    addr &= 0x3FFF;
+    if (addr >= 0x3F00) {
+        return ppu->palette[fn_palette_index(addr)];
+    }
+    return ppu->pages[addr >> 10][addr & (PPU_PAGE_SIZE - 1)];
+}
+
+/*
+ * Updates the decoded palettes of the 4x4 tiles covered by attribute byte `offset` (0-63) of a CIRAM bank
+ */
+FORCE_INLINE void fn_attr_decode(DECL_ARG_PPU, uint8_t bank, uint8_t offset, uint8_t attr) {
+    uint8_t y0 = (offset >> 3) << 2;
+    uint8_t x0 = (offset & 7) << 2;
+    for (uint8_t y = y0; y < y0 + 4; ++y) {
+        uint8_t* row = &ppu->nt_palette[bank][y][x0];
+        for (uint8_t x = 0; x < 4; ++x) {
+            // Each attribute byte covers 4x4 tiles, 2 bits per 2x2 tiles quadrant
+            row[x] = ((attr >> (((y & 2) << 1) | ((x0 + x) & 2))) & 0b11) << 2;
+        }
+    }
+}
+
+FORCE_INLINE void fn_ppu_write(DECL_ARG_PPU, addr_t addr, uint8_t val) {
+    addr &= 0x3FFF;
+    if (addr >= 0x3F00) {
+        // Palette entries are 6 bits
+        ppu->palette[fn_palette_index(addr)] = val & 0x3F;
+    } else if (ppu->pages_writable & (1 << (addr >> 10))) {
+        ppu->pages[addr >> 10][addr & (PPU_PAGE_SIZE - 1)] = val;
+        if (addr >= 0x2000 && (addr & 0x3FF) >= 0x3C0) {
+            fn_attr_decode(ppu, ppu->nt_bank[(addr >> 10) & 3], addr & 0x3F, val);
+        }
+    }
+}
+
+#define ppu_read(addr)          fn_ppu_read(ARG_PPU, addr)
+#define ppu_write(addr, val)    fn_ppu_write(ARG_PPU, addr, val)
+
+// Records a write to PPU memory for the deferred renderer
+#define ppu_log(type, addr, val, page) do { \
+    if (ppu->deferred != NULL) ppu_deferred_log(ppu->deferred, type, addr, val, page); \
+} while (0)
+
+// Lets the mapper catch up with the PPU address bus before the rendering configuration or v changes
+#define ppu_mapper_sync() do { \
+    if (ppu->mapper->func.ppu_sync != NULL) ppu->mapper->func.ppu_sync(ppu->mapper); \
+} while (0)
 
 #define is_ppu_render()         (ppu->mask.show_bgr || ppu->mask.show_spr)
 
-uint32_t ppu_render(DECL_ARG_PPU) {
+#define spr_height()            (ppu->ctrl.sprite_size ? 16 : 8)
 
-    // Background rendering
-    if (ppu->mask.show_bgr) {
-        uint8_t tile_idx = ppu_read(ppu->reg_v.addr);
+// Sprite evaluation runs from dot 65 to dot 256 of every visible scanline
+#define SPR_EVAL_TICK_BEGIN     65
+#define SPR_EVAL_TICK_END       256
+
+// OAM sprite attributes (byte 2)
+#define SPR_ATTR_FLIP_H         0x40
+#define SPR_ATTR_FLIP_V         0x80
+
+/*
+ * Loopy scrolling, the increments of v done by the background fetches.
+ *
+ * https://www.nesdev.org/wiki/PPU_scrolling
+ */
+static void ppu_inc_hori_v(DECL_ARG_PPU) {
+    if (ppu->reg_v.coarse_x == 31) {
+        ppu->reg_v.coarse_x = 0;
+        ppu->reg_v.nametable_select ^= 0b01; // switch horizontal nametable
+    } else {
+        ++ppu->reg_v.coarse_x;
+    }
+}
+
+static void ppu_inc_vert_v(DECL_ARG_PPU) {
+    if (ppu->reg_v.fine_y < 7) {
+        ++ppu->reg_v.fine_y;
+        return;
+    }
+    ppu->reg_v.fine_y = 0;
+    if (ppu->reg_v.coarse_y == 29) {
+        ppu->reg_v.coarse_y = 0;
+        ppu->reg_v.nametable_select ^= 0b10; // switch vertical nametable
+    } else if (ppu->reg_v.coarse_y == 31) {
+        // Attribute rows wrap without switching nametable
+        ppu->reg_v.coarse_y = 0;
+    } else {
+        ++ppu->reg_v.coarse_y;
+    }
+}
+
+// See Nametable cache
+static void ppu_nt_cache_write(DECL_ARG_PPU);
+
+#pragma mark Sprite evaluation
+
+/*
+ * Opaque pixels (bit 7 leftmost) of one row of a sprite, `row` counted from the top of the sprite on screen
+ */
+static uint8_t ppu_spr_row_opaque(DECL_ARG_PPU, const uint8_t* spr, uint8_t row) {
+    uint8_t height = spr_height();
+    uint8_t attr = spr[2];
+    if (attr & SPR_ATTR_FLIP_V) {
+        row = height - 1 - row;
+    }
+
+    addr_t pattern;
+    if (height == 16) {
+        // 8x16: bit 0 of the tile index selects the pattern table
+        uint8_t tile = (spr[1] & 0xFE) + (row >> 3);
+        pattern = ((spr[1] & 1) << 12) | (tile << 4) | (row & 7);
+    } else {
+        pattern = (ppu->ctrl.spr_pattern_table << 12) | (spr[1] << 4) | row;
+    }
+
+    uint8_t bits = ppu_read(pattern) | ppu_read(pattern + 8);
+    if (attr & SPR_ATTR_FLIP_H) {
+        bits = (bits & 0xF0) >> 4 | (bits & 0x0F) << 4;
+        bits = (bits & 0xCC) >> 2 | (bits & 0x33) << 2;
+        bits = (bits & 0xAA) >> 1 | (bits & 0x55) << 1;
+    }
+    return bits;
+}
+
+/*
+ * Sprite overflow with the hardware bug: once 8 sprites are found, the evaluation keeps
+ * incrementing both the sprite index n and the byte index m, so it reads tile/attribute/x
+ * bytes as Y coordinates.
+ *
+ * Returns the dot where the overflow flag gets set, or 0 if it is not set on this scanline.
+ */
+static uint16_t ppu_spr_overflow_tick(DECL_ARG_PPU, int16_t scanline, uint8_t n, uint16_t tick) {
+    uint8_t height = spr_height();
+    uint8_t m = 0;
+    for (; n < 64 && tick <= SPR_EVAL_TICK_END; tick += 2) {
+        int16_t row = scanline - ppu->oam[n * 4 + m];
+        if (row >= 0 && row < height) {
+            return tick;
+        }
+        ++n;
+        m = (m + 1) & 3;
+    }
+    return 0;
+}
+
+/*
+ * Builds the secondary OAM of every visible scanline from the current OAM,
+ * along with the sprite overflow event and the sprite 0 row masks.
+ *
+ * https://www.nesdev.org/wiki/PPU_sprite_evaluation
+ */
+static void ppu_sprite_eval(DECL_ARG_PPU) {
+    uint8_t height = spr_height();
+
+    // Number of OAM entries checked per scanline when its secondary OAM got full
+    uint8_t n_checked[PPU_VISIBLE_SCANLINES] = {0};
+    for (int16_t line = 0; line < PPU_VISIBLE_SCANLINES; ++line) {
+        ppu->line_sprites[line].count = 0;
+    }
+
+    for (uint8_t n = 0; n < 64; ++n) {
+        uint8_t y = ppu->oam[n * 4];
+        for (uint8_t row = 0; row < height; ++row) {
+            int16_t line = y + row;
+            if (line >= PPU_VISIBLE_SCANLINES) {
+                break;
+            }
+            ppu_line_sprites_t* sprites = &ppu->line_sprites[line];
+            if (sprites->count < PPU_SPRITES_PER_LINE) {
+                sprites->index[sprites->count++] = n;
+                n_checked[line] = n + 1;
+            }
+        }
+    }
+
+    ppu->spr_overflow_scanline = -1;
+    for (int16_t line = 0; line < PPU_VISIBLE_SCANLINES; ++line) {
+        ppu_line_sprites_t* sprites = &ppu->line_sprites[line];
+        if (sprites->count < PPU_SPRITES_PER_LINE) {
+            continue;
+        }
+        // 8 dots for each sprite copied into secondary OAM, 2 dots for each one out of range
+        uint8_t n = n_checked[line];
+        uint16_t tick = SPR_EVAL_TICK_BEGIN + 8 * PPU_SPRITES_PER_LINE + 2 * (n - PPU_SPRITES_PER_LINE);
+        tick = ppu_spr_overflow_tick(ppu, line, n, tick);
+        if (tick != 0) {
+            ppu->spr_overflow_scanline = line;
+            ppu->spr_overflow_tick = tick;
+            break;
+        }
+    }
+
+    for (uint8_t row = 0; row < height; ++row) {
+        ppu->spr0_rows[row] = ppu_spr_row_opaque(ppu, ppu->oam, row);
+    }
+
+    ppu->oam_dirty = false;
+}
+
+/*
+ * Opaque pixels of the background tile `offset` tiles right of the current v
+ */
+static uint8_t ppu_bgr_tile_opaque(DECL_ARG_PPU, uint8_t offset) {
+    uint16_t coarse_x = ppu->reg_v.coarse_x + offset;
+    uint8_t nametable = ppu->reg_v.nametable_select ^ ((coarse_x >> 5) & 1);
+    addr_t nt_addr = 0x2000 | (nametable << 10) | (ppu->reg_v.coarse_y << 5) | (coarse_x & 31);
+
+    uint8_t tile = ppu_read(nt_addr);
+    addr_t pattern = (ppu->ctrl.bgr_pattern_table << 12) | (tile << 4) | ppu->reg_v.fine_y;
+    return ppu_read(pattern) | ppu_read(pattern + 8);
+}
+
+/*
+ * Schedules the sprite 0 hit of the next scanline.
+ *
+ * Called at dot 257 when v holds the scroll position of the next scanline: the opaque pixels of
+ * sprite 0's row are ANDed with the opaque pixels of the background under it, the first
+ * common pixel x is the hit, which happens when the pixel is output at dot x + 1.
+ */
+static void ppu_spr0_predict(DECL_ARG_PPU, int16_t eval_line) {
+    ppu->spr0_hit_tick = 0;
+
+    const ppu_line_sprites_t* sprites = &ppu->line_sprites[eval_line];
+    if (ppu->status.sprite_0_hit || sprites->count == 0 || sprites->index[0] != 0) {
+        return;
+    }
+    if (!ppu->mask.show_bgr || !ppu->mask.show_spr) {
+        return;
+    }
+
+    uint8_t spr_x = ppu->oam[3];
+    uint8_t spr_mask = ppu->spr0_rows[eval_line - ppu->oam[0]];
+    if (spr_mask == 0) {
+        return;
     }
 
-    // Sprite rendering
+    uint16_t fine = ppu->reg_x + spr_x;
+    uint16_t bgr_bits = (ppu_bgr_tile_opaque(ppu, fine >> 3) << 8) | ppu_bgr_tile_opaque(ppu, (fine >> 3) + 1);
+    uint8_t hit = spr_mask & (uint8_t) (bgr_bits >> (8 - (fine & 7)));
+
+    // No hit in the left 8 pixels when either of them is clipped
+    if (spr_x < 8 && (!ppu->mask.show_bgr_left8 || !ppu->mask.show_spr_left8)) {
+        hit &= 0xFF >> (8 - spr_x);
+    }
+    // Nor at x = 255
+    if (spr_x > 255 - 8) {
+        hit &= 0xFF << (spr_x - (255 - 8));
+    }
+
+    if (hit != 0) {
+        uint8_t first = 0;
+        while (!(hit & (0x80 >> first))) {
+            ++first;
+        }
+        ppu->spr0_hit_tick = spr_x + first + 1;
+    }
+}
+
+void ppu_oam_dma(ppu_t* ppu, const uint8_t page[256]) {
+    ppu_nt_cache_write(ppu);
+    for (int i = 0; i < 256; ++i) {
+        ppu_log(PPU_LOG_OAM, (uint8_t) (ppu->oam_addr + i), page[i], NULL);
+        ppu->oam[(uint8_t) (ppu->oam_addr + i)] = page[i];
+    }
+    // OAM is stable for the rest of the frame in practice
+    ppu_sprite_eval(ppu);
+}
+
+/*
+ * Background pixels of a scanline starting at the scroll position `v`, as 4-bit palette RAM indexes
+ * (0 is transparent). Holds 33 tiles since fine X scroll may shift the line by up to 7 pixels.
+ */
+static void ppu_render_bgr_line(DECL_ARG_PPU, inner_reg_t v, uint8_t out[33 * 8]) {
+    addr_t pattern_base = (ppu->ctrl.bgr_pattern_table << 12) | v.fine_y;
+
+    const uint8_t* tiles = NULL;
+    const uint8_t* palettes = NULL;
+    for (uint8_t i = 0; i < 33; ++i) {
+        if (i == 0 || v.coarse_x == 0) {
+            // Row of the nametable the fetch is in
+            tiles = ppu->pages[8 | v.nametable_select] + (v.coarse_y << 5);
+            palettes = ppu->nt_palette[ppu->nt_bank[v.nametable_select]][v.coarse_y];
+        }
+        uint8_t tile = tiles[v.coarse_x];
+        uint8_t palette = palettes[v.coarse_x];
+
+        addr_t pattern = pattern_base | (tile << 4);
+        uint8_t lo = ppu_read(pattern);
+        uint8_t hi = ppu_read(pattern + 8);
+        for (uint8_t px = 0; px < 8; ++px) {
+            uint8_t color = ((lo >> (7 - px)) & 1) | (((hi >> (7 - px)) & 1) << 1);
+            out[i * 8 + px] = color ? palette | color : 0;
+        }
+
+        // coarse X increment
+        if (v.coarse_x == 31) {
+            v.coarse_x = 0;
+            v.nametable_select ^= 0b01;
+        } else {
+            ++v.coarse_x;
+        }
+    }
+}
+
+/*
+ * Sprite pixels of a scanline from its secondary OAM, as 4-bit sprite palette indexes (0 is transparent).
+ * Lower OAM index wins; bit 7 marks sprites behind the background.
+ */
+static void ppu_render_spr_line(DECL_ARG_PPU, int16_t scanline, uint8_t out[PPU_FRAME_WIDTH]) {
+    if (scanline == 0) {
+        // Nothing is evaluated for the first line
+        return;
+    }
+    const ppu_line_sprites_t* sprites = &ppu->line_sprites[scanline - 1];
+
+    for (uint8_t i = 0; i < sprites->count; ++i) {
+        const uint8_t* spr = &ppu->oam[sprites->index[i] * 4];
+        uint8_t row = scanline - 1 - spr[0];
+        uint8_t attr = spr[2];
+        uint8_t height = spr_height();
+        if (attr & SPR_ATTR_FLIP_V) {
+            row = height - 1 - row;
+        }
+
+        addr_t pattern;
+        if (height == 16) {
+            uint8_t tile = (spr[1] & 0xFE) + (row >> 3);
+            pattern = ((spr[1] & 1) << 12) | (tile << 4) | (row & 7);
+        } else {
+            pattern = (ppu->ctrl.spr_pattern_table << 12) | (spr[1] << 4) | row;
+        }
+        uint8_t lo = ppu_read(pattern);
+        uint8_t hi = ppu_read(pattern + 8);
+
+        uint8_t palette = 0x10 | ((attr & 0b11) << 2);
+        uint8_t behind = attr & 0x20 ? 0x80 : 0;
+        for (uint8_t px = 0; px < 8; ++px) {
+            uint16_t x = spr[3] + px;
+            if (x >= PPU_FRAME_WIDTH) {
+                break;
+            }
+            uint8_t bit = attr & SPR_ATTR_FLIP_H ? px : 7 - px;
+            uint8_t color = ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+            if (color && out[x] == 0) {
+                out[x] = behind | palette | color;
+            }
+        }
+    }
+}
+
+/*
+ * Mixes the background pixels of a scanline (palette RAM indexes, fine X applied) with its sprites
+ * and outputs the colors
+ */
+static void ppu_output_line(DECL_ARG_PPU, int16_t scanline, const uint8_t* bgr_line,
+                            uint8_t line[PPU_FRAME_WIDTH], uint8_t* emphasis) {
+    uint8_t backdrop = ppu->palette[0];
+    uint8_t color_mask = ppu->mask.greyscale ? 0x30 : 0x3F;
+    *emphasis = ppu->mask.val & 0xE0;
+
+    if (!is_ppu_render()) {
+        // Rendering disabled, the backdrop color is shown
+        for (uint16_t x = 0; x < PPU_FRAME_WIDTH; ++x) {
+            line[x] = backdrop & color_mask;
+        }
+        return;
+    }
+
+    uint8_t spr[PPU_FRAME_WIDTH] = {0};
     if (ppu->mask.show_spr) {
+        ppu_render_spr_line(ppu, scanline, spr);
+    }
+
+    for (uint16_t x = 0; x < PPU_FRAME_WIDTH; ++x) {
+        uint8_t b = x < 8 && !ppu->mask.show_bgr_left8 ? 0 : bgr_line[x];
+        uint8_t s = x < 8 && !ppu->mask.show_spr_left8 ? 0 : spr[x];
+
+        uint8_t index;
+        if (s && (!b || !(s & 0x80))) {
+            index = s & 0x1F;
+        } else {
+            index = b;
+        }
+        line[x] = (index ? ppu->palette[index] : backdrop) & color_mask;
+    }
+}
+
+/*
+ * Renders a whole visible scanline.
+ *
+ * Scroll comes from v as it was latched at the end of the previous scanline,
+ * the other inputs (mask, palettes, pattern tables) are sampled once for the line.
+ */
+void ppu_render_scanline(DECL_ARG_PPU, int16_t scanline, uint8_t line[PPU_FRAME_WIDTH], uint8_t* emphasis) {
+    uint8_t bgr[33 * 8] = {0};
+    if (ppu->mask.show_bgr) {
+        ppu_render_bgr_line(ppu, ppu->line_v, bgr);
+    }
+    ppu_output_line(ppu, scanline, bgr + ppu->line_x, line, emphasis);
+}
+
+#pragma mark Nametable cache
+
+/*
+ * Pre-rendered background of the four nametables, laid out as the scroll sees them:
+ *
+ *   +-----+-----+
+ *   | NT0 | NT1 |  512 x 480 background palette indexes
+ *   +-----+-----+
+ *   | NT2 | NT3 |
+ *   +-----+-----+
+ *
+ * Tiles are rendered again only when their nametable byte, attribute or pattern changed.
+ * A frame whose scanlines all scroll from the same origin is a 256x240 window of this bitmap,
+ * with sprites composited on top. While the frame looks that way the scanlines are not rendered;
+ * on the first sign of a split (a scroll/control/mask change, any write to PPU memory or OAM)
+ * the scanlines so far are produced from the bitmap and the rest of the frame uses the scanline path.
+ */
+#define NT_CACHE_WIDTH  (PPU_FRAME_WIDTH * 2)
+#define NT_CACHE_HEIGHT (PPU_FRAME_HEIGHT * 2)
+
+struct ppu_nt_cache {
+    uint8_t bitmap[NT_CACHE_HEIGHT][NT_CACHE_WIDTH];
+
+    // Tiles to render again, bit N of dirty[nt][coarse_y] is coarse_x N
+    uint32_t dirty[4][30];
+
+    // Patterns written or remapped, bit per tile of each pattern table
+    uint8_t chr_dirty[2][256 / 8];
+
+    bool all_dirty;
+
+    // Background pattern table the bitmap was rendered with
+    uint8_t bgr_table;
+
+    // The scanlines of the current frame are left to the bitmap
+    bool pending;
 
+    // Scanlines of the current frame recorded so far, and what they all share
+    int16_t lines;
+    inner_reg_t v;
+    uint8_t x;
+    uint8_t ctrl;
+    uint8_t mask;
+};
+
+static void ppu_nt_cache_render_tile(DECL_ARG_PPU, ppu_nt_cache_t* cache, uint8_t nt, uint8_t cy, uint8_t cx) {
+    uint8_t tile = ppu->pages[8 | nt][(cy << 5) | cx];
+    uint8_t palette = ppu->nt_palette[ppu->nt_bank[nt]][cy][cx];
+    addr_t pattern = (cache->bgr_table << 12) | (tile << 4);
+
+    uint8_t* out = &cache->bitmap[(nt >> 1) * PPU_FRAME_HEIGHT + cy * 8][(nt & 1) * PPU_FRAME_WIDTH + cx * 8];
+    for (uint8_t row = 0; row < 8; ++row, out += NT_CACHE_WIDTH) {
+        uint8_t lo = ppu_read(pattern | row);
+        uint8_t hi = ppu_read(pattern | row | 8);
+        for (uint8_t px = 0; px < 8; ++px) {
+            uint8_t color = ((lo >> (7 - px)) & 1) | (((hi >> (7 - px)) & 1) << 1);
+            out[px] = color ? palette | color : 0;
+        }
     }
+}
 
-    uint8_t bgr_color_idx = ppu_read(0x3F00);
-    printf("idx: %d\n", bgr_color_idx);
+static void ppu_nt_cache_refresh(DECL_ARG_PPU, ppu_nt_cache_t* cache) {
+    if (cache->bgr_table != ppu->ctrl.bgr_pattern_table) {
+        cache->bgr_table = ppu->ctrl.bgr_pattern_table;
+        cache->all_dirty = true;
+    }
+
+    const uint8_t* chr_dirty = cache->chr_dirty[cache->bgr_table];
+    for (uint8_t nt = 0; nt < 4; ++nt) {
+        const uint8_t* tiles = ppu->pages[8 | nt];
+        for (uint8_t cy = 0; cy < 30; ++cy) {
+            uint32_t dirty = cache->dirty[nt][cy];
+            for (uint8_t cx = 0; cx < 32; ++cx) {
+                uint8_t tile = tiles[(cy << 5) | cx];
+                if (cache->all_dirty || dirty & (1u << cx) || chr_dirty[tile >> 3] & (1 << (tile & 7))) {
+                    ppu_nt_cache_render_tile(ppu, cache, nt, cy, cx);
+                }
+            }
+            cache->dirty[nt][cy] = 0;
+        }
+    }
+    memset(cache->chr_dirty, 0, sizeof(cache->chr_dirty));
+    cache->all_dirty = false;
+}
+
+/*
+ * Row of the bitmap scanline 0 starts at, and the v scanline `y` has when scrolling from there
+ */
+FORCE_INLINE uint16_t fn_nt_cache_row(inner_reg_t v) {
+    return (v.nametable_select >> 1) * PPU_FRAME_HEIGHT + v.coarse_y * 8 + v.fine_y;
+}
+
+FORCE_INLINE inner_reg_t fn_nt_cache_line_v(inner_reg_t v, int16_t y) {
+    uint16_t row = (fn_nt_cache_row(v) + y) % NT_CACHE_HEIGHT;
+    uint16_t nt_row = row % PPU_FRAME_HEIGHT;
+    v.nametable_select = (v.nametable_select & 0b01) | ((row / PPU_FRAME_HEIGHT) << 1);
+    v.coarse_y = nt_row >> 3;
+    v.fine_y = nt_row & 7;
+    return v;
+}
+
+/*
+ * Produces the recorded scanlines of the current frame from the bitmap and ends the pending frame
+ */
+static void ppu_nt_cache_flush(DECL_ARG_PPU) {
+    ppu_nt_cache_t* cache = ppu->nt_cache;
+    cache->pending = false;
+    if (cache->lines == 0) {
+        return;
+    }
+    // Scanlines are output with the registers they were recorded with
+    uint8_t ctrl = ppu->ctrl.val;
+    uint8_t mask = ppu->mask.val;
+    ppu->ctrl.val = cache->ctrl;
+    ppu->mask.val = cache->mask;
+    ppu_nt_cache_refresh(ppu, cache);
+
+    uint16_t x = ((cache->v.nametable_select & 1) * PPU_FRAME_WIDTH + cache->v.coarse_x * 8 + cache->x);
+    uint16_t row = fn_nt_cache_row(cache->v);
+    // Split of the window at the right edge of the bitmap
+    uint16_t left = NT_CACHE_WIDTH - x < PPU_FRAME_WIDTH ? NT_CACHE_WIDTH - x : PPU_FRAME_WIDTH;
+
+    uint8_t bgr[PPU_FRAME_WIDTH] = {0};
+    for (int16_t y = 0; y < cache->lines; ++y, ++row) {
+        if (row == NT_CACHE_HEIGHT) {
+            row = 0;
+        }
+        if (ppu->mask.show_bgr) {
+            memcpy(bgr, &cache->bitmap[row][x], left);
+            memcpy(bgr + left, cache->bitmap[row], PPU_FRAME_WIDTH - left);
+        }
+        ppu_output_line(ppu, y, bgr, ppu->frame[y], &ppu->frame_emphasis[y]);
+    }
+    ppu->ctrl.val = ctrl;
+    ppu->mask.val = mask;
+}
+
+/*
+ * Scanline `scanline` is about to be rendered: whether it is left to the bitmap
+ */
+static bool ppu_nt_cache_line(DECL_ARG_PPU, int16_t scanline) {
+    ppu_nt_cache_t* cache = ppu->nt_cache;
+    if (!cache->pending) {
+        return false;
+    }
+    if (scanline == 0) {
+        cache->v = ppu->line_v;
+        cache->x = ppu->line_x;
+        cache->ctrl = ppu->ctrl.val;
+        cache->mask = ppu->mask.val;
+        if (cache->v.coarse_y < 30) {
+            cache->lines = 1;
+            return true;
+        }
+        // Scrolled into the attribute table, not in the bitmap
+        cache->pending = false;
+        return false;
+    }
+
+    if (ppu->line_v.addr == fn_nt_cache_line_v(cache->v, scanline).addr && ppu->line_x == cache->x &&
+        ppu->ctrl.val == cache->ctrl && ppu->mask.val == cache->mask) {
+        cache->lines = scanline + 1;
+        return true;
+    }
+    ppu_nt_cache_flush(ppu);
+    return false;
+}
+
+/*
+ * PPU memory, OAM or the page table is about to change
+ */
+static void ppu_nt_cache_write(DECL_ARG_PPU) {
+    if (ppu->nt_cache != NULL && ppu->nt_cache->pending) {
+        // Recorded scanlines were displayed with the memory as it is
+        ppu_nt_cache_flush(ppu);
+    }
+}
+
+/*
+ * Marks what a PPU bus write at `addr` changes in the bitmap
+ */
+static void ppu_nt_cache_invalidate(DECL_ARG_PPU, addr_t addr) {
+    ppu_nt_cache_t* cache = ppu->nt_cache;
+    addr &= 0x3FFF;
+    if (addr < 0x2000) {
+        uint8_t tile = addr >> 4;
+        cache->chr_dirty[addr >> 12][tile >> 3] |= 1 << (tile & 7);
+    } else if (addr < 0x3F00) {
+        uint8_t bank = ppu->nt_bank[(addr >> 10) & 3];
+        uint16_t offset = addr & 0x3FF;
+        for (uint8_t nt = 0; nt < 4; ++nt) {
+            if (ppu->nt_bank[nt] != bank) {
+                continue;
+            }
+            if (offset < 0x3C0) {
+                cache->dirty[nt][offset >> 5] |= 1u << (offset & 31);
+            } else {
+                // 4x4 tiles of an attribute byte
+                uint8_t y0 = ((offset & 0x3F) >> 3) << 2;
+                for (uint8_t cy = y0; cy < y0 + 4 && cy < 30; ++cy) {
+                    cache->dirty[nt][cy] |= 0xFu << ((offset & 7) << 2);
+                }
+            }
+        }
+    }
+}
 
+/*
+ * v updates of the pre-render and visible scanlines
+ */
+static void ppu_scroll_cycle(DECL_ARG_PPU) {
+    if (!is_ppu_render()) {
+        return;
+    }
+    uint16_t tick = ppu->tick;
+    if (tick != 0 && (tick <= 256 || tick >= 328) && (tick & 7) == 0) {
+        ppu_inc_hori_v(ppu);
+    }
+    if (tick == 256) {
+        ppu_inc_vert_v(ppu);
+    } else if (tick == 257) {
+        // hori(v) = hori(t)
+        ppu->reg_v.coarse_x = ppu->reg_t.coarse_x;
+        ppu->reg_v.nametable_select = (ppu->reg_v.nametable_select & 0b10) | (ppu->reg_t.nametable_select & 0b01);
+    }
+}
 
+/*
+ * Level of the address line A12 at the current dot (see a12_watch).
+ * Each 8-dot fetch slot drives the nametable and attribute addresses during its first half and the pattern
+ * address during its second half, dots 256-319 fetch the sprites of the next scanline and 336-340 nametables.
+ * Outside rendering the bus keeps its last address until PPUADDR/PPUDATA put v on it (see ppu_mapper_sync).
+ */
+static bool ppu_a12_level(DECL_ARG_PPU) {
+    int16_t scanline = ppu->scanline;
+    uint16_t tick = ppu->tick;
+    if (!is_ppu_render() || scanline >= PPU_VISIBLE_SCANLINES) {
+        return ppu->a12;
+    }
+    if ((tick & 7) < 4 || tick >= 336) {
+        return false;
+    }
+    if (tick < 256 || tick >= 320) {
+        return ppu->ctrl.bgr_pattern_table;
+    }
+    if (!ppu->ctrl.sprite_size) {
+        return ppu->ctrl.spr_pattern_table;
+    }
+    // 8x16 sprites select the pattern table with bit 0 of the tile, empty slots fetch tile $FF
+    uint8_t slot = (tick - 256) >> 3;
+    if (scanline >= 0 && slot < ppu->line_sprites[scanline].count) {
+        return ppu->oam[ppu->line_sprites[scanline].index[slot] * 4 + 1] & 1;
+    }
+    return true;
 }
 
 /*
@@ -110,11 +756,23 @@ void ppu_cycle(ppu_t* ppu) {
     if (scanline == -1) {
         // Pre-render
 
+        if (ppu->tick == 0) {
+            ppu->frame_render = ppu->render;
+            ppu->frame_updated = false;
+            if (ppu->deferred != NULL && ppu->frame_render) {
+                ppu_deferred_frame_begin(ppu->deferred);
+            } else if (ppu->nt_cache != NULL && ppu->frame_render) {
+                ppu->nt_cache->pending = true;
+                ppu->nt_cache->lines = 0;
+            }
+        }
+
         // Clear: VBlank, Sprite 0, Overflow
         if (ppu->tick == 1) {
             ppu->status.vblank_started = BIT_FLAG_CLR;
             ppu->status.sprite_0_hit = BIT_FLAG_CLR;
             ppu->status.sprite_overflow = BIT_FLAG_CLR;
+            ppu->spr0_hit_tick = 0;
         }
 
         // vert(v) = vert(t) each tick
@@ -125,17 +783,63 @@ void ppu_cycle(ppu_t* ppu) {
             }
         }
 
+        ppu_scroll_cycle(ppu);
+        if (ppu->tick == 320) {
+            ppu->line_v = ppu->reg_v;
+            ppu->line_x = ppu->reg_x;
+        }
     } else if (scanline >= 0 && scanline <= 239) {
         // [0, 239]
 
-        ppu_render(ppu);
+        if (ppu->tick == 0 && ppu->oam_dirty) {
+            ppu_sprite_eval(ppu);
+        }
+
+        if (ppu->tick == ppu->spr0_hit_tick) {
+            ppu->status.sprite_0_hit = BIT_FLAG_SET;
+            ppu->spr0_hit_tick = 0;
+        }
+
+        if (scanline == ppu->spr_overflow_scanline && ppu->tick == ppu->spr_overflow_tick && is_ppu_render()) {
+            ppu->status.sprite_overflow = BIT_FLAG_SET;
+        }
+
+        // Pixels are not timing-visible, render-less frames skip them
+        if (ppu->tick == 256 && ppu->frame_render) {
+            if (ppu->deferred != NULL) {
+                ppu_deferred_line(ppu->deferred, scanline);
+            } else if (ppu->nt_cache == NULL || !ppu_nt_cache_line(ppu, scanline)) {
+                ppu_render_scanline(ppu, scanline, ppu->frame[scanline], &ppu->frame_emphasis[scanline]);
+            }
+        }
+
+        ppu_scroll_cycle(ppu);
+
+        if (ppu->tick == 257 && scanline < 239) {
+            ppu_spr0_predict(ppu, scanline);
+        } else if (ppu->tick == 320) {
+            ppu->line_v = ppu->reg_v;
+            ppu->line_x = ppu->reg_x;
+        }
     } else if (scanline == 240) {
-        // 240 do nothing
+        // Post-render
+        if (ppu->tick == 0) {
+            if (ppu->deferred != NULL) {
+                // Publishes the previous frame, this one is rendered in the background
+                ppu_deferred_frame_end(ppu->deferred);
+            } else {
+                if (ppu->nt_cache != NULL && ppu->nt_cache->pending) {
+                    ppu_nt_cache_flush(ppu);
+                }
+                ppu->frame_updated = ppu->frame_render;
+            }
+        }
     } else if (scanline <= 260) {
         // vblank scanlines
         // The VBlank flag of the PPU is set at tick 1 (the second tick) of scanline 241, where the VBlank NMI also occurs
         // The PPU makes no memory accesses during these scanlines, so PPU memory can be freely accessed by the program.
         if (scanline == 241 && ppu->tick == 1) {
+            ++ppu->frame_count;
             ppu->status.vblank_started = BIT_FLAG_SET;
             if (ppu->ctrl.nmi_enable) {
                 ppu->cpu->nmi = true;
@@ -143,13 +847,22 @@ void ppu_cycle(ppu_t* ppu) {
         }
     }
 
+    if (ppu->a12_watch) {
+        bool a12 = ppu_a12_level(ppu);
+        if (a12 != ppu->a12) {
+            ppu->a12 = a12;
+            ppu->mapper->func.ppu_a12(ppu->mapper, a12);
+        }
+    }
+    ++ppu->dot_count;
+
     ++ppu->tick;
-    if (ppu->tick >= 341) {
+    if (ppu->tick >= PPU_DOTS_PER_SCANLINE) {
         ppu->tick = 0;
 
         // After 341 ppu cycle, scanline +1
         ++ppu->scanline;
-        if (ppu->scanline >= 261) {
+        if (ppu->scanline >= PPU_SCANLINES - 1) {
             ppu->scanline = -1;
         }
     }
@@ -173,8 +886,18 @@ uint8_t ppu_reg_read(ppu_t* ppu, ppu_reg_t reg) {
         case PPUDATA: { // $2007:
             // VRAM read/write data register.
             // After access, the video memory address will increment by an amount determined by bit 2 of $2000.
-            uint8_t ret = mapper_ppu_read(ppu->mapper, ppu->reg_v.addr);
-            ppu->reg_v.addr += ppu->ctrl.vram_addr_increment ? 32 : 0;
+            addr_t addr = ppu->reg_v.addr & 0x3FFF;
+            uint8_t ret;
+            if (addr >= 0x3F00) {
+                // Palette reads are not buffered, the buffer gets the nametable "underneath"
+                ret = ppu_read(addr);
+                ppu->data_buffer = ppu_read(addr - 0x1000);
+            } else {
+                ret = ppu->data_buffer;
+                ppu->data_buffer = ppu_read(addr);
+            }
+            ppu->reg_v.addr += ppu->ctrl.vram_addr_increment ? 32 : 1;
+            ppu_mapper_sync();
             return ret;
         }
         default:
@@ -186,6 +909,15 @@ uint8_t ppu_reg_read(ppu_t* ppu, ppu_reg_t reg) {
 void ppu_reg_write(ppu_t* ppu, ppu_reg_t reg, uint8_t val) {
     switch (reg) {
         case PPUCTRL: // $2000
+            ppu_mapper_sync();
+            if ((ppu->ctrl.val ^ val) & 0b00111000) {
+                // Recorded scanlines were fetched with the pattern tables and sprite size as they are
+                ppu_nt_cache_write(ppu);
+            }
+            // Sprite size and sprite pattern table feed the sprite evaluation
+            if ((ppu->ctrl.val ^ val) & 0b00101000) {
+                ppu->oam_dirty = true;
+            }
             ppu->ctrl.val = val;
             //    yyy NN YYYYY XXXXX
             // t: ... GH ..... .....  <- d: ......GH
@@ -193,6 +925,7 @@ void ppu_reg_write(ppu_t* ppu, ppu_reg_t reg, uint8_t val) {
             break;
 
         case PPUMASK: // $2001
+            ppu_mapper_sync();
             ppu->mask.val = val;
             break;
 
@@ -201,8 +934,12 @@ void ppu_reg_write(ppu_t* ppu, ppu_reg_t reg, uint8_t val) {
             break;
 
         case OAMDATA: // $2004
+            ppu_log(PPU_LOG_OAM, ppu->oam_addr, val, NULL);
+            ppu_nt_cache_write(ppu);
             ppu->oam[ppu->oam_addr] = val;
             ++ppu->oam_addr;
+            // Evaluated again once the writes are done
+            ppu->oam_dirty = true;
             break;
 
         case PPUSCROLL: // $2005
@@ -250,14 +987,25 @@ void ppu_reg_write(ppu_t* ppu, ppu_reg_t reg, uint8_t val) {
                 ppu->reg_t.addr |= val; // Set 0-7 bit
                 ppu->reg_v.addr = ppu->reg_t.addr;
                 ppu->reg_w = 0;
+                ppu_mapper_sync();
             }
             break;
 
         case PPUDATA: // $2007
             // VRAM read/write data register.
             // After access, the video memory address will increment by an amount determined by bit 2 of $2000.
-            mapper_ppu_write(ppu->mapper, ppu->reg_v.addr, val);
-            ppu->reg_v.addr += ppu->ctrl.vram_addr_increment ? 32 : 0;
+            ppu_log(PPU_LOG_BUS, ppu->reg_v.addr & 0x3FFF, val, NULL);
+            if (ppu->nt_cache != NULL) {
+                ppu_nt_cache_write(ppu);
+                ppu_nt_cache_invalidate(ppu, ppu->reg_v.addr);
+            }
+            ppu_write(ppu->reg_v.addr, val);
+            if ((ppu->reg_v.addr & 0x3FFF) < 0x2000) {
+                // CHR RAM may hold the sprite 0 pattern
+                ppu->oam_dirty = true;
+            }
+            ppu->reg_v.addr += ppu->ctrl.vram_addr_increment ? 32 : 1;
+            ppu_mapper_sync();
             break;
 
         default:
@@ -266,8 +1014,99 @@ void ppu_reg_write(ppu_t* ppu, ppu_reg_t reg, uint8_t val) {
     }
 }
 
-ppu_t* ppu_create(mapper_t* mapper) {
-    ppu_t* ppu = wn_calloc(sizeof(ppu_t));
+void ppu_bus_write(ppu_t* ppu, addr_t addr, uint8_t val) {
+    ppu_write(addr, val);
+}
+
+void ppu_map_chr(ppu_t* ppu, uint8_t page, uint8_t* mem, bool writable) {
+    ppu_log(PPU_LOG_PAGE, page, writable, mem);
+    if (ppu->nt_cache != NULL && ppu->pages[page] != mem) {
+        ppu_nt_cache_write(ppu);
+        // 64 tiles per page
+        memset(&ppu->nt_cache->chr_dirty[page >> 2][(page & 3) * 8], 0xFF, 8);
+    }
+    ppu->pages[page] = mem;
+    if (writable) {
+        ppu->pages_writable |= 1 << page;
+    } else {
+        ppu->pages_writable &= ~(1 << page);
+    }
+}
+
+void ppu_set_mirroring(ppu_t* ppu, mirroring_t mirroring) {
+    // CIRAM 1KB bank of each nametable
+    static const uint8_t NT_BANKS[][4] = {
+            [MIRRORING_HORIZONTAL]  = {0, 0, 1, 1},
+            [MIRRORING_VERTICAL]    = {0, 1, 0, 1},
+            [MIRRORING_SINGLE_LOW]  = {0, 0, 0, 0},
+            [MIRRORING_SINGLE_HIGH] = {1, 1, 1, 1},
+            [MIRRORING_FOUR_SCREEN] = {0, 1, 2, 3},
+    };
+
+    ppu_log(PPU_LOG_MIRRORING, 0, mirroring, NULL);
+    if (ppu->nt_cache != NULL) {
+        ppu_nt_cache_write(ppu);
+        ppu->nt_cache->all_dirty = true;
+    }
+    ppu->mirroring = mirroring;
+    for (uint8_t nt = 0; nt < 4; ++nt) {
+        uint8_t bank = NT_BANKS[mirroring][nt];
+        uint8_t* mem = bank < 2 ? ppu->vram + bank * PPU_PAGE_SIZE : ppu->ext_vram + (bank - 2) * PPU_PAGE_SIZE;
+        ppu->nt_bank[nt] = bank;
+        // $3000-$3EFF mirrors $2000-$2EFF
+        ppu->pages[8 + nt] = mem;
+        ppu->pages[12 + nt] = mem;
+    }
+    ppu->pages_writable |= 0xFF00;
+}
+
+void ppu_decode_attributes(ppu_t* ppu) {
+    for (uint8_t bank = 0; bank < 4; ++bank) {
+        const uint8_t* mem = bank < 2 ? ppu->vram + bank * PPU_PAGE_SIZE : ppu->ext_vram + (bank - 2) * PPU_PAGE_SIZE;
+        for (uint8_t offset = 0; offset < 64; ++offset) {
+            fn_attr_decode(ppu, bank, offset, mem[0x3C0 + offset]);
+        }
+    }
+}
+
+void ppu_set_deferred(ppu_t* ppu, ppu_deferred_t* deferred) {
+    if (ppu->deferred != NULL) {
+        // The frame in flight lands in the frame buffer
+        ppu_deferred_sync(ppu->deferred);
+    }
+    ppu->deferred = deferred;
+}
+
+void ppu_set_nt_cache(ppu_t* ppu, bool enable) {
+    if (enable == (ppu->nt_cache != NULL)) {
+        return;
+    }
+    if (enable) {
+        ppu->nt_cache = wn_calloc(sizeof(ppu_nt_cache_t));
+        ppu->nt_cache->all_dirty = true;
+    } else {
+        ppu_nt_cache_write(ppu);
+        wn_free(ppu->nt_cache);
+        ppu->nt_cache = NULL;
+    }
+}
+
+void ppu_set_render(ppu_t* ppu, bool render) {
+    ppu->render = render;
+}
+
+ppu_t* ppu_create(mapper_t* mapper, wn_arena_t* arena) {
+    ppu_t* ppu = wn_arena_calloc(arena, sizeof(ppu_t));
+    ppu->arena = arena;
     ppu->mapper = mapper;
+    mapper_ppu_attach(mapper, ppu);
+    ppu->oam_dirty = true;
+    ppu->spr_overflow_scanline = -1;
+    ppu->render = true;
     return ppu;
+}
+
+void ppu_destroy(ppu_t* ppu) {
+    wn_free(ppu->nt_cache);
+    wn_arena_free(ppu->arena, ppu);
 }
\ No newline at end of file
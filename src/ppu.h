@@ -11,6 +11,23 @@
 // 2KB Video RAM
 #define PPU_VRAM_SIZE (2*1024)
 
+// The 16KB PPU address space is mapped in 1KB pages
+#define PPU_PAGE_SIZE   0x400
+#define PPU_PAGE_COUNT  16
+
+#define PPU_PALETTE_SIZE 32
+
+#define PPU_VISIBLE_SCANLINES 240
+
+#define PPU_FRAME_WIDTH     256
+#define PPU_FRAME_HEIGHT    PPU_VISIBLE_SCANLINES
+
+// Secondary OAM holds up to 8 sprites per scanline
+#define PPU_SPRITES_PER_LINE 8
+
+#define PPU_DOTS_PER_SCANLINE 341
+#define PPU_SCANLINES         262
+
 /*
  * The PPU exposes eight memory-mapped registers to the CPU.
  *
@@ -99,6 +116,23 @@ typedef struct cpu cpu_t;
 
 typedef struct ppu ppu_t;
 
+typedef struct ppu_deferred ppu_deferred_t;
+
+typedef struct ppu_nt_cache ppu_nt_cache_t;
+
+// 0xRRGGBB color of each palette index
+extern const uint32_t DEFAULT_PALETTES[64];
+
+/*
+ * Result of the sprite evaluation that runs on one scanline (dots 65-256),
+ * i.e. the secondary OAM used to render the following scanline.
+ */
+typedef struct {
+    uint8_t count;
+    // OAM index of each sprite, in OAM order
+    uint8_t index[PPU_SPRITES_PER_LINE];
+} ppu_line_sprites_t;
+
 typedef union {
     struct {
         uint16_t coarse_x: 5;
@@ -115,14 +149,69 @@ struct ppu {
 
     mapper_t* mapper;
 
-    // Video RAM
+    // Video RAM (CIRAM)
     uint8_t vram[PPU_VRAM_SIZE];
 
+    // Extra nametables of four-screen boards
+    uint8_t ext_vram[PPU_VRAM_SIZE];
+
+    uint8_t palette[PPU_PALETTE_SIZE];
+
+    /*
+     * Attribute tables decoded per tile: background palette (attribute bits << 2) of each tile of
+     * the 4 CIRAM banks, indexed [bank][coarse_y][coarse_x]. Kept up to date on every attribute byte
+     * write so a row fetch reads tile and palette from two contiguous arrays.
+     * Rows 30-31 are the attribute bytes themselves, decoded as the hardware would fetch them.
+     */
+    uint8_t nt_palette[4][32][32];
+
+    // CIRAM bank of each nametable, per the mirroring
+    mirroring_t mirroring;
+    uint8_t nt_bank[4];
+
+    /*
+     * PPU address bus, $0000-$3FFF in 1KB pages:
+     *   0-7:   pattern tables, set by the mapper
+     *   8-11:  nametables, CIRAM according to the mirroring
+     *   12-15: mirrors of 8-11, except $3F00-$3FFF which is the palette RAM
+     */
+    uint8_t* pages[PPU_PAGE_COUNT];
+
+    // Bit N set when page N accepts writes (CHR RAM, nametables)
+    uint16_t pages_writable;
+
+    // PPUDATA read buffer
+    uint8_t data_buffer;
+
     // Object Attribute Memory
     uint8_t oam[256];
 
     uint8_t oam_addr;
 
+    //
+    // Sprite evaluation
+    //
+    // Hardware evaluates secondary OAM dot by dot on every visible scanline.
+    // Since OAM barely changes during a frame, all scanlines are evaluated at once
+    // when OAM becomes stable, and overflow/sprite 0 hit are replayed as events.
+    //
+
+    // OAM (or the sprite size/pattern table) changed since the last evaluation
+    bool oam_dirty;
+
+    // Indexed by the evaluating scanline, sprites of line_sprites[N] are displayed on scanline N + 1
+    ppu_line_sprites_t line_sprites[PPU_VISIBLE_SCANLINES];
+
+    // Scanline and dot where the sprite overflow flag gets set, -1 for none
+    int16_t spr_overflow_scanline;
+    uint16_t spr_overflow_tick;
+
+    // Opaque pixels of each sprite 0 row (bit 7 is the leftmost pixel), flips applied
+    uint8_t spr0_rows[16];
+
+    // Dot of the current scanline where sprite 0 hit gets set, 0 for none
+    uint16_t spr0_hit_tick;
+
     //
     // Rendering
     //
@@ -130,6 +219,49 @@ struct ppu {
 
     uint32_t tick;
 
+    // Incremented when a frame is complete (start of vblank)
+    uint32_t frame_count;
+
+    // PPU dots since power on
+    uint64_t dot_count;
+
+    /*
+     * Exact tracking of the address line A12 for mappers clocked by it (MMC3), which otherwise predict
+     * the edges from the rendering configuration. When set, every change of A12 is reported to the mapper.
+     */
+    bool a12_watch;
+    bool a12;
+
+    // Indexed frame buffer, palette indexes $00-$3F
+    uint8_t frame[PPU_FRAME_HEIGHT][PPU_FRAME_WIDTH];
+
+    // Emphasis bits (PPUMASK bits 5-7) each scanline was rendered with
+    uint8_t frame_emphasis[PPU_FRAME_HEIGHT];
+
+    /*
+     * Render-less mode: when false, no pixel is generated and the frame buffer keeps the last rendered frame.
+     * Everything the CPU can observe (vblank, NMI, sprite 0 hit, sprite overflow) is unaffected.
+     * Latched at the start of each frame.
+     */
+    bool render;
+    bool frame_render;
+
+    // The frame buffer received a new frame during the current frame
+    bool frame_updated;
+
+    // Deferred rendering (see ppu_deferred.h), NULL when scanlines are rendered in place
+    ppu_deferred_t* deferred;
+
+    // Pre-rendered nametables (see ppu_set_nt_cache), NULL when disabled
+    ppu_nt_cache_t* nt_cache;
+
+    // Holds the PPU, NULL when it is on the heap
+    wn_arena_t* arena;
+
+    // Scroll position (v and fine X) the next scanline is rendered from
+    inner_reg_t line_v;
+    uint8_t line_x;
+
     //
     // Memory-mapped registers
     //
@@ -139,11 +271,10 @@ struct ppu {
         struct {
             uint8_t nametable_addr: 2;
             uint8_t vram_addr_increment: 1;
-            uint8_t a1: 1;
-            uint8_t a2: 1;
-            uint8_t a3: 1;
+            uint8_t spr_pattern_table: 1;
+            uint8_t bgr_pattern_table: 1;
             uint8_t sprite_size: 1;
-            uint8_t a4: 1;
+            uint8_t master_slave: 1;
             uint8_t nmi_enable: 1;
         };
         uint8_t val;
@@ -202,7 +333,53 @@ uint8_t ppu_reg_read(ppu_t* ppu, ppu_reg_t reg);
 
 void ppu_reg_write(ppu_t* ppu, ppu_reg_t reg, uint8_t val);
 
-ppu_t* ppu_create(mapper_t* mapper);
+/**
+ * Enables or disables pixel generation, from the next frame on
+ */
+void ppu_set_render(ppu_t* ppu, bool render);
+
+/**
+ * Renders visible scanline `scanline` into `line` from the current PPU state:
+ * scroll from line_v/line_x, sprites from line_sprites[scanline - 1], mask, palette and pattern tables as they are
+ */
+void ppu_render_scanline(ppu_t* ppu, int16_t scanline, uint8_t line[PPU_FRAME_WIDTH], uint8_t* emphasis);
+
+/**
+ * Write to the PPU address space, as through PPUDATA
+ */
+void ppu_bus_write(ppu_t* ppu, addr_t addr, uint8_t val);
+
+/**
+ * Switches to deferred rendering, or back to in-place rendering with NULL.
+ * The PPU does not own `deferred`.
+ */
+void ppu_set_deferred(ppu_t* ppu, ppu_deferred_t* deferred);
+
+/**
+ * Produces frames without scroll splits from a pre-rendered bitmap of the four nametables,
+ * falling back to the scanline renderer for the rest of a frame as soon as a split shows up.
+ * Not used together with deferred rendering.
+ */
+void ppu_set_nt_cache(ppu_t* ppu, bool enable);
+
+/**
+ * Maps a 1KB page of the pattern tables ($0000-$1FFF) to `mem`
+ */
+void ppu_map_chr(ppu_t* ppu, uint8_t page, uint8_t* mem, bool writable);
+
+void ppu_set_mirroring(ppu_t* ppu, mirroring_t mirroring);
+
+/**
+ * Decodes the attribute bytes of every CIRAM bank again, after VRAM was written behind the PPU's back
+ */
+void ppu_decode_attributes(ppu_t* ppu);
+
+/**
+ * OAM DMA ($4014), copies a whole CPU page into OAM starting at OAMADDR
+ */
+void ppu_oam_dma(ppu_t* ppu, const uint8_t page[256]);
+
+ppu_t* ppu_create(mapper_t* mapper, wn_arena_t* arena);
 
 void ppu_destroy(ppu_t* ppu);
 
@@ -0,0 +1,292 @@
+//
+// Deferred PPU rendering
+//
+
+#include <string.h>
+
+#include "ppu_deferred.h"
+
+// The frame is rendered in horizontal bands of BAND_ROWS scanlines
+#define BAND_COUNT  8
+#define BAND_ROWS   (PPU_FRAME_HEIGHT / BAND_COUNT)
+
+#define PPU_TIME(scanline, tick) ((uint32_t) ((scanline) + 1) * 341 + (tick))
+
+// Dot where the scanline renderer samples its inputs
+#define RENDER_TICK 256
+
+typedef struct {
+    inner_reg_t v;
+    uint8_t x;
+    uint8_t ctrl;
+    uint8_t mask;
+    // Sprites evaluated on the previous scanline
+    ppu_line_sprites_t sprites;
+} ppu_line_state_t;
+
+typedef struct {
+    // PPU memory at the start of the frame
+    uint8_t vram[PPU_VRAM_SIZE];
+    uint8_t ext_vram[PPU_VRAM_SIZE];
+    uint8_t palette[PPU_PALETTE_SIZE];
+    uint8_t oam[256];
+    uint8_t* pages[PPU_PAGE_COUNT];
+    uint16_t pages_writable;
+    uint8_t nt_palette[4][32][32];
+    uint8_t nt_bank[4];
+    uint8_t* chr_ram;
+
+    // Writes to PPU memory during the frame, in time order
+    ppu_log_entry_t* log;
+    uint32_t log_count;
+    uint32_t log_capacity;
+
+    ppu_line_state_t lines[PPU_FRAME_HEIGHT];
+
+    uint8_t frame[PPU_FRAME_HEIGHT][PPU_FRAME_WIDTH];
+    uint8_t emphasis[PPU_FRAME_HEIGHT];
+} ppu_deferred_frame_t;
+
+typedef struct {
+    // Private PPU the renderer runs on
+    ppu_t* ppu;
+    uint8_t* chr_ram;
+} ppu_deferred_band_t;
+
+struct ppu_deferred {
+    ppu_t* ppu;
+    thread_pool_t* pool;
+
+    // CHR RAM of the cartridge, which the page table may point into
+    uint8_t* chr_ram;
+    uint32_t chr_ram_size;
+
+    // One frame is recorded while the other one is rendered
+    ppu_deferred_frame_t* frames[2];
+    uint8_t recording;
+    bool recording_active;
+
+    // frames[recording ^ 1] is being rendered
+    bool rendering;
+
+    ppu_deferred_band_t bands[BAND_COUNT];
+};
+
+/*
+ * Pointer into the PPU/cartridge memory -> same location in the memory of a band
+ */
+static uint8_t* deferred_translate(ppu_deferred_t* deferred, ppu_deferred_band_t* band, uint8_t* ptr) {
+    ppu_t* ppu = deferred->ppu;
+    if (ptr >= ppu->vram && ptr < ppu->vram + PPU_VRAM_SIZE) {
+        return band->ppu->vram + (ptr - ppu->vram);
+    }
+    if (ptr >= ppu->ext_vram && ptr < ppu->ext_vram + PPU_VRAM_SIZE) {
+        return band->ppu->ext_vram + (ptr - ppu->ext_vram);
+    }
+    if (deferred->chr_ram != NULL && ptr >= deferred->chr_ram && ptr < deferred->chr_ram + deferred->chr_ram_size) {
+        return band->chr_ram + (ptr - deferred->chr_ram);
+    }
+    // CHR ROM, never written
+    return ptr;
+}
+
+static void deferred_replay(ppu_deferred_t* deferred, ppu_deferred_band_t* band, const ppu_log_entry_t* entry) {
+    ppu_t* ppu = band->ppu;
+    switch (entry->type) {
+        case PPU_LOG_BUS:
+            ppu_bus_write(ppu, entry->addr, entry->val);
+            break;
+        case PPU_LOG_OAM:
+            ppu->oam[entry->addr] = entry->val;
+            break;
+        case PPU_LOG_PAGE:
+            ppu->pages[entry->addr] = deferred_translate(deferred, band, entry->page);
+            if (entry->val) {
+                ppu->pages_writable |= 1 << entry->addr;
+            } else {
+                ppu->pages_writable &= ~(1 << entry->addr);
+            }
+            break;
+        case PPU_LOG_MIRRORING:
+            ppu_set_mirroring(ppu, entry->val);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Worker task: renders one band from the snapshot and the log of the frame
+ */
+static void deferred_render_band(void* arg, uint32_t index) {
+    ppu_deferred_t* deferred = arg;
+    ppu_deferred_frame_t* frame = deferred->frames[deferred->recording ^ 1];
+    ppu_deferred_band_t* band = &deferred->bands[index];
+    ppu_t* ppu = band->ppu;
+
+    memcpy(ppu->vram, frame->vram, PPU_VRAM_SIZE);
+    memcpy(ppu->ext_vram, frame->ext_vram, PPU_VRAM_SIZE);
+    memcpy(ppu->palette, frame->palette, PPU_PALETTE_SIZE);
+    memcpy(ppu->oam, frame->oam, sizeof(ppu->oam));
+    if (band->chr_ram != NULL) {
+        memcpy(band->chr_ram, frame->chr_ram, deferred->chr_ram_size);
+    }
+    for (uint8_t page = 0; page < PPU_PAGE_COUNT; ++page) {
+        ppu->pages[page] = deferred_translate(deferred, band, frame->pages[page]);
+    }
+    ppu->pages_writable = frame->pages_writable;
+    memcpy(ppu->nt_palette, frame->nt_palette, sizeof(ppu->nt_palette));
+    memcpy(ppu->nt_bank, frame->nt_bank, sizeof(ppu->nt_bank));
+
+    int16_t first = (int16_t) (index * BAND_ROWS);
+    uint32_t next = 0;
+    for (int16_t y = first; y < first + BAND_ROWS; ++y) {
+        // Writes are visible to a scanline when made before its render dot
+        uint32_t time = PPU_TIME(y, RENDER_TICK);
+        while (next < frame->log_count && frame->log[next].time <= time) {
+            deferred_replay(deferred, band, &frame->log[next++]);
+        }
+
+        const ppu_line_state_t* line = &frame->lines[y];
+        ppu->line_v = line->v;
+        ppu->line_x = line->x;
+        ppu->ctrl.val = line->ctrl;
+        ppu->mask.val = line->mask;
+        if (y > 0) {
+            ppu->line_sprites[y - 1] = line->sprites;
+        }
+        ppu_render_scanline(ppu, y, frame->frame[y], &frame->emphasis[y]);
+    }
+}
+
+ppu_deferred_t* ppu_deferred_create(ppu_t* ppu, thread_pool_t* pool) {
+    ppu_deferred_t* deferred = wn_calloc(sizeof(ppu_deferred_t));
+    deferred->ppu = ppu;
+    deferred->pool = pool;
+
+    cart_t* cart = ppu->mapper->cart;
+    if (cart->chr_ram) {
+        deferred->chr_ram = cart->chr_rom;
+        deferred->chr_ram_size = cart->chr_size;
+    }
+
+    for (uint8_t i = 0; i < 2; ++i) {
+        ppu_deferred_frame_t* frame = wn_calloc(sizeof(ppu_deferred_frame_t));
+        if (deferred->chr_ram != NULL) {
+            frame->chr_ram = wn_calloc(deferred->chr_ram_size);
+        }
+        deferred->frames[i] = frame;
+    }
+    for (uint8_t i = 0; i < BAND_COUNT; ++i) {
+        ppu_deferred_band_t* band = &deferred->bands[i];
+        band->ppu = wn_calloc(sizeof(ppu_t));
+        if (deferred->chr_ram != NULL) {
+            band->chr_ram = wn_calloc(deferred->chr_ram_size);
+        }
+    }
+    return deferred;
+}
+
+void ppu_deferred_frame_begin(ppu_deferred_t* deferred) {
+    ppu_t* ppu = deferred->ppu;
+    ppu_deferred_frame_t* frame = deferred->frames[deferred->recording];
+
+    memcpy(frame->vram, ppu->vram, PPU_VRAM_SIZE);
+    memcpy(frame->ext_vram, ppu->ext_vram, PPU_VRAM_SIZE);
+    memcpy(frame->palette, ppu->palette, PPU_PALETTE_SIZE);
+    memcpy(frame->oam, ppu->oam, sizeof(ppu->oam));
+    memcpy(frame->pages, ppu->pages, sizeof(ppu->pages));
+    frame->pages_writable = ppu->pages_writable;
+    memcpy(frame->nt_palette, ppu->nt_palette, sizeof(ppu->nt_palette));
+    memcpy(frame->nt_bank, ppu->nt_bank, sizeof(ppu->nt_bank));
+    if (deferred->chr_ram != NULL) {
+        memcpy(frame->chr_ram, deferred->chr_ram, deferred->chr_ram_size);
+    }
+
+    frame->log_count = 0;
+    deferred->recording_active = true;
+}
+
+void ppu_deferred_log(ppu_deferred_t* deferred, ppu_log_type_t type, uint16_t addr, uint8_t val, uint8_t* page) {
+    if (!deferred->recording_active) {
+        // Vblank: the writes are part of the next snapshot
+        return;
+    }
+    ppu_t* ppu = deferred->ppu;
+    ppu_deferred_frame_t* frame = deferred->frames[deferred->recording];
+    if (frame->log_count == frame->log_capacity) {
+        uint32_t capacity = frame->log_capacity ? frame->log_capacity * 2 : 256;
+        ppu_log_entry_t* log = wn_malloc(capacity * sizeof(ppu_log_entry_t));
+        if (frame->log_count != 0) {
+            memcpy(log, frame->log, frame->log_count * sizeof(ppu_log_entry_t));
+        }
+        wn_free(frame->log);
+        frame->log = log;
+        frame->log_capacity = capacity;
+    }
+
+    ppu_log_entry_t* entry = &frame->log[frame->log_count++];
+    entry->time = PPU_TIME(ppu->scanline, ppu->tick);
+    entry->type = type;
+    entry->val = val;
+    entry->addr = addr;
+    entry->page = page;
+}
+
+void ppu_deferred_line(ppu_deferred_t* deferred, int16_t scanline) {
+    ppu_t* ppu = deferred->ppu;
+    ppu_line_state_t* line = &deferred->frames[deferred->recording]->lines[scanline];
+    line->v = ppu->line_v;
+    line->x = ppu->line_x;
+    line->ctrl = ppu->ctrl.val;
+    line->mask = ppu->mask.val;
+    if (scanline > 0) {
+        line->sprites = ppu->line_sprites[scanline - 1];
+    }
+}
+
+void ppu_deferred_sync(ppu_deferred_t* deferred) {
+    if (!deferred->rendering) {
+        return;
+    }
+    thread_pool_wait(deferred->pool);
+    deferred->rendering = false;
+
+    ppu_t* ppu = deferred->ppu;
+    ppu_deferred_frame_t* frame = deferred->frames[deferred->recording ^ 1];
+    memcpy(ppu->frame, frame->frame, sizeof(ppu->frame));
+    memcpy(ppu->frame_emphasis, frame->emphasis, sizeof(ppu->frame_emphasis));
+    ppu->frame_updated = true;
+}
+
+void ppu_deferred_frame_end(ppu_deferred_t* deferred) {
+    ppu_deferred_sync(deferred);
+    if (!deferred->recording_active) {
+        // Render-less frame
+        return;
+    }
+    deferred->recording_active = false;
+
+    deferred->recording ^= 1;
+    deferred->rendering = true;
+    thread_pool_submit(deferred->pool, deferred_render_band, deferred, BAND_COUNT);
+}
+
+void ppu_deferred_destroy(ppu_deferred_t* deferred) {
+    if (deferred == NULL) {
+        return;
+    }
+    if (deferred->rendering) {
+        thread_pool_wait(deferred->pool);
+    }
+    for (uint8_t i = 0; i < 2; ++i) {
+        wn_free(deferred->frames[i]->log);
+        wn_free(deferred->frames[i]->chr_ram);
+        wn_free(deferred->frames[i]);
+    }
+    for (uint8_t i = 0; i < BAND_COUNT; ++i) {
+        wn_free(deferred->bands[i].ppu);
+        wn_free(deferred->bands[i].chr_ram);
+    }
+    wn_free(deferred);
+}
@@ -0,0 +1,73 @@
+//
+// Deferred PPU rendering
+//
+
+#ifndef WINES_PPU_DEFERRED_H
+#define WINES_PPU_DEFERRED_H
+
+#include "common.h"
+#include "ppu.h"
+#include "thread_pool.h"
+
+/*
+ * In deferred mode the emulation thread only runs the timing-visible part of the PPU (as in render-less
+ * mode) and records what the renderer needs:
+ *   - a snapshot of PPU memory (CIRAM, palette, OAM, CHR RAM, page table, decoded attributes)
+ *     at the start of the frame,
+ *   - a log of every write to that memory during the frame, with its PPU timestamp,
+ *   - the registers each scanline is rendered with (v, fine X, PPUCTRL, PPUMASK, secondary OAM),
+ *     which is what the scanline renderer samples of the register writes.
+ * When the visible part of the frame is over, horizontal bands of the frame are rendered in parallel
+ * on a worker pool, each band replaying the log over its own copy of the snapshot, while the
+ * emulation thread goes on with the next frame. The frame buffer therefore lags one frame behind.
+ */
+
+typedef enum {
+    PPU_LOG_BUS = 0,    // PPU bus write (nametables, palette, CHR RAM)
+    PPU_LOG_OAM,        // OAM write
+    PPU_LOG_PAGE,       // Pattern table page change (CHR bank switch)
+    PPU_LOG_MIRRORING,  // Nametable mirroring change
+} ppu_log_type_t;
+
+typedef struct {
+    // (scanline + 1) * 341 + dot
+    uint32_t time;
+    uint8_t type;
+    // BUS/OAM: value written, PAGE: writable, MIRRORING: mirroring_t
+    uint8_t val;
+    // BUS: PPU address, OAM: OAM address, PAGE: page index
+    uint16_t addr;
+    // PAGE: new page pointer
+    uint8_t* page;
+} ppu_log_entry_t;
+
+typedef struct ppu_deferred ppu_deferred_t;
+
+ppu_deferred_t* ppu_deferred_create(ppu_t* ppu, thread_pool_t* pool);
+
+/**
+ * Called by the PPU at the start of the pre-render scanline
+ */
+void ppu_deferred_frame_begin(ppu_deferred_t* deferred);
+
+void ppu_deferred_log(ppu_deferred_t* deferred, ppu_log_type_t type, uint16_t addr, uint8_t val, uint8_t* page);
+
+/**
+ * Records the registers scanline `scanline` is rendered with
+ */
+void ppu_deferred_line(ppu_deferred_t* deferred, int16_t scanline);
+
+/**
+ * Called by the PPU when the visible scanlines are over: publishes the previous frame to the PPU
+ * frame buffer and starts rendering this one
+ */
+void ppu_deferred_frame_end(ppu_deferred_t* deferred);
+
+/**
+ * Waits for the frame being rendered and publishes it
+ */
+void ppu_deferred_sync(ppu_deferred_t* deferred);
+
+void ppu_deferred_destroy(ppu_deferred_t* deferred);
+
+#endif //WINES_PPU_DEFERRED_H
@@ -0,0 +1,226 @@
+//
+// Windowed-sinc polyphase resampler
+//
+
+#include <math.h>
+#include <string.h>
+
+#include "resampler.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define RESAMPLER_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RESAMPLER_SSE
+#endif
+
+// Input position, 32.32 fixed point
+#define POS_BITS 32
+
+// Input samples kept between calls besides the filter history
+#define BLOCK_SIZE 1024
+
+typedef struct {
+    uint32_t taps;
+    uint32_t phases;
+    double kaiser_beta;
+} resampler_preset_t;
+
+static const resampler_preset_t PRESETS[RESAMPLER_QUALITY_COUNT] = {
+        [RESAMPLER_FAST]   = {8, 64, 5.0},
+        [RESAMPLER_MEDIUM] = {16, 128, 7.0},
+        [RESAMPLER_HIGH]   = {32, 256, 8.5},
+        [RESAMPLER_BEST]   = {64, 1024, 10.0},
+};
+
+struct resampler {
+    uint32_t taps;
+    uint32_t phase_bits;
+    double base_step;
+    // Input samples per output sample, 32.32
+    uint64_t step;
+    // Position of the next output in `history`, 32.32
+    uint64_t pos;
+
+    // phases x taps, 32-byte aligned rows
+    float* coeffs;
+    void* coeffs_alloc;
+
+    // Input samples not consumed yet, as floats
+    float* history;
+    uint32_t history_count;
+};
+
+/*
+ * Zeroth order modified Bessel function of the first kind, for the Kaiser window
+ */
+static double bessel_i0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 32; ++k) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static void resampler_init_coeffs(resampler_t* r, const resampler_preset_t* preset, double cutoff) {
+    uint32_t taps = preset->taps;
+    double i0_beta = bessel_i0(preset->kaiser_beta);
+    for (uint32_t phase = 0; phase < preset->phases; ++phase) {
+        float* row = r->coeffs + phase * taps;
+        double frac = (double) phase / preset->phases;
+        double sum = 0;
+        for (uint32_t i = 0; i < taps; ++i) {
+            // Distance of tap i to the output position, which lies between taps/2 - 1 and taps/2
+            double x = (double) i - (taps / 2 - 1) - frac;
+            double w = x / (taps / 2.0);
+            double window = fabs(w) >= 1 ? 0 : bessel_i0(preset->kaiser_beta * sqrt(1 - w * w)) / i0_beta;
+            double sinc = x == 0 ? 1 : sin(WN_PI * cutoff * x) / (WN_PI * cutoff * x);
+            row[i] = (float) (sinc * window);
+            sum += row[i];
+        }
+        // Unity gain at DC for every phase
+        for (uint32_t i = 0; i < taps; ++i) {
+            row[i] = (float) (row[i] / sum);
+        }
+    }
+}
+
+resampler_t* resampler_create(double in_rate, double out_rate, resampler_quality_t quality) {
+    const resampler_preset_t* preset = &PRESETS[quality];
+    resampler_t* r = wn_calloc(sizeof(resampler_t));
+    r->taps = preset->taps;
+    r->phase_bits = 0;
+    while ((1u << r->phase_bits) < preset->phases) {
+        ++r->phase_bits;
+    }
+    r->base_step = in_rate / out_rate;
+    resampler_set_ratio(r, 1);
+
+    size_t size = (size_t) preset->phases * preset->taps * sizeof(float);
+    r->coeffs_alloc = wn_malloc(size + 32);
+    r->coeffs = (float*) (((uintptr_t) r->coeffs_alloc + 31) & ~(uintptr_t) 31);
+    // Below the Nyquist frequency of the lower rate
+    double cutoff = (out_rate < in_rate ? out_rate / in_rate : 1.0) * 0.95;
+    resampler_init_coeffs(r, preset, cutoff);
+
+    r->history = wn_calloc((r->taps + BLOCK_SIZE) * sizeof(float));
+    // Starts with the history of silence the first output is centered on
+    r->history_count = r->taps / 2 - 1;
+    return r;
+}
+
+void resampler_set_ratio(resampler_t* resampler, double ratio) {
+    resampler->step = (uint64_t) (resampler->base_step / ratio * (double) ((uint64_t) 1 << POS_BITS));
+}
+
+uint32_t resampler_max_output(const resampler_t* resampler, uint32_t count) {
+    uint64_t input = (uint64_t) (resampler->history_count + count) << POS_BITS;
+    return (uint32_t) (input / resampler->step) + 1;
+}
+
+static float resampler_dot(const float* in, const float* coeffs, uint32_t taps) {
+#if defined(RESAMPLER_AVX)
+    __m256 acc = _mm256_setzero_ps();
+    for (uint32_t i = 0; i < taps; i += 8) {
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(in + i), _mm256_load_ps(coeffs + i)));
+    }
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+#elif defined(RESAMPLER_SSE)
+    __m128 sum = _mm_setzero_ps();
+    for (uint32_t i = 0; i < taps; i += 4) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(in + i), _mm_load_ps(coeffs + i)));
+    }
+#endif
+#if defined(RESAMPLER_AVX) || defined(RESAMPLER_SSE)
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#else
+    float sum = 0;
+    for (uint32_t i = 0; i < taps; ++i) {
+        sum += in[i] * coeffs[i];
+    }
+    return sum;
+#endif
+}
+
+const char* resampler_kernel_name(void) {
+#if defined(RESAMPLER_AVX)
+    return "avx";
+#elif defined(RESAMPLER_SSE)
+    return "sse";
+#else
+    return "scalar";
+#endif
+}
+
+uint32_t resampler_process(resampler_t* r, const int16_t* in, uint32_t count, int16_t* out) {
+    uint32_t produced = 0;
+    uint32_t phase_shift = POS_BITS - r->phase_bits;
+
+    while (count > 0) {
+        // Appends a block of input after the history
+        uint32_t n = count < BLOCK_SIZE ? count : BLOCK_SIZE;
+        for (uint32_t i = 0; i < n; ++i) {
+            r->history[r->history_count + i] = in[i];
+        }
+        r->history_count += n;
+        in += n;
+        count -= n;
+
+        // Outputs whose taps are all available, none until the history holds a full kernel
+        uint64_t end = r->history_count + 1 >= r->taps ? (uint64_t) (r->history_count - r->taps + 1) << POS_BITS : 0;
+        uint64_t pos = r->pos;
+        while (pos < end) {
+            uint32_t index = (uint32_t) (pos >> POS_BITS);
+            const float* coeffs = r->coeffs + ((pos & 0xFFFFFFFFu) >> phase_shift) * r->taps;
+            float s = resampler_dot(r->history + index, coeffs, r->taps);
+            out[produced++] = (int16_t) (s > 32767.0f ? 32767 : s < -32768.0f ? -32768 : lrintf(s));
+            pos += r->step;
+        }
+
+        // Drops the input before the next output
+        uint32_t consumed = (uint32_t) (pos >> POS_BITS);
+        if (consumed > r->history_count) {
+            consumed = r->history_count;
+        }
+        memmove(r->history, r->history + consumed, (r->history_count - consumed) * sizeof(float));
+        r->history_count -= consumed;
+        r->pos = pos - ((uint64_t) consumed << POS_BITS);
+    }
+    return produced;
+}
+
+typedef struct {
+    uint64_t pos;
+    uint32_t history_count;
+} resampler_state_t;
+
+size_t resampler_state_size(const resampler_t* r) {
+    return sizeof(resampler_state_t) + (r->taps + BLOCK_SIZE) * sizeof(float);
+}
+
+size_t resampler_save(const resampler_t* r, void* out) {
+    resampler_state_t state = {r->pos, r->history_count};
+    memcpy(out, &state, sizeof(state));
+    memcpy((uint8_t*) out + sizeof(state), r->history, r->history_count * sizeof(float));
+    return sizeof(state) + r->history_count * sizeof(float);
+}
+
+void resampler_load(resampler_t* r, const void* in) {
+    resampler_state_t state;
+    memcpy(&state, in, sizeof(state));
+    r->pos = state.pos;
+    r->history_count = state.history_count;
+    memcpy(r->history, (const uint8_t*) in + sizeof(state), r->history_count * sizeof(float));
+}
+
+void resampler_destroy(resampler_t* resampler) {
+    if (resampler != NULL) {
+        wn_free(resampler->coeffs_alloc);
+        wn_free(resampler->history);
+        wn_free(resampler);
+    }
+}
@@ -0,0 +1,61 @@
+//
+// Windowed-sinc polyphase resampler
+//
+
+#ifndef WINES_RESAMPLER_H
+#define WINES_RESAMPLER_H
+
+#include "common.h"
+
+typedef enum {
+    RESAMPLER_FAST = 0,     // 8 taps, 64 phases
+    RESAMPLER_MEDIUM,       // 16 taps, 128 phases
+    RESAMPLER_HIGH,         // 32 taps, 256 phases
+    RESAMPLER_BEST,         // 64 taps, 1024 phases
+    RESAMPLER_QUALITY_COUNT,
+} resampler_quality_t;
+
+/*
+ * Each output sample is the dot product of `taps` input samples with the Kaiser-windowed sinc
+ * coefficients of the nearest of `phases` sub-sample positions, precomputed at creation.
+ * The dot products use AVX or SSE when the build enables them.
+ */
+typedef struct resampler resampler_t;
+
+resampler_t* resampler_create(double in_rate, double out_rate, resampler_quality_t quality);
+
+/**
+ * Produces out_rate * ratio samples per second from now on, for dynamic rate control
+ */
+void resampler_set_ratio(resampler_t* resampler, double ratio);
+
+/**
+ * Upper bound of the samples resampler_process produces from `count` input samples
+ */
+uint32_t resampler_max_output(const resampler_t* resampler, uint32_t count);
+
+/**
+ * Consumes all of `in` and writes the samples it completes to `out`, returns their number
+ */
+uint32_t resampler_process(resampler_t* resampler, const int16_t* in, uint32_t count, int16_t* out);
+
+/**
+ * Name of the dot product kernel in use
+ */
+const char* resampler_kernel_name(void);
+
+/**
+ * Largest size of the state saved by resampler_save
+ */
+size_t resampler_state_size(const resampler_t* resampler);
+
+/**
+ * Saves the input history and the position in it, returns the size written
+ */
+size_t resampler_save(const resampler_t* resampler, void* out);
+
+void resampler_load(resampler_t* resampler, const void* in);
+
+void resampler_destroy(resampler_t* resampler);
+
+#endif //WINES_RESAMPLER_H
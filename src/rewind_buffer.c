@@ -0,0 +1,232 @@
+//
+// Rewind: the last frames of a console as compressed deltas between save states
+//
+
+#include <string.h>
+
+#include "rewind_buffer.h"
+#include "state.h"
+
+// Unchanged bytes needed to end a literal run, shorter gaps cost more in run headers than in literals
+#define REWIND_MIN_GAP 4
+
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+} rewind_entry_t;
+
+struct rewind_buffer {
+    wines_t* nes;
+    size_t state_size;
+    // Newest state, valid once a frame was pushed
+    uint8_t* current;
+    bool has_current;
+    // State being pushed, and its delta before it is copied into the ring
+    uint8_t* next;
+    uint8_t* delta;
+
+    uint8_t* ring;
+    size_t capacity;
+    // Where the next delta goes
+    size_t pos;
+    size_t used;
+
+    // Deltas from the oldest to the newest, circular
+    rewind_entry_t* entries;
+    uint32_t max_frames;
+    uint32_t first;
+    uint32_t count;
+};
+
+rewind_buffer_t* rewind_buffer_create(wines_t* nes, uint32_t frames, size_t capacity) {
+    rewind_buffer_t* rewind = wn_calloc(sizeof(rewind_buffer_t));
+    rewind->nes = nes;
+    rewind->state_size = wn_state_size(nes);
+    rewind->current = wn_malloc(rewind->state_size);
+    rewind->next = wn_malloc(rewind->state_size);
+    // Run headers take no more room than the unchanged bytes they skip, but for the first one
+    rewind->delta = wn_malloc(rewind->state_size + 16);
+    rewind->ring = wn_malloc(capacity);
+    rewind->capacity = capacity;
+    rewind->entries = wn_malloc(sizeof(rewind_entry_t) * (frames > 0 ? frames : 1));
+    rewind->max_frames = frames > 0 ? frames : 1;
+    return rewind;
+}
+
+#pragma mark - Delta coding
+
+FORCE_INLINE static uint8_t* rewind_write_varint(uint8_t* out, size_t val) {
+    while (val >= 0x80) {
+        *out++ = (uint8_t) (val | 0x80);
+        val >>= 7;
+    }
+    *out++ = (uint8_t) val;
+    return out;
+}
+
+FORCE_INLINE static size_t rewind_read_varint(const uint8_t** in) {
+    size_t val = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = *(*in)++;
+        val |= (size_t) (byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return val;
+}
+
+/**
+ * Encodes prev ^ cur as (unchanged count, literal count, literals) runs, returns the size of the delta
+ */
+static size_t rewind_encode(const uint8_t* prev, const uint8_t* cur, size_t size, uint8_t* out) {
+    uint8_t* begin = out;
+    size_t i = 0;
+    while (i < size) {
+        size_t start = i;
+        // Unchanged bytes, 8 at a time in the large untouched areas
+        while (i + 8 <= size) {
+            uint64_t a, b;
+            memcpy(&a, prev + i, 8);
+            memcpy(&b, cur + i, 8);
+            if (a != b) {
+                break;
+            }
+            i += 8;
+        }
+        while (i < size && prev[i] == cur[i]) {
+            ++i;
+        }
+        size_t gap = i - start;
+        if (i == size) {
+            break;
+        }
+
+        start = i;
+        size_t same = 0;
+        while (i < size && same < REWIND_MIN_GAP) {
+            same = prev[i] == cur[i] ? same + 1 : 0;
+            ++i;
+        }
+        if (same == REWIND_MIN_GAP) {
+            i -= same;
+        }
+
+        out = rewind_write_varint(out, gap);
+        out = rewind_write_varint(out, i - start);
+        for (size_t k = start; k < i; ++k) {
+            *out++ = prev[k] ^ cur[k];
+        }
+    }
+    return out - begin;
+}
+
+/**
+ * XORs a delta into `state`, turning one end of the delta into the other
+ */
+static void rewind_apply(uint8_t* state, const uint8_t* delta, size_t size) {
+    const uint8_t* end = delta + size;
+    uint8_t* pos = state;
+    while (delta < end) {
+        pos += rewind_read_varint(&delta);
+        size_t literal = rewind_read_varint(&delta);
+        for (size_t k = 0; k < literal; ++k) {
+            *pos++ ^= *delta++;
+        }
+    }
+}
+
+#pragma mark - Ring
+
+FORCE_INLINE static rewind_entry_t* rewind_oldest(rewind_buffer_t* rewind) {
+    return &rewind->entries[rewind->first];
+}
+
+FORCE_INLINE static void rewind_drop_oldest(rewind_buffer_t* rewind) {
+    rewind->used -= rewind_oldest(rewind)->size;
+    rewind->first = (rewind->first + 1) % rewind->max_frames;
+    rewind->count--;
+}
+
+/*
+ * Deltas are laid out in push order from `pos` around the ring, so the ones a new delta would overwrite
+ * are always the oldest. A delta never wraps: when it does not fit before the end of the ring, the deltas
+ * after `pos` are dropped with the unused end and it goes to the start.
+ */
+static void rewind_store(rewind_buffer_t* rewind, const uint8_t* delta, size_t size) {
+    if (size > rewind->capacity) {
+        // The history cannot go back past this frame
+        rewind->first = rewind->count = 0;
+        rewind->pos = rewind->used = 0;
+        return;
+    }
+    if (rewind->count == rewind->max_frames) {
+        rewind_drop_oldest(rewind);
+    }
+    if (rewind->pos + size > rewind->capacity) {
+        while (rewind->count > 0 && rewind_oldest(rewind)->offset >= rewind->pos) {
+            rewind_drop_oldest(rewind);
+        }
+        rewind->pos = 0;
+    }
+    while (rewind->count > 0 && rewind_oldest(rewind)->offset >= rewind->pos
+           && rewind_oldest(rewind)->offset < rewind->pos + size) {
+        rewind_drop_oldest(rewind);
+    }
+
+    memcpy(rewind->ring + rewind->pos, delta, size);
+    rewind_entry_t* entry = &rewind->entries[(rewind->first + rewind->count) % rewind->max_frames];
+    entry->offset = (uint32_t) rewind->pos;
+    entry->size = (uint32_t) size;
+    rewind->count++;
+    rewind->pos += size;
+    rewind->used += size;
+}
+
+void rewind_buffer_push(rewind_buffer_t* rewind) {
+    if (!rewind->has_current) {
+        wn_state_save(rewind->nes, rewind->current, rewind->state_size);
+        rewind->has_current = true;
+        return;
+    }
+    wn_state_save(rewind->nes, rewind->next, rewind->state_size);
+    size_t size = rewind_encode(rewind->current, rewind->next, rewind->state_size, rewind->delta);
+    rewind_store(rewind, rewind->delta, size);
+
+    uint8_t* current = rewind->current;
+    rewind->current = rewind->next;
+    rewind->next = current;
+}
+
+bool rewind_buffer_back(rewind_buffer_t* rewind) {
+    if (rewind->count == 0) {
+        return false;
+    }
+    const rewind_entry_t* newest = &rewind->entries[(rewind->first + rewind->count - 1) % rewind->max_frames];
+    rewind_apply(rewind->current, rewind->ring + newest->offset, newest->size);
+    // The space of the newest delta is reused by the next push
+    rewind->pos = newest->offset;
+    rewind->used -= newest->size;
+    rewind->count--;
+    wn_state_load(rewind->nes, rewind->current, rewind->state_size);
+    return true;
+}
+
+uint32_t rewind_buffer_frames(const rewind_buffer_t* rewind) {
+    return rewind->count;
+}
+
+size_t rewind_buffer_used(const rewind_buffer_t* rewind) {
+    return rewind->used;
+}
+
+void rewind_buffer_destroy(rewind_buffer_t* rewind) {
+    if (rewind != NULL) {
+        wn_free(rewind->current);
+        wn_free(rewind->next);
+        wn_free(rewind->delta);
+        wn_free(rewind->ring);
+        wn_free(rewind->entries);
+        wn_free(rewind);
+    }
+}
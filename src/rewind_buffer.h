@@ -0,0 +1,52 @@
+//
+// Rewind: the last frames of a console as compressed deltas between save states
+//
+
+#ifndef WINES_REWIND_BUFFER_H
+#define WINES_REWIND_BUFFER_H
+
+#include "common.h"
+
+typedef struct wines wines_t;
+
+// Ring size per second of rewind, most frames take a few hundred bytes
+#define REWIND_BUFFER_BYTES_PER_SECOND (96 * 1024)
+
+/*
+ * Only the newest state is kept whole. Every frame pushed is XORed with it, so the bytes that did not
+ * change become zero, and the delta is stored as runs of unchanged bytes and XORed literals in a fixed-size
+ * ring. Stepping back XORs the newest delta into the newest state, which gives the state of the frame before,
+ * so going back N frames decodes N deltas whatever the length of the history. When the ring is full, or
+ * holds the maximum number of frames, the oldest deltas are dropped.
+ */
+typedef struct rewind_buffer rewind_buffer_t;
+
+/**
+ * Keeps up to `frames` frames of history in `capacity` bytes
+ */
+rewind_buffer_t* rewind_buffer_create(wines_t* nes, uint32_t frames, size_t capacity);
+
+/**
+ * Records the current state of the console, called once per frame
+ */
+void rewind_buffer_push(rewind_buffer_t* rewind);
+
+/**
+ * Restores the console to the frame pushed before the newest one, which becomes the newest.
+ * Returns false, leaving the console as it is, when there is no older frame.
+ */
+bool rewind_buffer_back(rewind_buffer_t* rewind);
+
+/**
+ * Frames rewind_buffer_back can go back
+ */
+uint32_t rewind_buffer_frames(const rewind_buffer_t* rewind);
+
+/**
+ * Bytes of the ring taken by the deltas
+ */
+size_t rewind_buffer_used(const rewind_buffer_t* rewind);
+
+void rewind_buffer_destroy(rewind_buffer_t* rewind);
+
+#endif //WINES_REWIND_BUFFER_H
@@ -0,0 +1,384 @@
+//
+// Persistent index of a ROM library: headers and content hashes, keyed by path, mtime and size
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "rom_index.h"
+#include "platform.h"
+#include "thread_pool.h"
+
+_Static_assert(sizeof(rom_index_entry_t) == 64, "rom_index_entry_t is 64 bytes");
+
+#define ROM_INDEX_MAGIC     "WNRI"
+#define ROM_INDEX_VERSION   1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t strings_size;
+} rom_index_file_t;
+
+struct rom_index {
+    char* filename;
+    // Previous index, entries and strings point into it until a scan replaces them
+    wn_mmap_t* map;
+    const rom_index_entry_t* entries;
+    const char* strings;
+    uint32_t count;
+    // Storage of a scanned index
+    rom_index_entry_t* scanned_entries;
+    char* scanned_strings;
+    uint32_t strings_size;
+};
+
+#pragma mark - Hashes
+
+static uint32_t CRC32_TABLE[256];
+
+static void crc32_init(void) {
+    if (CRC32_TABLE[1] != 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        CRC32_TABLE[i] = c;
+    }
+}
+
+static uint32_t crc32(const uint8_t* data, size_t size) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; ++i) {
+        crc = CRC32_TABLE[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_block(uint32_t h[5], const uint8_t block[64]) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t) block[i * 4] << 24 | (uint32_t) block[i * 4 + 1] << 16
+               | (uint32_t) block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; ++i) {
+        w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; ++i) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = ROL32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROL32(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+static void sha1(const uint8_t* data, size_t size, uint8_t out[20]) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        sha1_block(h, data + i);
+    }
+    // Padding: 0x80, zeros, then the bit length big-endian
+    uint8_t tail[128] = {0};
+    size_t rest = size - i;
+    memcpy(tail, data + i, rest);
+    tail[rest] = 0x80;
+    size_t tail_size = rest < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t) size * 8;
+    for (int k = 0; k < 8; ++k) {
+        tail[tail_size - 1 - k] = (uint8_t) (bits >> (k * 8));
+    }
+    for (size_t k = 0; k < tail_size; k += 64) {
+        sha1_block(h, tail + k);
+    }
+    for (int k = 0; k < 5; ++k) {
+        out[k * 4] = h[k] >> 24;
+        out[k * 4 + 1] = h[k] >> 16;
+        out[k * 4 + 2] = h[k] >> 8;
+        out[k * 4 + 3] = h[k];
+    }
+}
+
+#pragma mark - Scan
+
+typedef struct {
+    rom_index_entry_t* entries;
+    char** paths;
+    // Entries to hash
+    uint32_t* jobs;
+} rom_index_scan_t;
+
+/**
+ * Parses the header and hashes the PRG + CHR payload of one file
+ */
+static void rom_index_hash_task(void* arg, uint32_t index) {
+    rom_index_scan_t* scan = arg;
+    uint32_t i = scan->jobs[index];
+    rom_index_entry_t* entry = &scan->entries[i];
+
+    wn_mmap_t* map = wn_mmap_file(scan->paths[i], WN_MMAP_READ, 0);
+    if (map == NULL) {
+        return;
+    }
+    if (map->size >= sizeof(nes_header_t) && memcmp(map->data, "NES\x1A", 4) == 0) {
+        memcpy(&entry->header, map->data, sizeof(nes_header_t));
+        size_t offset = sizeof(nes_header_t) + (entry->header.flags6.trainer ? 512 : 0);
+        size_t payload = entry->header.pgr_blocks * 0x4000 + entry->header.chr_blocks * 0x2000;
+        if (payload > 0 && offset + payload <= map->size) {
+            entry->crc32 = crc32(map->data + offset, payload);
+            sha1(map->data + offset, payload, entry->sha1);
+            entry->flags |= ROM_INDEX_VALID;
+        }
+    }
+    wn_mmap_close(map);
+}
+
+typedef struct {
+    const char* dirname;
+    char** paths;
+    uint32_t count;
+    uint32_t capacity;
+} rom_index_list_t;
+
+static void rom_index_list_file(void* userdata, const char* name) {
+    rom_index_list_t* list = userdata;
+    size_t len = strlen(name);
+    if (len < 4 || name[len - 4] != '.' || tolower(name[len - 3]) != 'n' || tolower(name[len - 2]) != 'e'
+        || tolower(name[len - 1]) != 's') {
+        return;
+    }
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        char** paths = wn_malloc(list->capacity * sizeof(char*));
+        memcpy(paths, list->paths, list->count * sizeof(char*));
+        wn_free(list->paths);
+        list->paths = paths;
+    }
+    size_t dir_len = strlen(list->dirname);
+    char* path = wn_malloc(dir_len + len + 2);
+    memcpy(path, list->dirname, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, len + 1);
+    list->paths[list->count++] = path;
+}
+
+static int rom_index_compare_paths(const void* a, const void* b) {
+    return strcmp(*(const char* const*) a, *(const char* const*) b);
+}
+
+static void rom_index_release(rom_index_t* index) {
+    wn_mmap_close(index->map);
+    wn_free(index->scanned_entries);
+    wn_free(index->scanned_strings);
+    index->map = NULL;
+    index->scanned_entries = NULL;
+    index->scanned_strings = NULL;
+    index->entries = NULL;
+    index->strings = NULL;
+    index->count = 0;
+    index->strings_size = 0;
+}
+
+int32_t rom_index_scan(rom_index_t* index, const char* dirname, thread_pool_t* pool) {
+    rom_index_list_t list = {.dirname = dirname};
+    if (!wn_list_dir(dirname, rom_index_list_file, &list)) {
+        return -1;
+    }
+    qsort(list.paths, list.count, sizeof(char*), rom_index_compare_paths);
+
+    rom_index_entry_t* entries = wn_calloc((list.count ? list.count : 1) * sizeof(rom_index_entry_t));
+    uint32_t* jobs = wn_malloc((list.count ? list.count : 1) * sizeof(uint32_t));
+    uint32_t count = 0;
+    uint32_t job_count = 0;
+    uint32_t strings_size = 0;
+    for (uint32_t i = 0; i < list.count; ++i) {
+        uint64_t mtime, size;
+        if (!file_stat(list.paths[i], &mtime, &size)) {
+            wn_free(list.paths[i]);
+            continue;
+        }
+        list.paths[count] = list.paths[i];
+        rom_index_entry_t* entry = &entries[count];
+        const rom_index_entry_t* old = rom_index_find(index, list.paths[i]);
+        if (old != NULL && old->mtime == mtime && old->size == size) {
+            *entry = *old;
+        } else {
+            entry->mtime = mtime;
+            entry->size = size;
+            jobs[job_count++] = count;
+        }
+        entry->path_offset = strings_size;
+        entry->path_length = (uint16_t) strlen(list.paths[i]);
+        strings_size += entry->path_length + 1;
+        ++count;
+    }
+
+    crc32_init();
+    rom_index_scan_t scan = {.entries = entries, .paths = list.paths, .jobs = jobs};
+    if (job_count > 0) {
+        if (pool != NULL) {
+            thread_pool_run(pool, rom_index_hash_task, &scan, job_count);
+        } else {
+            for (uint32_t i = 0; i < job_count; ++i) {
+                rom_index_hash_task(&scan, i);
+            }
+        }
+    }
+
+    char* strings = wn_malloc(strings_size ? strings_size : 1);
+    for (uint32_t i = 0; i < count; ++i) {
+        memcpy(strings + entries[i].path_offset, list.paths[i], entries[i].path_length + 1);
+        wn_free(list.paths[i]);
+    }
+    wn_free(list.paths);
+    wn_free(jobs);
+
+    rom_index_release(index);
+    index->scanned_entries = entries;
+    index->scanned_strings = strings;
+    index->entries = entries;
+    index->strings = strings;
+    index->count = count;
+    index->strings_size = strings_size;
+    return (int32_t) job_count;
+}
+
+#pragma mark - Index file
+
+rom_index_t* rom_index_open(const char* index_filename) {
+    rom_index_t* index = wn_calloc(sizeof(rom_index_t));
+    size_t len = strlen(index_filename);
+    index->filename = wn_malloc(len + 1);
+    memcpy(index->filename, index_filename, len + 1);
+
+    wn_mmap_t* map = wn_mmap_file(index_filename, WN_MMAP_READ, 0);
+    if (map == NULL) {
+        return index;
+    }
+    const rom_index_file_t* file = (const rom_index_file_t*) map->data;
+    if (map->size < sizeof(rom_index_file_t) || memcmp(file->magic, ROM_INDEX_MAGIC, 4) != 0
+        || file->version != ROM_INDEX_VERSION
+        || (uint64_t) file->count * sizeof(rom_index_entry_t) + file->strings_size
+           != map->size - sizeof(rom_index_file_t)) {
+        wn_mmap_close(map);
+        return index;
+    }
+    index->map = map;
+    index->entries = (const rom_index_entry_t*) (map->data + sizeof(rom_index_file_t));
+    index->strings = (const char*) (index->entries + file->count);
+    index->count = file->count;
+    index->strings_size = file->strings_size;
+    // Every path must be terminated inside the string table
+    for (uint32_t i = 0; i < index->count; ++i) {
+        const rom_index_entry_t* entry = &index->entries[i];
+        if ((uint64_t) entry->path_offset + entry->path_length >= index->strings_size
+            || index->strings[entry->path_offset + entry->path_length] != '\0') {
+            rom_index_release(index);
+            break;
+        }
+    }
+    return index;
+}
+
+err_t rom_index_save(rom_index_t* index) {
+    if (index->scanned_entries == NULL) {
+        // Unchanged since it was mapped
+        return ERR_OK;
+    }
+
+    size_t len = strlen(index->filename);
+    char* tmp_filename = wn_malloc(len + 5);
+    memcpy(tmp_filename, index->filename, len);
+    memcpy(tmp_filename + len, ".tmp", 5);
+
+    wn_file_t* file = open_file(tmp_filename, "wb");
+    if (file == NULL) {
+        wn_free(tmp_filename);
+        return ERR_FILE_NOT_EXISTS;
+    }
+    rom_index_file_t header = {.version = ROM_INDEX_VERSION, .count = index->count,
+                               .strings_size = index->strings_size};
+    memcpy(header.magic, ROM_INDEX_MAGIC, 4);
+    size_t entries_size = index->count * sizeof(rom_index_entry_t);
+    bool ok = file->write(file, &header, sizeof(header)) == sizeof(header)
+              && file->write(file, index->entries, entries_size) == entries_size
+              && file->write(file, index->strings, index->strings_size) == index->strings_size;
+    file->close(file);
+
+    // Replaced in one step, a reader never sees a partial index
+    if (ok) {
+        ok = file_replace(tmp_filename, index->filename);
+    }
+    if (!ok) {
+        remove(tmp_filename);
+    }
+    wn_free(tmp_filename);
+    return ok ? ERR_OK : ERR_FILE_NOT_EXISTS;
+}
+
+uint32_t rom_index_count(const rom_index_t* index) {
+    return index->count;
+}
+
+const rom_index_entry_t* rom_index_entry(const rom_index_t* index, uint32_t i) {
+    return &index->entries[i];
+}
+
+const char* rom_index_path(const rom_index_t* index, const rom_index_entry_t* entry) {
+    return index->strings + entry->path_offset;
+}
+
+const rom_index_entry_t* rom_index_find(const rom_index_t* index, const char* path) {
+    uint32_t lo = 0;
+    uint32_t hi = index->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        int cmp = strcmp(path, index->strings + index->entries[mid].path_offset);
+        if (cmp == 0) {
+            return &index->entries[mid];
+        } else if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+void rom_index_close(rom_index_t* index) {
+    if (index != NULL) {
+        rom_index_release(index);
+        wn_free(index->filename);
+        wn_free(index);
+    }
+}
@@ -0,0 +1,63 @@
+//
+// Persistent index of a ROM library: headers and content hashes, keyed by path, mtime and size
+//
+
+#ifndef WINES_ROM_INDEX_H
+#define WINES_ROM_INDEX_H
+
+#include "common.h"
+#include "cartridge.h"
+
+typedef struct thread_pool thread_pool_t;
+
+#define ROM_INDEX_VALID     (1 << 0)    // The file parsed as an iNES/NES 2.0 ROM, the hashes are set
+
+/*
+ * On-disk entry. The index file is a small header, the entries sorted by path, then the paths,
+ * so it is used straight from its mapping without being parsed.
+ */
+typedef struct rom_index_entry {
+    uint32_t path_offset;
+    uint16_t path_length;
+    uint16_t flags;
+    uint64_t mtime;
+    uint64_t size;
+    // Of the PRG + CHR ROM payload, which matches the hashes of ROM databases
+    uint32_t crc32;
+    uint8_t sha1[20];
+    nes_header_t header;
+} rom_index_entry_t;
+
+typedef struct rom_index rom_index_t;
+
+/**
+ * Maps the index saved at `index_filename` if there is a valid one, the index is empty otherwise
+ */
+rom_index_t* rom_index_open(const char* index_filename);
+
+/**
+ * Indexes the .nes files of a directory. Entries whose path, mtime and size match the previous index are
+ * reused, the other files are parsed and hashed on the pool.
+ * Returns the number of files that were hashed, or -1 if the directory cannot be read.
+ */
+int32_t rom_index_scan(rom_index_t* index, const char* dirname, thread_pool_t* pool);
+
+/**
+ * Writes the index back to the file it was opened from
+ */
+err_t rom_index_save(rom_index_t* index);
+
+uint32_t rom_index_count(const rom_index_t* index);
+
+const rom_index_entry_t* rom_index_entry(const rom_index_t* index, uint32_t i);
+
+const char* rom_index_path(const rom_index_t* index, const rom_index_entry_t* entry);
+
+/**
+ * Binary search by path, NULL if not indexed
+ */
+const rom_index_entry_t* rom_index_find(const rom_index_t* index, const char* path);
+
+void rom_index_close(rom_index_t* index);
+
+#endif //WINES_ROM_INDEX_H
@@ -0,0 +1,176 @@
+//
+// Run-ahead: presents the frame a few frames after the emulated one, hiding the game's own input lag
+//
+
+#include <string.h>
+
+#include "run_ahead.h"
+#include "platform.h"
+#include "state.h"
+#include "wines.h"
+
+struct run_ahead {
+    wines_t* nes;
+    // Second console, NULL with one instance
+    wines_t* ahead;
+    uint8_t frames;
+
+    uint8_t* state;
+    size_t state_size;
+    // Sound output of the emulated timeline, with one instance
+    uint8_t* synth;
+    size_t synth_size;
+
+    int16_t* samples;
+    uint32_t sample_count;
+
+    run_ahead_stats_t stats;
+};
+
+/**
+ * Gives the second console the codes of the first one
+ */
+static void run_ahead_copy_cheats(const wines_t* nes, wines_t* ahead) {
+    const cheats_t* cheats = nes->mapper->cheats;
+    if (cheats == NULL) {
+        return;
+    }
+    cheats_t* copy = cheats_create(ahead->mapper);
+    for (uint32_t i = 0; i < cheats->count; ++i) {
+        copy->list[copy->count++] = cheats->list[i];
+        // Patches the slot of the code
+        cheats_set_enabled(copy, i, cheats->list[i].enabled);
+    }
+}
+
+run_ahead_t* run_ahead_create(wines_t* nes, uint8_t frames, bool second_instance) {
+    wines_t* ahead = NULL;
+    if (second_instance && wines_create_shared(nes->cart->image, &ahead) != ERR_OK) {
+        return NULL;
+    }
+    wines_set_deferred(nes, false);
+
+    run_ahead_t* run_ahead = wn_calloc(sizeof(run_ahead_t));
+    run_ahead->nes = nes;
+    run_ahead->ahead = ahead;
+    run_ahead->frames = frames > 0 ? frames : 1;
+    run_ahead->state_size = wn_state_size(nes);
+    run_ahead->state = wn_malloc(run_ahead->state_size);
+    run_ahead->samples = wn_malloc(RUN_AHEAD_SAMPLE_BUFFER * sizeof(int16_t));
+    if (ahead != NULL) {
+        ppu_set_nt_cache(ahead->ppu, nes->ppu->nt_cache != NULL);
+        run_ahead_copy_cheats(nes, ahead);
+    }
+    return run_ahead;
+}
+
+/**
+ * Moves the samples of the frame just emulated out of the APU, before the frames ahead add theirs
+ */
+static void run_ahead_keep_samples(run_ahead_t* run_ahead) {
+    apu_t* apu = run_ahead->nes->apu;
+    uint32_t avail = apu_samples_avail(apu);
+    if (avail > RUN_AHEAD_SAMPLE_BUFFER) {
+        apu_read_samples(apu, NULL, avail - RUN_AHEAD_SAMPLE_BUFFER);
+        avail = RUN_AHEAD_SAMPLE_BUFFER;
+    }
+    if (run_ahead->sample_count + avail > RUN_AHEAD_SAMPLE_BUFFER) {
+        // Not read in time, only the latest are kept
+        uint32_t drop = run_ahead->sample_count + avail - RUN_AHEAD_SAMPLE_BUFFER;
+        run_ahead->sample_count -= drop;
+        memmove(run_ahead->samples, run_ahead->samples + drop, run_ahead->sample_count * sizeof(int16_t));
+    }
+    run_ahead->sample_count += apu_read_samples(apu, run_ahead->samples + run_ahead->sample_count, avail);
+}
+
+/**
+ * Saves the sound output the save state leaves out, the buffer follows the output settings
+ */
+static void run_ahead_save_synth(run_ahead_t* run_ahead) {
+    apu_t* apu = run_ahead->nes->apu;
+    size_t size = apu_synth_size(apu);
+    if (size > run_ahead->synth_size) {
+        wn_free(run_ahead->synth);
+        run_ahead->synth = wn_malloc(size);
+        run_ahead->synth_size = size;
+    }
+    apu_save_synth(apu, run_ahead->synth);
+}
+
+/**
+ * Runs the frames ahead on `console`, the last one rendered and passed to the frame hook
+ */
+static void run_ahead_step(run_ahead_t* run_ahead, wines_t* console, frame_hook_t hook, void* hook_data) {
+    for (uint8_t i = 0; i < run_ahead->frames; ++i) {
+        bool last = i == run_ahead->frames - 1;
+        ppu_set_render(console->ppu, last);
+        wines_set_frame_hook(console, last ? hook : NULL, hook_data);
+        wines_step_frame(console);
+    }
+    wines_set_frame_hook(console, NULL, NULL);
+    apu_read_samples(console->apu, NULL, apu_samples_avail(console->apu));
+}
+
+void run_ahead_frame(run_ahead_t* run_ahead) {
+    wines_t* nes = run_ahead->nes;
+    frame_hook_t hook = nes->frame_hook;
+    void* hook_data = nes->frame_hook_data;
+
+    uint64_t begin = wn_time_ns();
+    nes->frame_hook = NULL;
+    ppu_set_render(nes->ppu, false);
+    wines_step_frame(nes);
+    run_ahead_keep_samples(run_ahead);
+    uint64_t ahead_begin = wn_time_ns();
+
+    wn_state_save(nes, run_ahead->state, run_ahead->state_size);
+    if (run_ahead->ahead != NULL) {
+        wn_state_load(run_ahead->ahead, run_ahead->state, run_ahead->state_size);
+        run_ahead_step(run_ahead, run_ahead->ahead, hook, hook_data);
+    } else {
+        run_ahead_save_synth(run_ahead);
+        run_ahead_step(run_ahead, nes, hook, hook_data);
+        wn_state_load(nes, run_ahead->state, run_ahead->state_size);
+        // The sound continues from the emulated frame, not from the levels of the frames ahead
+        apu_load_synth(nes->apu, run_ahead->synth);
+    }
+    wines_set_frame_hook(nes, hook, hook_data);
+    // Only the PRG RAM of the emulated timeline reaches the .sav file
+    wines_sync_sav(nes);
+
+    uint64_t end = wn_time_ns();
+    run_ahead->stats.frames++;
+    run_ahead->stats.frame_ns += ahead_begin - begin;
+    run_ahead->stats.ahead_ns += end - ahead_begin;
+}
+
+uint32_t run_ahead_read_samples(run_ahead_t* run_ahead, int16_t* out, uint32_t count) {
+    if (count > run_ahead->sample_count) {
+        count = run_ahead->sample_count;
+    }
+    if (out != NULL) {
+        memcpy(out, run_ahead->samples, count * sizeof(int16_t));
+    }
+    run_ahead->sample_count -= count;
+    memmove(run_ahead->samples, run_ahead->samples + count, run_ahead->sample_count * sizeof(int16_t));
+    return count;
+}
+
+void run_ahead_stats(const run_ahead_t* run_ahead, run_ahead_stats_t* out) {
+    *out = run_ahead->stats;
+}
+
+double run_ahead_frame_cost_ns(const run_ahead_t* run_ahead) {
+    uint64_t frames = run_ahead->stats.frames * run_ahead->frames;
+    return frames > 0 ? (double) run_ahead->stats.ahead_ns / (double) frames : 0;
+}
+
+void run_ahead_destroy(run_ahead_t* run_ahead) {
+    if (run_ahead != NULL) {
+        wines_destroy(run_ahead->ahead);
+        wn_free(run_ahead->state);
+        wn_free(run_ahead->synth);
+        wn_free(run_ahead->samples);
+        wn_free(run_ahead);
+    }
+}
@@ -0,0 +1,62 @@
+//
+// Run-ahead: presents the frame a few frames after the emulated one, hiding the game's own input lag
+//
+
+#ifndef WINES_RUN_AHEAD_H
+#define WINES_RUN_AHEAD_H
+
+#include "common.h"
+
+typedef struct wines wines_t;
+
+// Samples of the emulated frames kept until they are read, the oldest are dropped beyond
+#define RUN_AHEAD_SAMPLE_BUFFER 8192
+
+/*
+ * Each host frame the console emulates one frame render-less, with its audio kept, then the frames ahead
+ * are run on a copy of its state, render-less but for the last one, which is the frame presented (the
+ * frame hook only sees that one). Their audio is dropped.
+ *
+ * With one instance, the state is saved before the frames ahead and restored after them. With a second
+ * instance, the state is loaded into a second console sharing the ROM image, which runs ahead while the
+ * first one is never restored: no restore, and the two consoles keep their own PPU caches and audio buffers.
+ *
+ * Frames are rendered immediately, deferred rendering is turned off on the console since its frame of lag
+ * would cancel a frame of run-ahead. The second instance gets the cheat codes of the console at creation.
+ */
+typedef struct run_ahead run_ahead_t;
+
+typedef struct {
+    uint64_t frames;
+    // Emulating the frames the console keeps
+    uint64_t frame_ns;
+    // Saving and restoring or copying the state, and the frames ahead
+    uint64_t ahead_ns;
+} run_ahead_stats_t;
+
+/**
+ * Runs `frames` (at least 1) frames ahead, with a second console when `second_instance` is set.
+ * Returns NULL when the second console cannot be created.
+ */
+run_ahead_t* run_ahead_create(wines_t* nes, uint8_t frames, bool second_instance);
+
+/**
+ * One host frame, replaces wines_run_frame
+ */
+void run_ahead_frame(run_ahead_t* run_ahead);
+
+/**
+ * Reads up to `count` samples of the emulated frames, returns the number read
+ */
+uint32_t run_ahead_read_samples(run_ahead_t* run_ahead, int16_t* out, uint32_t count);
+
+void run_ahead_stats(const run_ahead_t* run_ahead, run_ahead_stats_t* out);
+
+/**
+ * Cost of one frame ahead, in nanoseconds: ahead_ns / (frames * frames ahead)
+ */
+double run_ahead_frame_cost_ns(const run_ahead_t* run_ahead);
+
+void run_ahead_destroy(run_ahead_t* run_ahead);
+
+#endif //WINES_RUN_AHEAD_H
@@ -0,0 +1,498 @@
+//
+// Save states: versioned, little-endian snapshots of a console, without the ROM
+//
+
+#include "state.h"
+#include "wines.h"
+
+#define STATE_MAGIC         "WNST"
+#define STATE_HEADER_SIZE   20
+#define STATE_SECTION_SIZE  8
+
+#define STATE_TAG(a, b, c, d) ((uint32_t) (a) | (uint32_t) (b) << 8 | (uint32_t) (c) << 16 | (uint32_t) (d) << 24)
+
+#define STATE_TAG_CPU       STATE_TAG('C', 'P', 'U', ' ')
+#define STATE_TAG_PPU       STATE_TAG('P', 'P', 'U', ' ')
+#define STATE_TAG_APU       STATE_TAG('A', 'P', 'U', ' ')
+#define STATE_TAG_MAPPER    STATE_TAG('M', 'A', 'P', 'R')
+
+// Section sizes: memories, then the fields written one by one
+#define STATE_CPU_SIZE      (CPU_RAM_SIZE + 25)
+#define STATE_PPU_SIZE      (PPU_VRAM_SIZE * 2 + PPU_PALETTE_SIZE + 256 \
+                             + PPU_VISIBLE_SCANLINES * (1 + PPU_SPRITES_PER_LINE) + 16 + 44)
+#define STATE_PULSE_SIZE    21
+#define STATE_APU_SIZE      (STATE_PULSE_SIZE * 2 + 12 + 16 + 22 + 30)
+// Bank numbers, then PRG RAM, CHR RAM and the board's state
+#define STATE_MAPPER_SIZE   (MAPPER_PRG_BANK_COUNT * 4 + MAPPER_CHR_BANK_COUNT * 4)
+
+static uint32_t state_mapper_size(const wines_t* nes) {
+    const cart_t* cart = nes->cart;
+    return STATE_MAPPER_SIZE + cart->prg_ram_size + (cart->chr_ram ? cart->chr_size : 0)
+           + nes->mapper->func.state_size;
+}
+
+size_t wn_state_size(const wines_t* nes) {
+    return STATE_HEADER_SIZE + STATE_SECTION_SIZE * 4 + STATE_CPU_SIZE + STATE_PPU_SIZE + STATE_APU_SIZE
+           + state_mapper_size(nes);
+}
+
+#pragma mark - Save
+
+static void state_save_cpu(const cpu_t* cpu, state_writer_t* w) {
+    state_write_bytes(w, cpu->ram, CPU_RAM_SIZE);
+    state_write_u8(w, cpu->nmi);
+    state_write_u8(w, cpu->irq);
+    state_write_u16(w, cpu->pc);
+    state_write_u8(w, cpu->sp);
+    state_write_u8(w, cpu->a);
+    state_write_u8(w, cpu->x);
+    state_write_u8(w, cpu->y);
+    state_write_u8(w, cpu->p);
+    state_write_u32(w, cpu->cycles);
+    state_write_u64(w, cpu->cycle_count);
+    state_write_u8(w, cpu->am_acc_flag);
+    state_write_u8(w, cpu->oam_dma_flag);
+    state_write_u16(w, cpu->oam_dma_addr);
+}
+
+static void state_save_ppu(const ppu_t* ppu, state_writer_t* w) {
+    state_write_bytes(w, ppu->vram, PPU_VRAM_SIZE);
+    state_write_bytes(w, ppu->ext_vram, PPU_VRAM_SIZE);
+    state_write_bytes(w, ppu->palette, PPU_PALETTE_SIZE);
+    state_write_bytes(w, ppu->oam, 256);
+    for (int i = 0; i < PPU_VISIBLE_SCANLINES; ++i) {
+        state_write_u8(w, ppu->line_sprites[i].count);
+        state_write_bytes(w, ppu->line_sprites[i].index, PPU_SPRITES_PER_LINE);
+    }
+    state_write_bytes(w, ppu->spr0_rows, 16);
+
+    state_write_u8(w, ppu->mirroring);
+    state_write_u8(w, ppu->data_buffer);
+    state_write_u8(w, ppu->oam_addr);
+    state_write_u8(w, ppu->oam_dirty);
+    state_write_u16(w, ppu->spr_overflow_scanline);
+    state_write_u16(w, ppu->spr_overflow_tick);
+    state_write_u16(w, ppu->spr0_hit_tick);
+    state_write_u16(w, ppu->scanline);
+    state_write_u32(w, ppu->tick);
+    state_write_u32(w, ppu->frame_count);
+    state_write_u64(w, ppu->dot_count);
+    state_write_u8(w, ppu->a12_watch);
+    state_write_u8(w, ppu->a12);
+    state_write_u8(w, ppu->frame_render);
+    state_write_u8(w, ppu->frame_updated);
+    state_write_u16(w, ppu->line_v.addr);
+    state_write_u8(w, ppu->line_x);
+    state_write_u8(w, ppu->ctrl.val);
+    state_write_u8(w, ppu->mask.val);
+    state_write_u8(w, ppu->status.val);
+    state_write_u16(w, ppu->reg_v.addr);
+    state_write_u16(w, ppu->reg_t.addr);
+    state_write_u8(w, ppu->reg_x);
+    state_write_u8(w, ppu->reg_w);
+}
+
+static void state_save_envelope(const apu_envelope_t* envelope, state_writer_t* w) {
+    state_write_u8(w, envelope->start);
+    state_write_u8(w, envelope->divider);
+    state_write_u8(w, envelope->decay);
+}
+
+/*
+ * The channel outputs (amp) are left out: they track the synthesis buffer, which is not part of the state
+ */
+static void state_save_apu(const apu_t* apu, state_writer_t* w) {
+    for (int i = 0; i < 2; ++i) {
+        const apu_pulse_t* pulse = &apu->pulse[i];
+        state_write_u8(w, pulse->duty);
+        state_write_u8(w, pulse->halt);
+        state_write_u8(w, pulse->constant_volume);
+        state_write_u8(w, pulse->volume);
+        state_save_envelope(&pulse->envelope, w);
+        state_write_u8(w, pulse->sweep_enable);
+        state_write_u8(w, pulse->sweep_negate);
+        state_write_u8(w, pulse->sweep_reload);
+        state_write_u8(w, pulse->sweep_period);
+        state_write_u8(w, pulse->sweep_shift);
+        state_write_u8(w, pulse->sweep_divider);
+        state_write_u16(w, pulse->period);
+        state_write_u8(w, pulse->length);
+        state_write_u8(w, pulse->phase);
+        state_write_u32(w, pulse->delay);
+    }
+
+    const apu_triangle_t* triangle = &apu->triangle;
+    state_write_u8(w, triangle->halt);
+    state_write_u8(w, triangle->linear_reload);
+    state_write_u8(w, triangle->linear);
+    state_write_u8(w, triangle->linear_reload_flag);
+    state_write_u16(w, triangle->period);
+    state_write_u8(w, triangle->length);
+    state_write_u8(w, triangle->phase);
+    state_write_u32(w, triangle->delay);
+
+    const apu_noise_t* noise = &apu->noise;
+    state_write_u8(w, noise->halt);
+    state_write_u8(w, noise->constant_volume);
+    state_write_u8(w, noise->volume);
+    state_save_envelope(&noise->envelope, w);
+    state_write_u8(w, noise->mode);
+    state_write_u16(w, noise->period);
+    state_write_u16(w, noise->lfsr);
+    state_write_u8(w, noise->length);
+    state_write_u32(w, noise->delay);
+
+    const apu_dmc_t* dmc = &apu->dmc;
+    state_write_u8(w, dmc->irq_enable);
+    state_write_u8(w, dmc->loop);
+    state_write_u16(w, dmc->period);
+    state_write_u8(w, dmc->level);
+    state_write_u16(w, dmc->sample_addr);
+    state_write_u16(w, dmc->sample_length);
+    state_write_u16(w, dmc->addr);
+    state_write_u16(w, dmc->remaining);
+    state_write_u8(w, dmc->buffer);
+    state_write_u8(w, dmc->buffer_full);
+    state_write_u8(w, dmc->shift);
+    state_write_u8(w, dmc->bits);
+    state_write_u8(w, dmc->silence);
+    state_write_u32(w, dmc->delay);
+
+    state_write_u8(w, apu->enabled);
+    state_write_u8(w, apu->mode5);
+    state_write_u8(w, apu->irq_inhibit);
+    state_write_u8(w, apu->frame_step);
+    state_write_u64(w, apu->frame_next);
+    state_write_u8(w, apu->frame_irq);
+    state_write_u8(w, apu->dmc_irq);
+    state_write_u64(w, apu->time);
+    state_write_u64(w, apu->irq_time);
+}
+
+static void state_save_mapper(const mapper_t* mapper, state_writer_t* w) {
+    const cart_t* cart = mapper->cart;
+    for (uint8_t slot = 0; slot < MAPPER_PRG_BANK_COUNT; ++slot) {
+        // The ROM bank under a cheat's patched copy
+        const uint8_t* bank = mapper->cheats != NULL ? mapper->cheats->source[slot] : mapper->prg_banks[slot];
+        state_write_u32(w, (uint32_t) ((bank - cart->pgr_rom) / MAPPER_PRG_BANK_SIZE));
+    }
+    for (uint8_t slot = 0; slot < MAPPER_CHR_BANK_COUNT; ++slot) {
+        state_write_u32(w, (uint32_t) ((mapper->chr_banks[slot] - cart->chr_rom) / MAPPER_CHR_BANK_SIZE));
+    }
+    state_write_bytes(w, cart->prg_ram, cart->prg_ram_size);
+    if (cart->chr_ram) {
+        state_write_bytes(w, cart->chr_rom, cart->chr_size);
+    }
+    if (mapper->func.state_save != NULL) {
+        mapper->func.state_save((mapper_t*) mapper, w);
+    }
+}
+
+FORCE_INLINE static void state_begin_section(state_writer_t* w, uint32_t tag, uint32_t size) {
+    state_write_u32(w, tag);
+    state_write_u32(w, size);
+}
+
+size_t wn_state_save(const wines_t* nes, uint8_t* buf, size_t size) {
+    size_t state_size = wn_state_size(nes);
+    if (size < state_size) {
+        return 0;
+    }
+
+    const cart_t* cart = nes->cart;
+    state_writer_t w = {buf};
+    state_write_bytes(&w, STATE_MAGIC, 4);
+    state_write_u16(&w, WN_STATE_VERSION);
+    state_write_u8(&w, cart->mapper_no);
+    state_write_u8(&w, 0);
+    state_write_u32(&w, cart->pgr_size);
+    state_write_u32(&w, cart->chr_size);
+    state_write_u32(&w, cart->prg_ram_size);
+
+    state_begin_section(&w, STATE_TAG_CPU, STATE_CPU_SIZE);
+    state_save_cpu(nes->cpu, &w);
+    state_begin_section(&w, STATE_TAG_PPU, STATE_PPU_SIZE);
+    state_save_ppu(nes->ppu, &w);
+    state_begin_section(&w, STATE_TAG_APU, STATE_APU_SIZE);
+    state_save_apu(nes->apu, &w);
+    state_begin_section(&w, STATE_TAG_MAPPER, state_mapper_size(nes));
+    state_save_mapper(nes->mapper, &w);
+    return state_size;
+}
+
+#pragma mark - Load
+
+static void state_load_cpu(cpu_t* cpu, state_reader_t* r) {
+    state_read_bytes(r, cpu->ram, CPU_RAM_SIZE);
+    cpu->nmi = state_read_u8(r);
+    cpu->irq = state_read_u8(r);
+    cpu->pc = state_read_u16(r);
+    cpu->sp = state_read_u8(r);
+    cpu->a = state_read_u8(r);
+    cpu->x = state_read_u8(r);
+    cpu->y = state_read_u8(r);
+    cpu->p = state_read_u8(r);
+    cpu->cycles = state_read_u32(r);
+    cpu->cycle_count = state_read_u64(r);
+    cpu->am_acc_flag = state_read_u8(r);
+    cpu->oam_dma_flag = state_read_u8(r);
+    cpu->oam_dma_addr = state_read_u16(r);
+}
+
+static void state_load_ppu(ppu_t* ppu, state_reader_t* r) {
+    state_read_bytes(r, ppu->vram, PPU_VRAM_SIZE);
+    state_read_bytes(r, ppu->ext_vram, PPU_VRAM_SIZE);
+    state_read_bytes(r, ppu->palette, PPU_PALETTE_SIZE);
+    state_read_bytes(r, ppu->oam, 256);
+    for (int i = 0; i < PPU_VISIBLE_SCANLINES; ++i) {
+        ppu->line_sprites[i].count = state_read_u8(r);
+        state_read_bytes(r, ppu->line_sprites[i].index, PPU_SPRITES_PER_LINE);
+    }
+    state_read_bytes(r, ppu->spr0_rows, 16);
+
+    // Maps the nametables and invalidates the nametable cache
+    ppu_set_mirroring(ppu, (mirroring_t) state_read_u8(r));
+    // Derived from the attribute bytes, not part of the state
+    ppu_decode_attributes(ppu);
+    ppu->data_buffer = state_read_u8(r);
+    ppu->oam_addr = state_read_u8(r);
+    ppu->oam_dirty = state_read_u8(r);
+    ppu->spr_overflow_scanline = (int16_t) state_read_u16(r);
+    ppu->spr_overflow_tick = state_read_u16(r);
+    ppu->spr0_hit_tick = state_read_u16(r);
+    ppu->scanline = (int16_t) state_read_u16(r);
+    ppu->tick = state_read_u32(r);
+    ppu->frame_count = state_read_u32(r);
+    ppu->dot_count = state_read_u64(r);
+    // Gates the ppu_a12 callback, which only boards tracking A12 have
+    ppu->a12_watch = state_read_u8(r) && ppu->mapper->func.ppu_a12 != NULL;
+    ppu->a12 = state_read_u8(r);
+    ppu->frame_render = state_read_u8(r);
+    ppu->frame_updated = state_read_u8(r);
+    ppu->line_v.addr = state_read_u16(r);
+    ppu->line_x = state_read_u8(r);
+    ppu->ctrl.val = state_read_u8(r);
+    ppu->mask.val = state_read_u8(r);
+    ppu->status.val = state_read_u8(r);
+    ppu->reg_v.addr = state_read_u16(r);
+    ppu->reg_t.addr = state_read_u16(r);
+    ppu->reg_x = state_read_u8(r);
+    ppu->reg_w = state_read_u8(r);
+}
+
+static void state_load_envelope(apu_envelope_t* envelope, state_reader_t* r) {
+    envelope->start = state_read_u8(r);
+    envelope->divider = state_read_u8(r);
+    envelope->decay = state_read_u8(r);
+}
+
+static void state_load_apu(apu_t* apu, state_reader_t* r) {
+    // Samples of the current timeline are kept, the restored one continues from there
+    apu_end_frame(apu, apu->time);
+
+    for (int i = 0; i < 2; ++i) {
+        apu_pulse_t* pulse = &apu->pulse[i];
+        pulse->duty = state_read_u8(r);
+        pulse->halt = state_read_u8(r);
+        pulse->constant_volume = state_read_u8(r);
+        pulse->volume = state_read_u8(r);
+        state_load_envelope(&pulse->envelope, r);
+        pulse->sweep_enable = state_read_u8(r);
+        pulse->sweep_negate = state_read_u8(r);
+        pulse->sweep_reload = state_read_u8(r);
+        pulse->sweep_period = state_read_u8(r);
+        pulse->sweep_shift = state_read_u8(r);
+        pulse->sweep_divider = state_read_u8(r);
+        pulse->period = state_read_u16(r);
+        pulse->length = state_read_u8(r);
+        pulse->phase = state_read_u8(r);
+        pulse->delay = state_read_u32(r);
+    }
+
+    apu_triangle_t* triangle = &apu->triangle;
+    triangle->halt = state_read_u8(r);
+    triangle->linear_reload = state_read_u8(r);
+    triangle->linear = state_read_u8(r);
+    triangle->linear_reload_flag = state_read_u8(r);
+    triangle->period = state_read_u16(r);
+    triangle->length = state_read_u8(r);
+    triangle->phase = state_read_u8(r);
+    triangle->delay = state_read_u32(r);
+
+    apu_noise_t* noise = &apu->noise;
+    noise->halt = state_read_u8(r);
+    noise->constant_volume = state_read_u8(r);
+    noise->volume = state_read_u8(r);
+    state_load_envelope(&noise->envelope, r);
+    noise->mode = state_read_u8(r);
+    noise->period = state_read_u16(r);
+    noise->lfsr = state_read_u16(r);
+    noise->length = state_read_u8(r);
+    noise->delay = state_read_u32(r);
+
+    apu_dmc_t* dmc = &apu->dmc;
+    dmc->irq_enable = state_read_u8(r);
+    dmc->loop = state_read_u8(r);
+    dmc->period = state_read_u16(r);
+    dmc->level = state_read_u8(r);
+    dmc->sample_addr = state_read_u16(r);
+    dmc->sample_length = state_read_u16(r);
+    dmc->addr = state_read_u16(r);
+    dmc->remaining = state_read_u16(r);
+    dmc->buffer = state_read_u8(r);
+    dmc->buffer_full = state_read_u8(r);
+    dmc->shift = state_read_u8(r);
+    dmc->bits = state_read_u8(r);
+    dmc->silence = state_read_u8(r);
+    dmc->delay = state_read_u32(r);
+
+    apu->enabled = state_read_u8(r);
+    apu->mode5 = state_read_u8(r);
+    apu->irq_inhibit = state_read_u8(r);
+    apu->frame_step = state_read_u8(r);
+    apu->frame_next = state_read_u64(r);
+    apu->frame_irq = state_read_u8(r);
+    apu->dmc_irq = state_read_u8(r);
+    apu->time = state_read_u64(r);
+    apu->irq_time = state_read_u64(r);
+    apu->frame_start = apu->time;
+}
+
+static void state_load_mapper(mapper_t* mapper, state_reader_t* r) {
+    cart_t* cart = mapper->cart;
+    for (uint8_t slot = 0; slot < MAPPER_PRG_BANK_COUNT; ++slot) {
+        mapper_set_prg_bank(mapper, slot, state_read_u32(r));
+    }
+    for (uint8_t slot = 0; slot < MAPPER_CHR_BANK_COUNT; ++slot) {
+        mapper_set_chr_bank(mapper, slot, state_read_u32(r));
+    }
+    // Gates irq_update, which boards without an IRQ do not have. Those with one schedule it in their state_load.
+    mapper->irq_time = UINT64_MAX;
+    state_read_bytes(r, cart->prg_ram, cart->prg_ram_size);
+    if (cart->chr_ram) {
+        state_read_bytes(r, cart->chr_rom, cart->chr_size);
+    }
+    if (mapper->func.state_load != NULL) {
+        mapper->func.state_load(mapper, r);
+    }
+}
+
+#pragma mark - Check
+
+/*
+ * Fields used as indexes are checked before anything is restored, so a damaged state cannot leave the console
+ * half loaded or make it read out of its tables
+ */
+static bool state_check_ppu(state_reader_t* r) {
+    r->pos += PPU_VRAM_SIZE * 2 + PPU_PALETTE_SIZE + 256;
+    for (int i = 0; i < PPU_VISIBLE_SCANLINES; ++i) {
+        if (state_read_u8(r) > PPU_SPRITES_PER_LINE) {
+            return false;
+        }
+        for (int k = 0; k < PPU_SPRITES_PER_LINE; ++k) {
+            if (state_read_u8(r) >= 64) {
+                return false;
+            }
+        }
+    }
+    r->pos += 16;
+
+    if (state_read_u8(r) > MIRRORING_FOUR_SCREEN) {
+        return false;
+    }
+    // Data buffer, OAM address and flag, sprite overflow and sprite 0 hit times
+    r->pos += 3 + 6;
+    int16_t scanline = (int16_t) state_read_u16(r);
+    uint32_t tick = state_read_u32(r);
+    return scanline >= -1 && scanline < PPU_SCANLINES - 1 && tick < PPU_DOTS_PER_SCANLINE;
+}
+
+static bool state_check_apu(state_reader_t* r) {
+    for (int i = 0; i < 2; ++i) {
+        uint8_t duty = state_read_u8(r);
+        // Flags, volume, envelope, sweep, period and length
+        r->pos += 15;
+        uint8_t phase = state_read_u8(r);
+        r->pos += 4;
+        if (duty >= 4 || phase >= 8) {
+            return false;
+        }
+    }
+
+    // Flags, linear counter, period and length
+    r->pos += 7;
+    if (state_read_u8(r) >= 32) {
+        return false;
+    }
+    // Triangle delay, then the noise flags, volume, envelope and mode
+    r->pos += 4 + 7;
+    uint16_t noise_period = state_read_u16(r);
+    // Noise LFSR, length and delay, DMC flags
+    r->pos += 7 + 2;
+    uint16_t dmc_period = state_read_u16(r);
+    // A zero period would never advance the channel timers
+    if (!apu_periods_valid(noise_period, dmc_period)) {
+        return false;
+    }
+    // Rest of the DMC, then the enabled channels, frame mode and IRQ inhibit
+    r->pos += 18 + 3;
+    return state_read_u8(r) < 4;
+}
+
+err_t wn_state_load(wines_t* nes, const uint8_t* buf, size_t size) {
+    if (nes == NULL || buf == NULL) {
+        return ERR_NULLPTR;
+    }
+
+    const cart_t* cart = nes->cart;
+    state_reader_t r = {buf};
+    if (size < STATE_HEADER_SIZE || memcmp(buf, STATE_MAGIC, 4) != 0) {
+        return ERR_INVALID_STATE;
+    }
+    r.pos += 4;
+    uint16_t version = state_read_u16(&r);
+    uint8_t mapper_no = state_read_u8(&r);
+    r.pos += 1;
+    if (version != WN_STATE_VERSION || mapper_no != cart->mapper_no || state_read_u32(&r) != cart->pgr_size
+        || state_read_u32(&r) != cart->chr_size || state_read_u32(&r) != cart->prg_ram_size) {
+        return ERR_INVALID_STATE;
+    }
+
+    // Every section is located and checked before anything is restored
+    const uint32_t tags[4] = {STATE_TAG_CPU, STATE_TAG_PPU, STATE_TAG_APU, STATE_TAG_MAPPER};
+    const uint32_t sizes[4] = {STATE_CPU_SIZE, STATE_PPU_SIZE, STATE_APU_SIZE, state_mapper_size(nes)};
+    const uint8_t* sections[4] = {NULL};
+    const uint8_t* end = buf + size;
+    while (end - r.pos >= STATE_SECTION_SIZE) {
+        uint32_t tag = state_read_u32(&r);
+        uint32_t section_size = state_read_u32(&r);
+        if ((size_t) (end - r.pos) < section_size) {
+            return ERR_INVALID_STATE;
+        }
+        for (int i = 0; i < 4; ++i) {
+            if (tag == tags[i]) {
+                if (section_size != sizes[i]) {
+                    return ERR_INVALID_STATE;
+                }
+                sections[i] = r.pos;
+            }
+        }
+        r.pos += section_size;
+    }
+    for (int i = 0; i < 4; ++i) {
+        if (sections[i] == NULL) {
+            return ERR_INVALID_STATE;
+        }
+    }
+    if (!state_check_ppu(&(state_reader_t) {sections[1]}) || !state_check_apu(&(state_reader_t) {sections[2]})) {
+        return ERR_INVALID_STATE;
+    }
+
+    // The APU catches up on the current timeline first, the IRQs it raises there are replaced by the CPU's.
+    // Banks before the PPU, its pattern pages follow them.
+    state_load_apu(nes->apu, &(state_reader_t) {sections[2]});
+    state_load_mapper(nes->mapper, &(state_reader_t) {sections[3]});
+    state_load_cpu(nes->cpu, &(state_reader_t) {sections[0]});
+    state_load_ppu(nes->ppu, &(state_reader_t) {sections[1]});
+    return ERR_OK;
+}
@@ -0,0 +1,114 @@
+//
+// Save states: versioned, little-endian snapshots of a console, without the ROM
+//
+
+#ifndef WINES_STATE_H
+#define WINES_STATE_H
+
+#include <string.h>
+
+#include "common.h"
+
+typedef struct wines wines_t;
+
+#define WN_STATE_VERSION 2
+
+/*
+ * Layout, all integers little-endian:
+ *   header:   "WNST", u16 version, u8 mapper number, u8 reserved, u32 PRG ROM size, u32 CHR size, u32 PRG RAM size
+ *   sections: u32 tag, u32 size, then `size` bytes, for "CPU ", "PPU ", "APU " and "MAPR"
+ *
+ * Multi-byte fields are written one by one so the format does not depend on the host or the compiler,
+ * memories (RAM, VRAM, OAM, PRG/CHR RAM) are copied as they are. A loader skips the sections it does
+ * not know. The size of the states of a console never changes (see wn_state_size).
+ */
+
+typedef struct {
+    uint8_t* pos;
+} state_writer_t;
+
+typedef struct {
+    const uint8_t* pos;
+} state_reader_t;
+
+FORCE_INLINE static void state_write_u8(state_writer_t* w, uint8_t val) {
+    *w->pos++ = val;
+}
+
+FORCE_INLINE static void state_write_u16(state_writer_t* w, uint16_t val) {
+    w->pos[0] = val;
+    w->pos[1] = val >> 8;
+    w->pos += 2;
+}
+
+FORCE_INLINE static void state_write_u32(state_writer_t* w, uint32_t val) {
+    for (int i = 0; i < 4; ++i) {
+        w->pos[i] = val >> (i * 8);
+    }
+    w->pos += 4;
+}
+
+FORCE_INLINE static void state_write_u64(state_writer_t* w, uint64_t val) {
+    for (int i = 0; i < 8; ++i) {
+        w->pos[i] = val >> (i * 8);
+    }
+    w->pos += 8;
+}
+
+FORCE_INLINE static void state_write_bytes(state_writer_t* w, const void* data, size_t size) {
+    memcpy(w->pos, data, size);
+    w->pos += size;
+}
+
+FORCE_INLINE static uint8_t state_read_u8(state_reader_t* r) {
+    return *r->pos++;
+}
+
+FORCE_INLINE static uint16_t state_read_u16(state_reader_t* r) {
+    uint16_t val = r->pos[0] | r->pos[1] << 8;
+    r->pos += 2;
+    return val;
+}
+
+FORCE_INLINE static uint32_t state_read_u32(state_reader_t* r) {
+    uint32_t val = 0;
+    for (int i = 0; i < 4; ++i) {
+        val |= (uint32_t) r->pos[i] << (i * 8);
+    }
+    r->pos += 4;
+    return val;
+}
+
+FORCE_INLINE static uint64_t state_read_u64(state_reader_t* r) {
+    uint64_t val = 0;
+    for (int i = 0; i < 8; ++i) {
+        val |= (uint64_t) r->pos[i] << (i * 8);
+    }
+    r->pos += 8;
+    return val;
+}
+
+FORCE_INLINE static void state_read_bytes(state_reader_t* r, void* data, size_t size) {
+    memcpy(data, r->pos, size);
+    r->pos += size;
+}
+
+/**
+ * Size of every state of the console
+ */
+size_t wn_state_size(const wines_t* nes);
+
+/**
+ * Writes the state of the console to `buf`, which holds at least wn_state_size bytes.
+ * Returns the number of bytes written, 0 if the buffer is too small.
+ */
+size_t wn_state_save(const wines_t* nes, uint8_t* buf, size_t size);
+
+/**
+ * Restores a state saved from a console running the same ROM.
+ * Returns ERR_INVALID_STATE, leaving the console untouched, if the state is damaged, from a newer version
+ * or from another ROM.
+ */
+err_t wn_state_load(wines_t* nes, const uint8_t* buf, size_t size);
+
+#endif //WINES_STATE_H
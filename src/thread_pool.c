@@ -0,0 +1,165 @@
+//
+// Small worker pool running data-parallel jobs (stripes, bands, files)
+//
+
+#include <stdatomic.h>
+
+#include "thread_pool.h"
+#include "platform.h"
+
+struct thread_pool {
+    wn_thread_t** threads;
+    uint32_t workers;
+
+    wn_mutex_t* mutex;
+    // Workers wait for a new job
+    wn_cond_t* job_cond;
+    // Waiters wait for the job to complete
+    wn_cond_t* done_cond;
+
+    // Current job, changes under the mutex
+    thread_task_t task;
+    void* arg;
+    uint32_t count;
+    uint32_t generation;
+    bool quit;
+
+    // Next item to take, and items not finished yet
+    atomic_uint next;
+    atomic_uint remaining;
+
+    // Workers inside pool_work, changes under the mutex. A worker waking up late may still enter
+    // pool_work with a job that is already over, so submit waits for it to drop to 0 before resetting
+    // the counters: no worker can then pick items of the next job with the task of the previous one.
+    atomic_uint active;
+};
+
+/*
+ * Takes items of the current job until there is none left
+ */
+static void pool_work(thread_pool_t* pool, thread_task_t task, void* arg, uint32_t count) {
+    uint32_t index;
+    while ((index = atomic_fetch_add(&pool->next, 1)) < count) {
+        task(arg, index);
+        atomic_fetch_sub(&pool->remaining, 1);
+    }
+}
+
+static void pool_worker(void* param) {
+    thread_pool_t* pool = param;
+    uint32_t generation = 0;
+
+    wn_mutex_lock(pool->mutex);
+    while (true) {
+        while (!pool->quit && pool->generation == generation) {
+            wn_cond_wait(pool->job_cond, pool->mutex);
+        }
+        if (pool->quit) {
+            break;
+        }
+        generation = pool->generation;
+        thread_task_t task = pool->task;
+        void* arg = pool->arg;
+        uint32_t count = pool->count;
+        atomic_fetch_add(&pool->active, 1);
+        wn_mutex_unlock(pool->mutex);
+
+        pool_work(pool, task, arg, count);
+
+        wn_mutex_lock(pool->mutex);
+        if (atomic_fetch_sub(&pool->active, 1) == 1) {
+            wn_cond_broadcast(pool->done_cond);
+        }
+    }
+    wn_mutex_unlock(pool->mutex);
+}
+
+thread_pool_t* thread_pool_create(uint32_t workers) {
+    if (workers == 0) {
+        uint32_t cpus = wn_cpu_count();
+        workers = cpus > 1 ? cpus - 1 : 1;
+    }
+
+    thread_pool_t* pool = wn_calloc(sizeof(thread_pool_t));
+    pool->workers = workers;
+    pool->mutex = wn_mutex_create();
+    pool->job_cond = wn_cond_create();
+    pool->done_cond = wn_cond_create();
+    atomic_init(&pool->next, 0);
+    atomic_init(&pool->remaining, 0);
+    atomic_init(&pool->active, 0);
+
+    pool->threads = wn_calloc(sizeof(wn_thread_t*) * workers);
+    for (uint32_t i = 0; i < workers; ++i) {
+        pool->threads[i] = wn_thread_create(pool_worker, pool);
+    }
+    return pool;
+}
+
+void thread_pool_submit(thread_pool_t* pool, thread_task_t task, void* arg, uint32_t count) {
+    if (count == 0) {
+        return;
+    }
+    wn_mutex_lock(pool->mutex);
+    while (atomic_load(&pool->active) != 0) {
+        wn_cond_wait(pool->done_cond, pool->mutex);
+    }
+    pool->task = task;
+    pool->arg = arg;
+    pool->count = count;
+    atomic_store(&pool->remaining, count);
+    atomic_store(&pool->next, 0);
+    ++pool->generation;
+    wn_cond_broadcast(pool->job_cond);
+    wn_mutex_unlock(pool->mutex);
+}
+
+void thread_pool_wait(thread_pool_t* pool) {
+    wn_mutex_lock(pool->mutex);
+    thread_task_t task = pool->task;
+    void* arg = pool->arg;
+    uint32_t count = pool->count;
+    wn_mutex_unlock(pool->mutex);
+
+    if (task != NULL) {
+        pool_work(pool, task, arg, count);
+    }
+
+    wn_mutex_lock(pool->mutex);
+    while (atomic_load(&pool->remaining) != 0 || atomic_load(&pool->active) != 0) {
+        wn_cond_wait(pool->done_cond, pool->mutex);
+    }
+    wn_mutex_unlock(pool->mutex);
+}
+
+bool thread_pool_done(thread_pool_t* pool) {
+    return atomic_load(&pool->remaining) == 0 && atomic_load(&pool->active) == 0;
+}
+
+void thread_pool_run(thread_pool_t* pool, thread_task_t task, void* arg, uint32_t count) {
+    thread_pool_submit(pool, task, arg, count);
+    thread_pool_wait(pool);
+}
+
+uint32_t thread_pool_workers(const thread_pool_t* pool) {
+    return pool->workers;
+}
+
+void thread_pool_destroy(thread_pool_t* pool) {
+    if (pool == NULL) {
+        return;
+    }
+    wn_mutex_lock(pool->mutex);
+    pool->quit = true;
+    wn_cond_broadcast(pool->job_cond);
+    wn_mutex_unlock(pool->mutex);
+
+    for (uint32_t i = 0; i < pool->workers; ++i) {
+        wn_thread_join(pool->threads[i]);
+    }
+    wn_free(pool->threads);
+    wn_cond_destroy(pool->job_cond);
+    wn_cond_destroy(pool->done_cond);
+    wn_mutex_destroy(pool->mutex);
+    wn_free(pool);
+}
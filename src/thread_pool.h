@@ -0,0 +1,47 @@
+//
+// Small worker pool running data-parallel jobs (stripes, bands, files)
+//
+
+#ifndef WINES_THREAD_POOL_H
+#define WINES_THREAD_POOL_H
+
+#include "common.h"
+
+typedef struct thread_pool thread_pool_t;
+
+/**
+ * One item of a job, `index` in [0, count)
+ */
+typedef void (* thread_task_t)(void* arg, uint32_t index);
+
+/**
+ * `workers` threads, 0 for one less than the number of processors
+ */
+thread_pool_t* thread_pool_create(uint32_t workers);
+
+/**
+ * Starts running task(arg, 0..count-1) on the workers and returns immediately.
+ * One job at a time: the previous one must have been waited for.
+ */
+void thread_pool_submit(thread_pool_t* pool, thread_task_t task, void* arg, uint32_t count);
+
+/**
+ * Helps with the current job on the calling thread, then waits until all of its items are done
+ */
+void thread_pool_wait(thread_pool_t* pool);
+
+/**
+ * Whether the current job is done, never blocks
+ */
+bool thread_pool_done(thread_pool_t* pool);
+
+/**
+ * thread_pool_submit + thread_pool_wait
+ */
+void thread_pool_run(thread_pool_t* pool, thread_task_t task, void* arg, uint32_t count);
+
+uint32_t thread_pool_workers(const thread_pool_t* pool);
+
+void thread_pool_destroy(thread_pool_t* pool);
+
+#endif //WINES_THREAD_POOL_H
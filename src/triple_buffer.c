@@ -0,0 +1,67 @@
+//
+// Lock-free triple buffer between one producer and one consumer thread
+//
+
+#include "triple_buffer.h"
+#include "platform.h"
+
+#define MIDDLE_INDEX    0b011
+#define MIDDLE_FRESH    0b100
+
+void triple_buffer_init(triple_buffer_t* tb) {
+    tb->back = 0;
+    atomic_init(&tb->middle, 1);
+    tb->front = 2;
+    tb->buffers[tb->front].frame_count = 0;
+
+    atomic_init(&tb->published, 0);
+    atomic_init(&tb->dropped, 0);
+    atomic_init(&tb->presented, 0);
+    atomic_init(&tb->repeated, 0);
+    atomic_init(&tb->latency_total_ns, 0);
+    atomic_init(&tb->latency_max_ns, 0);
+}
+
+video_frame_t* triple_buffer_back(triple_buffer_t* tb) {
+    return &tb->buffers[tb->back];
+}
+
+void triple_buffer_publish(triple_buffer_t* tb) {
+    // Release: the frame contents are visible to the consumer once it sees the new index
+    unsigned old = atomic_exchange_explicit(&tb->middle, tb->back | MIDDLE_FRESH, memory_order_acq_rel);
+    tb->back = old & MIDDLE_INDEX;
+    if (old & MIDDLE_FRESH) {
+        atomic_fetch_add_explicit(&tb->dropped, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&tb->published, 1, memory_order_relaxed);
+}
+
+const video_frame_t* triple_buffer_acquire(triple_buffer_t* tb, bool* fresh) {
+    *fresh = atomic_load_explicit(&tb->middle, memory_order_relaxed) & MIDDLE_FRESH;
+    if (*fresh) {
+        unsigned old = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel);
+        tb->front = old & MIDDLE_INDEX;
+
+        uint64_t latency = wn_time_ns() - tb->buffers[tb->front].complete_ns;
+        atomic_fetch_add_explicit(&tb->latency_total_ns, latency, memory_order_relaxed);
+        if (latency > atomic_load_explicit(&tb->latency_max_ns, memory_order_relaxed)) {
+            atomic_store_explicit(&tb->latency_max_ns, latency, memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&tb->presented, 1, memory_order_relaxed);
+    } else if (atomic_load_explicit(&tb->presented, memory_order_relaxed) == 0) {
+        return NULL;
+    } else {
+        atomic_fetch_add_explicit(&tb->repeated, 1, memory_order_relaxed);
+    }
+    return &tb->buffers[tb->front];
+}
+
+void triple_buffer_stats(triple_buffer_t* tb, triple_buffer_stats_t* out) {
+    out->published = atomic_load_explicit(&tb->published, memory_order_relaxed);
+    out->dropped = atomic_load_explicit(&tb->dropped, memory_order_relaxed);
+    out->presented = atomic_load_explicit(&tb->presented, memory_order_relaxed);
+    out->repeated = atomic_load_explicit(&tb->repeated, memory_order_relaxed);
+    uint64_t total = atomic_load_explicit(&tb->latency_total_ns, memory_order_relaxed);
+    out->latency_avg_ns = out->presented ? total / out->presented : 0;
+    out->latency_max_ns = atomic_load_explicit(&tb->latency_max_ns, memory_order_relaxed);
+}
@@ -0,0 +1,71 @@
+//
+// Lock-free triple buffer between one producer and one consumer thread
+//
+
+#ifndef WINES_TRIPLE_BUFFER_H
+#define WINES_TRIPLE_BUFFER_H
+
+#include <stdatomic.h>
+
+#include "common.h"
+#include "video.h"
+
+/*
+ * The producer always owns the back buffer and the consumer the front buffer, the third one sits in
+ * the middle. Publishing swaps back and middle, acquiring swaps front and middle if the middle one
+ * holds a newer frame. Neither side ever waits on the other: a frame the consumer did not pick up in
+ * time is replaced (dropped), and the consumer shows its front buffer again when nothing new came (repeated).
+ */
+typedef struct {
+    video_frame_t buffers[3];
+
+    // Index of the middle buffer (bits 0-1), and whether it holds an unconsumed frame (bit 2)
+    atomic_uint middle;
+
+    // Owned by the producer
+    uint8_t back;
+    // Owned by the consumer
+    uint8_t front;
+
+    //
+    // Counters, each written by one side only
+    //
+    atomic_uint_fast64_t published;
+    atomic_uint_fast64_t dropped;
+    atomic_uint_fast64_t presented;
+    atomic_uint_fast64_t repeated;
+    // Time from frame completion to acquisition by the consumer
+    atomic_uint_fast64_t latency_total_ns;
+    atomic_uint_fast64_t latency_max_ns;
+} triple_buffer_t;
+
+typedef struct {
+    uint64_t published;
+    uint64_t dropped;
+    uint64_t presented;
+    uint64_t repeated;
+    uint64_t latency_avg_ns;
+    uint64_t latency_max_ns;
+} triple_buffer_stats_t;
+
+void triple_buffer_init(triple_buffer_t* tb);
+
+/**
+ * Producer: buffer to fill with the next frame
+ */
+video_frame_t* triple_buffer_back(triple_buffer_t* tb);
+
+/**
+ * Producer: makes the back buffer the newest frame
+ */
+void triple_buffer_publish(triple_buffer_t* tb);
+
+/**
+ * Consumer: newest published frame, `fresh` tells whether it differs from the previous call.
+ * Returns NULL until the first frame is published.
+ */
+const video_frame_t* triple_buffer_acquire(triple_buffer_t* tb, bool* fresh);
+
+void triple_buffer_stats(triple_buffer_t* tb, triple_buffer_stats_t* out);
+
+#endif //WINES_TRIPLE_BUFFER_H
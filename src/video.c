@@ -0,0 +1,15 @@
+//
+// Completed video frames, as handed from the emulation to the presentation side
+//
+
+#include <string.h>
+
+#include "video.h"
+#include "platform.h"
+
+void video_frame_capture(video_frame_t* frame, const ppu_t* ppu) {
+    memcpy(frame->pixels, ppu->frame, sizeof(frame->pixels));
+    memcpy(frame->emphasis, ppu->frame_emphasis, sizeof(frame->emphasis));
+    frame->frame_count = ppu->frame_count;
+    frame->complete_ns = wn_time_ns();
+}
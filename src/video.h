@@ -0,0 +1,26 @@
+//
+// Completed video frames, as handed from the emulation to the presentation side
+//
+
+#ifndef WINES_VIDEO_H
+#define WINES_VIDEO_H
+
+#include "common.h"
+#include "ppu.h"
+
+typedef struct {
+    // Palette indexes $00-$3F
+    uint8_t pixels[PPU_FRAME_HEIGHT][PPU_FRAME_WIDTH];
+    // PPUMASK emphasis bits (5-7) of each scanline
+    uint8_t emphasis[PPU_FRAME_HEIGHT];
+    uint32_t frame_count;
+    // wn_time_ns() when the frame was completed
+    uint64_t complete_ns;
+} video_frame_t;
+
+/**
+ * Copies the PPU frame buffer into `frame`
+ */
+void video_frame_capture(video_frame_t* frame, const ppu_t* ppu);
+
+#endif //WINES_VIDEO_H
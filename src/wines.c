@@ -2,20 +2,91 @@
 // Created by WangKZ on 2024/4/1.
 //
 
-#include "cartridge.h"
-#include "cpu.h"
-#include "ppu.h"
+#include "wines.h"
 #include "platform.h"
 
-void pop_nes_init() {
-    cart_t cart;
-    cart_load_rom("../test_nes/nestest.nes", &cart);
+size_t wines_arena_size(const cart_image_t* image) {
+    size_t mapper = mapper_arena_size(image->mapper_no);
+    if (mapper == 0) {
+        return 0;
+    }
+    return WN_ARENA_ALIGN(sizeof(wines_t)) + WN_ARENA_ALIGN(sizeof(cart_t)) + cart_arena_size(image) + mapper
+           + WN_ARENA_ALIGN(sizeof(ppu_t)) + WN_ARENA_ALIGN(sizeof(cpu_t)) + WN_ARENA_ALIGN(sizeof(apu_t));
+}
 
-    mapper_t* mapper = mapper_create(&cart);
-    ppu_t* ppu = ppu_create(mapper);
-    cpu_t* cpu = cpu_create(ppu, mapper);
+/**
+ * Wires a console around the image, every part of it allocated from one arena
+ */
+static err_t wines_create_image(cart_image_t* image, bool shared, wines_t** out) {
+    size_t size = wines_arena_size(image);
+    if (size == 0) {
+        return ERR_UNSUPPORTED_MAPPER;
+    }
 
-    while (true) {
+    // Everything lands on the heap if the block cannot be allocated
+    wn_arena_t arena;
+    wn_arena_init(&arena, size);
+    wines_t* nes = wn_arena_calloc(&arena, sizeof(wines_t));
+    nes->arena = arena;
+
+    nes->cart = wn_arena_calloc(&nes->arena, sizeof(cart_t));
+    if (shared) {
+        cart_init_shared(image, nes->cart, &nes->arena);
+    } else {
+        cart_init(image, nes->cart, &nes->arena);
+    }
+    nes->mapper = mapper_create(nes->cart, &nes->arena);
+    nes->ppu = ppu_create(nes->mapper, &nes->arena);
+    nes->cpu = cpu_create(nes->ppu, nes->mapper, &nes->arena);
+    nes->apu = apu_create(nes->cpu, &nes->arena);
+
+    *out = nes;
+    return ERR_OK;
+}
+
+err_t wines_create(const char* rom_filename, wines_t** out) {
+    if (rom_filename == NULL || out == NULL) {
+        return ERR_NULLPTR;
+    }
+
+    cart_image_t* image;
+    err_t err = cart_image_load(rom_filename, &image);
+    if (err != ERR_OK) {
+        return err;
+    }
+    err = wines_create_image(image, false, out);
+    cart_image_release(image);
+    return err;
+}
+
+err_t wines_create_shared(cart_image_t* image, wines_t** out) {
+    if (image == NULL || out == NULL) {
+        return ERR_NULLPTR;
+    }
+    return wines_create_image(image, true, out);
+}
+
+void wines_run_frame(wines_t* nes) {
+    // Latched by the PPU at the start of the frame
+    ppu_set_render(nes->ppu, nes->frame_skip_count == 0);
+    if (++nes->frame_skip_count > nes->frame_skip) {
+        nes->frame_skip_count = 0;
+    }
+    wines_step_frame(nes);
+    wines_sync_sav(nes);
+}
+
+void wines_sync_sav(wines_t* nes) {
+    if (nes->ppu->frame_count % CART_SAV_SYNC_FRAMES == 0) {
+        cart_sync_sav(nes->cart);
+    }
+}
+
+void wines_step_frame(wines_t* nes) {
+    cpu_t* cpu = nes->cpu;
+    ppu_t* ppu = nes->ppu;
+    uint32_t frame = ppu->frame_count;
+    while (ppu->frame_count == frame) {
         // On NTSC system, three PPU ticks per CPU cycle
         cpu_cycle(cpu);
 
@@ -23,4 +94,87 @@ void pop_nes_init() {
         ppu_cycle(ppu);
         ppu_cycle(ppu);
     }
-}
\ No newline at end of file
+    apu_end_frame(nes->apu, cpu->cycle_count);
+
+    // Frozen values are in place when the NMI handler runs
+    if (nes->mapper->cheats != NULL) {
+        cheats_apply_ram(nes->mapper->cheats, cpu);
+    }
+
+    if (nes->frame_hook != NULL) {
+        nes->frame_hook(nes, nes->frame_hook_data);
+    }
+}
+
+void wines_set_frame_skip(wines_t* nes, uint8_t frame_skip) {
+    nes->frame_skip = frame_skip;
+    nes->frame_skip_count = 0;
+}
+
+void wines_set_deferred(wines_t* nes, bool deferred) {
+    if (deferred == (nes->deferred != NULL)) {
+        return;
+    }
+    if (deferred) {
+        nes->render_pool = thread_pool_create(0);
+        nes->deferred = ppu_deferred_create(nes->ppu, nes->render_pool);
+        ppu_set_deferred(nes->ppu, nes->deferred);
+    } else {
+        ppu_set_deferred(nes->ppu, NULL);
+        ppu_deferred_destroy(nes->deferred);
+        thread_pool_destroy(nes->render_pool);
+        nes->deferred = NULL;
+        nes->render_pool = NULL;
+    }
+}
+
+void wines_set_frame_hook(wines_t* nes, frame_hook_t hook, void* userdata) {
+    nes->frame_hook = hook;
+    nes->frame_hook_data = userdata;
+}
+
+int32_t wines_add_cheat(wines_t* nes, const char* code) {
+    if (nes->mapper->cheats == NULL) {
+        cheats_create(nes->mapper);
+    }
+    return cheats_add(nes->mapper->cheats, code);
+}
+
+void wines_set_cheat_enabled(wines_t* nes, uint32_t index, bool enabled) {
+    if (nes->mapper->cheats != NULL) {
+        cheats_set_enabled(nes->mapper->cheats, index, enabled);
+    }
+}
+
+void wines_clear_cheats(wines_t* nes) {
+    cheats_destroy(nes->mapper->cheats);
+}
+
+void wines_destroy(wines_t* nes) {
+    if (nes != NULL) {
+        wines_set_deferred(nes, false);
+        wines_clear_cheats(nes);
+        apu_destroy(nes->apu);
+        wn_arena_free(&nes->arena, nes->cpu);
+        ppu_destroy(nes->ppu);
+        mapper_destroy(nes->mapper);
+        cart_free(nes->cart);
+
+        // The arena lives in the block it frees
+        wn_arena_t arena = nes->arena;
+        wn_arena_free(&arena, nes);
+        wn_arena_destroy(&arena);
+    }
+}
+
+void pop_nes_init(const char* rom_filename, uint8_t frame_skip) {
+    wines_t* nes;
+    if (wines_create(rom_filename, &nes) != ERR_OK) {
+        return;
+    }
+    wines_set_frame_skip(nes, frame_skip);
+
+    while (true) {
+        wines_run_frame(nes);
+    }
+}
@@ -0,0 +1,114 @@
+//
+// Created by WangKZ on 2024/4/1.
+//
+
+#ifndef WINES_WINES_H
+#define WINES_WINES_H
+
+#include "common.h"
+#include "cartridge.h"
+#include "mapper.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "cheat.h"
+#include "ppu_deferred.h"
+#include "thread_pool.h"
+
+// NTSC frame rate
+#define NES_FRAME_RATE 60.0988
+
+typedef struct wines wines_t;
+
+/**
+ * Called at the end of every frame, after the PPU entered vblank
+ */
+typedef void (* frame_hook_t)(wines_t* nes, void* userdata);
+
+/*
+ * A console instance: cartridge, mapper, CPU and PPU wired together
+ */
+struct wines {
+    cart_t* cart;
+    mapper_t* mapper;
+    ppu_t* ppu;
+    cpu_t* cpu;
+    apu_t* apu;
+
+    // One frame out of (frame_skip + 1) is rendered, the others run render-less
+    uint8_t frame_skip;
+    uint8_t frame_skip_count;
+
+    frame_hook_t frame_hook;
+    void* frame_hook_data;
+
+    // Deferred rendering, NULL when disabled
+    ppu_deferred_t* deferred;
+    thread_pool_t* render_pool;
+
+    // One block holding the console, cartridge RAM, mapper, PPU, CPU and APU (see wines_arena_size)
+    wn_arena_t arena;
+};
+
+/**
+ * Size of the block holding a console running the image, 0 when its mapper is not supported
+ */
+size_t wines_arena_size(const cart_image_t* image);
+
+err_t wines_create(const char* rom_filename, wines_t** out);
+
+/**
+ * Console running a ROM image shared with other consoles of the process (see cart_init_shared).
+ * The console takes its own reference to the image.
+ */
+err_t wines_create_shared(cart_image_t* image, wines_t** out);
+
+/**
+ * Runs the console until the PPU completes a frame (start of vblank),
+ * rendering it or not according to the frame skip ratio.
+ * The samples of the frame are then available with apu_read_samples.
+ */
+void wines_run_frame(wines_t* nes);
+
+/**
+ * Same as wines_run_frame, leaving the PPU render mode untouched
+ */
+void wines_step_frame(wines_t* nes);
+
+/**
+ * Writes the battery-backed RAM to the .sav file every CART_SAV_SYNC_FRAMES frames.
+ * Done by wines_run_frame, callers of wines_step_frame call it once their frame is the one kept.
+ */
+void wines_sync_sav(wines_t* nes);
+
+/**
+ * Frame skip ratio, 0 renders every frame
+ */
+void wines_set_frame_skip(wines_t* nes, uint8_t frame_skip);
+
+/**
+ * Renders frames on worker threads while the next frame is emulated.
+ * The frame buffer then lags one frame behind the emulation.
+ */
+void wines_set_deferred(wines_t* nes, bool deferred);
+
+void wines_set_frame_hook(wines_t* nes, frame_hook_t hook, void* userdata);
+
+/**
+ * Adds a Game Genie or raw code (see cheat_parse), enabled.
+ * Returns its index, or -1 if the code cannot be parsed.
+ */
+int32_t wines_add_cheat(wines_t* nes, const char* code);
+
+void wines_set_cheat_enabled(wines_t* nes, uint32_t index, bool enabled);
+
+/**
+ * Removes every code, the PRG ROM is mapped back unpatched
+ */
+void wines_clear_cheats(wines_t* nes);
+
+void wines_destroy(wines_t* nes);
+
+void pop_nes_init(const char* rom_filename, uint8_t frame_skip);
+
+#endif //WINES_WINES_H
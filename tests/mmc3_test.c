@@ -0,0 +1,186 @@
+//
+// MMC3: the predicted scanline IRQ fires on the same CPU cycles as exact A12 tracking
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "wines.h"
+
+#define ROM_FILENAME    "mmc3_test.nes"
+#define TEST_FRAMES     600
+#define MAX_IRQS        4096
+
+// Fixed last bank, where the program lives
+#define CODE_BASE       0xE000
+#define PRG_SIZE        0x8000
+#define CHR_SIZE        0x2000
+
+/*
+ * Reset: IRQ latch 250 (more than a frame of scanlines), IRQ on, background at $0000 and 8x8 sprites
+ * at $1000, then an idle loop.
+ * NMI: PPUCTRL from the table by frame number, alternating predicted and exact configurations.
+ * IRQ: acknowledge, add 67 to the latch, so every value comes up, reload the counter and switch PPUCTRL
+ * from the table again, in the middle of the frame.
+ */
+static const uint8_t PROGRAM[] = {
+        // $E000 reset
+        0x78,                               // SEI
+        0xA2, 0xFF,                         // LDX #$FF
+        0x9A,                               // TXS
+        0xA9, 0x40, 0x8D, 0x17, 0x40,       // LDA #$40, STA $4017
+        0xA9, 0x00, 0x8D, 0x00, 0x20,       // LDA #0, STA $2000
+        0x8D, 0x01, 0x20,                   // STA $2001
+        0xA9, 0xFA, 0x85, 0x01,             // LDA #250, STA $01
+        0x8D, 0x00, 0xC0,                   // STA $C000
+        0x8D, 0x01, 0xC0,                   // STA $C001
+        0x8D, 0x01, 0xE0,                   // STA $E001
+        0xA9, 0x88, 0x8D, 0x00, 0x20,       // LDA #$88, STA $2000
+        0xA9, 0x1E, 0x8D, 0x01, 0x20,       // LDA #$1E, STA $2001
+        0x58,                               // CLI
+        0x4C, 0x29, 0xE0,                   // $E029: JMP $E029
+        // $E02C NMI
+        0x48, 0x8A, 0x48,                   // PHA, TXA, PHA
+        0xE6, 0x00,                         // INC $00
+        0xA5, 0x00,                         // LDA $00
+        0x29, 0x03, 0xAA,                   // AND #3, TAX
+        0xBD, 0x63, 0xE0,                   // LDA $E063,X
+        0x8D, 0x00, 0x20,                   // STA $2000
+        0x68, 0xAA, 0x68,                   // PLA, TAX, PLA
+        0x40,                               // RTI
+        // $E040 IRQ
+        0x48, 0x8A, 0x48,                   // PHA, TXA, PHA
+        0x8D, 0x00, 0xE0,                   // STA $E000
+        0x8D, 0x01, 0xE0,                   // STA $E001
+        0xA5, 0x01, 0x18,                   // LDA $01, CLC
+        0x69, 0x43, 0x85, 0x01,             // ADC #67, STA $01
+        0x8D, 0x00, 0xC0,                   // STA $C000
+        0x8D, 0x01, 0xC0,                   // STA $C001
+        0x29, 0x03, 0xAA,                   // AND #3, TAX
+        0xBD, 0x63, 0xE0,                   // LDA $E063,X
+        0x8D, 0x00, 0x20,                   // STA $2000
+        0x68, 0xAA, 0x68,                   // PLA, TAX, PLA
+        0x40,                               // RTI
+        // $E063 PPUCTRL: 8x8 sprites at $1000, 8x16 sprites, again, background and sprites at $1000
+        0x88, 0xA8, 0x88, 0x98,
+};
+
+#define NMI_ADDR        0xE02C
+#define IRQ_ADDR        0xE040
+
+typedef struct {
+    uint64_t cycles[MAX_IRQS];
+    uint32_t count;
+    // IRQ line as the CPU last polled it
+    bool polled;
+    // Rendered with the A12 watch off and on
+    bool watch_off;
+    bool watch_on;
+} irq_log_t;
+
+static bool write_rom(void) {
+    static uint8_t rom[16 + PRG_SIZE + CHR_SIZE];
+    // 2 x 16 KB PRG ROM, 1 x 8 KB CHR ROM, mapper 4
+    static const uint8_t HEADER[16] = {'N', 'E', 'S', 0x1A, 2, 1, 0x40, 0x00};
+    memcpy(rom, HEADER, sizeof(HEADER));
+    uint8_t* prg = rom + 16;
+    memset(prg, 0xFF, PRG_SIZE);
+    memcpy(prg + CODE_BASE - 0x8000, PROGRAM, sizeof(PROGRAM));
+    const uint16_t vectors[3] = {NMI_ADDR, CODE_BASE, IRQ_ADDR};
+    for (int i = 0; i < 3; ++i) {
+        prg[PRG_SIZE - 6 + i * 2] = vectors[i] & 0xFF;
+        prg[PRG_SIZE - 5 + i * 2] = vectors[i] >> 8;
+    }
+
+    FILE* file = fopen(ROM_FILENAME, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    bool ok = fwrite(rom, sizeof(rom), 1, file) == 1;
+    return fclose(file) == 0 && ok;
+}
+
+/**
+ * wines_step_frame, logging the CPU cycles of the instruction boundaries where the mapper IRQ shows up
+ */
+static void run_frame(wines_t* nes, irq_log_t* log) {
+    cpu_t* cpu = nes->cpu;
+    ppu_t* ppu = nes->ppu;
+    uint32_t frame = ppu->frame_count;
+    while (ppu->frame_count == frame) {
+        bool poll = cpu->cycles == 0 && !cpu->oam_dma_flag;
+        uint64_t cycle = cpu->cycle_count;
+        cpu_cycle(cpu);
+        if (poll) {
+            bool asserted = cpu->irq & CPU_IRQ_MAPPER;
+            if (asserted && !log->polled && log->count < MAX_IRQS) {
+                log->cycles[log->count++] = cycle;
+            }
+            log->polled = asserted;
+        }
+        if (ppu->mask.show_bgr || ppu->mask.show_spr) {
+            log->watch_on |= ppu->a12_watch;
+            log->watch_off |= !ppu->a12_watch;
+        }
+
+        ppu_cycle(ppu);
+        ppu_cycle(ppu);
+        ppu_cycle(ppu);
+    }
+    apu_end_frame(nes->apu, cpu->cycle_count);
+}
+
+static bool run(bool exact, irq_log_t* log) {
+    wines_t* nes;
+    if (wines_create(ROM_FILENAME, &nes) != ERR_OK) {
+        return false;
+    }
+    nes->mapper->exact_irq = exact;
+    for (int i = 0; i < TEST_FRAMES; ++i) {
+        run_frame(nes, log);
+    }
+    wines_destroy(nes);
+    return true;
+}
+
+int main(void) {
+    static irq_log_t predicted, exact;
+    if (!write_rom() || !run(false, &predicted) || !run(true, &exact)) {
+        fprintf(stderr, "Cannot run %s\n", ROM_FILENAME);
+        return 2;
+    }
+    remove(ROM_FILENAME);
+
+    int failed = 0;
+    // Both paths are taken
+    if (!predicted.watch_off || !predicted.watch_on) {
+        fprintf(stderr, "FAIL configurations: A12 watch off %d, on %d\n", predicted.watch_off, predicted.watch_on);
+        ++failed;
+    }
+    // The latch goes through every value, some take more than a frame
+    uint64_t longest = 0;
+    for (uint32_t i = 1; i < exact.count; ++i) {
+        uint64_t gap = exact.cycles[i] - exact.cycles[i - 1];
+        longest = gap > longest ? gap : longest;
+    }
+    if (exact.count < 256 || longest < 29781) {
+        fprintf(stderr, "FAIL coverage: %u IRQs, longest %llu cycles\n", exact.count, (unsigned long long) longest);
+        ++failed;
+    }
+    if (predicted.count != exact.count) {
+        fprintf(stderr, "FAIL %u predicted IRQs, %u exact\n", predicted.count, exact.count);
+        ++failed;
+    }
+    uint32_t count = predicted.count < exact.count ? predicted.count : exact.count;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (predicted.cycles[i] != exact.cycles[i]) {
+            fprintf(stderr, "FAIL IRQ %u: predicted at cycle %llu, exact at %llu\n", i,
+                    (unsigned long long) predicted.cycles[i], (unsigned long long) exact.cycles[i]);
+            ++failed;
+            break;
+        }
+    }
+
+    printf("%s: %u IRQs\n", failed ? "FAILED" : "OK", exact.count);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+//
+// Rewind: every step back restores the state pushed for that frame, byte for byte
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "wines.h"
+#include "state.h"
+#include "rewind_buffer.h"
+
+#define TEST_FRAMES     600
+#define MAX_FRAMES      512
+// Far less than MAX_FRAMES deltas, the ring wraps and drops its oldest deltas many times
+#define CAPACITY        8192
+
+// Frames where the test goes back a few frames before pushing again
+#define BACK_EVERY      37
+#define BACK_STEPS      3
+
+// Frame where most of the memories change at once, for a delta as large as the state
+#define SCRAMBLE_FRAME  300
+
+typedef struct {
+    wines_t* nes;
+    rewind_buffer_t* rewind;
+    size_t size;
+    // States pushed, the newest on top
+    uint8_t* states;
+    uint32_t top;
+    uint8_t* current;
+    int failed;
+} rewind_test_t;
+
+static void scramble(wines_t* nes) {
+    for (size_t i = 0; i < CPU_RAM_SIZE; ++i) {
+        nes->cpu->ram[i] ^= 0xFF;
+    }
+    for (size_t i = 0; i < PPU_VRAM_SIZE; ++i) {
+        nes->ppu->vram[i] ^= 0xFF;
+        nes->ppu->ext_vram[i] ^= 0xFF;
+    }
+    for (size_t i = 0; i < 256; ++i) {
+        nes->ppu->oam[i] ^= 0xFF;
+    }
+}
+
+static void push(rewind_test_t* t) {
+    wn_state_save(t->nes, t->states + t->top++ * t->size, t->size);
+    rewind_buffer_push(t->rewind);
+}
+
+/**
+ * Steps back, checks the console against the state pushed before the newest one
+ */
+static bool back(rewind_test_t* t, uint32_t frame) {
+    if (!rewind_buffer_back(t->rewind)) {
+        return false;
+    }
+    --t->top;
+    wn_state_save(t->nes, t->current, t->size);
+    if (t->top == 0 || memcmp(t->current, t->states + (t->top - 1) * t->size, t->size) != 0) {
+        fprintf(stderr, "FAIL frame %u: back to push %u differs\n", frame, t->top - 1);
+        ++t->failed;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <rom>\n", argv[0]);
+        return 2;
+    }
+    rewind_test_t t = {0};
+    if (wines_create(argv[1], &t.nes) != ERR_OK) {
+        fprintf(stderr, "Cannot load %s\n", argv[1]);
+        return 2;
+    }
+    t.rewind = rewind_buffer_create(t.nes, MAX_FRAMES, CAPACITY);
+    t.size = wn_state_size(t.nes);
+    t.states = malloc(t.size * TEST_FRAMES);
+    t.current = malloc(t.size);
+
+    uint32_t most_frames = 0;
+    for (uint32_t frame = 0; frame < TEST_FRAMES; ++frame) {
+        wines_run_frame(t.nes);
+        if (frame == SCRAMBLE_FRAME) {
+            scramble(t.nes);
+        }
+        if (frame % BACK_EVERY == BACK_EVERY - 1) {
+            // The pushes after these reuse the ring space of the deltas just undone
+            for (int i = 0; i < BACK_STEPS; ++i) {
+                back(&t, frame);
+            }
+        }
+        push(&t);
+
+        uint32_t frames = rewind_buffer_frames(t.rewind);
+        most_frames = frames > most_frames ? frames : most_frames;
+        if (frames > MAX_FRAMES || rewind_buffer_used(t.rewind) > CAPACITY) {
+            fprintf(stderr, "FAIL frame %u: %u frames in %zu bytes\n", frame, frames, rewind_buffer_used(t.rewind));
+            ++t.failed;
+        }
+    }
+
+    // Back to the oldest delta left, through the wraps of the ring
+    uint32_t steps = 0;
+    while (back(&t, TEST_FRAMES)) {
+        ++steps;
+    }
+    if (steps == 0 || most_frames == MAX_FRAMES) {
+        fprintf(stderr, "FAIL coverage: %u steps back, at most %u frames held\n", steps, most_frames);
+        ++t.failed;
+    }
+
+    rewind_buffer_destroy(t.rewind);
+    wines_destroy(t.nes);
+    free(t.states);
+    free(t.current);
+    printf("%s: %u steps back\n", t.failed ? "FAILED" : "OK", steps);
+    return t.failed ? 1 : 0;
+}
@@ -0,0 +1,207 @@
+//
+// Save states: damaged states are rejected and leave the console untouched
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "wines.h"
+#include "state.h"
+#include "frame_hash.h"
+
+// Frames of the round trip, from power on
+#define ROUND_TRIP_FRAMES   60
+
+// Offsets in the section bodies, see the state_save_* functions
+#define PPU_LINE_SPRITES    (PPU_VRAM_SIZE * 2 + PPU_PALETTE_SIZE + 256)
+#define PPU_MIRRORING       (PPU_LINE_SPRITES + PPU_VISIBLE_SCANLINES * (1 + PPU_SPRITES_PER_LINE) + 16)
+#define PPU_SCANLINE        (PPU_MIRRORING + 1 + 3 + 6)
+#define PPU_TICK            (PPU_SCANLINE + 2)
+#define PPU_A12_WATCH       (PPU_TICK + 4 + 4 + 8)
+#define APU_PULSE_PHASE     16
+#define APU_TRIANGLE_PHASE  49
+#define APU_NOISE_PERIOD    61
+#define APU_DMC_PERIOD      72
+#define APU_FRAME_STEP      95
+
+typedef struct {
+    const char* name;
+    const char* section;
+    size_t offset;
+    // Little-endian value of `width` bytes
+    uint64_t val;
+    uint8_t width;
+} corruption_t;
+
+static const corruption_t CORRUPTIONS[] = {
+        {"mirroring", "PPU ", PPU_MIRRORING, MIRRORING_FOUR_SCREEN + 1, 1},
+        {"sprites per line", "PPU ", PPU_LINE_SPRITES, PPU_SPRITES_PER_LINE + 1, 1},
+        {"sprite index", "PPU ", PPU_LINE_SPRITES + 1, 64, 1},
+        {"scanline", "PPU ", PPU_SCANLINE + 1, 0x7F, 1},
+        {"tick", "PPU ", PPU_TICK + 3, 0x80, 1},
+        {"pulse duty", "APU ", 0, 4, 1},
+        {"pulse phase", "APU ", APU_PULSE_PHASE, 8, 1},
+        {"triangle phase", "APU ", APU_TRIANGLE_PHASE, 32, 1},
+        {"noise period", "APU ", APU_NOISE_PERIOD, 0, 2},
+        {"DMC period", "APU ", APU_DMC_PERIOD, 0, 2},
+        {"frame step", "APU ", APU_FRAME_STEP, 4, 1},
+};
+
+// Fields the console does not take from the state when its board has no use for them
+static const corruption_t IGNORED[] = {
+        {"A12 watch", "PPU ", PPU_A12_WATCH, 1, 1},
+};
+
+static size_t find_section(const uint8_t* buf, size_t size, const char* tag) {
+    size_t pos = 20;
+    while (pos + 8 <= size) {
+        state_reader_t r = {buf + pos + 4};
+        uint32_t section_size = state_read_u32(&r);
+        if (memcmp(buf + pos, tag, 4) == 0) {
+            return pos + 8;
+        }
+        pos += 8 + section_size;
+    }
+    return 0;
+}
+
+static void corrupt(uint8_t* state, size_t size, const corruption_t* c) {
+    uint8_t* field = state + find_section(state, size, c->section) + c->offset;
+    for (uint8_t k = 0; k < c->width; ++k) {
+        field[k] = (uint8_t) (c->val >> (k * 8));
+    }
+}
+
+/**
+ * Damaged states are rejected before anything is restored
+ */
+static int test_rejected(wines_t* nes, const uint8_t* good, size_t size) {
+    uint8_t* state = malloc(size);
+    uint8_t* after = malloc(size);
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(CORRUPTIONS) / sizeof(CORRUPTIONS[0]); ++i) {
+        const corruption_t* c = &CORRUPTIONS[i];
+        memcpy(state, good, size);
+        corrupt(state, size, c);
+        err_t err = wn_state_load(nes, state, size);
+        wn_state_save(nes, after, size);
+        if (err != ERR_INVALID_STATE || memcmp(after, good, size) != 0) {
+            fprintf(stderr, "FAIL %s: error %d\n", c->name, err);
+            ++failed;
+        }
+    }
+    free(state);
+    free(after);
+    return failed;
+}
+
+/**
+ * Ignored fields load, and the next frame is the one of the intact state
+ */
+static int test_ignored(wines_t* nes, const uint8_t* good, size_t size) {
+    uint8_t* state = malloc(size);
+    uint8_t* expected = malloc(size);
+    uint8_t* after = malloc(size);
+    wn_state_load(nes, good, size);
+    wines_run_frame(nes);
+    wn_state_save(nes, expected, size);
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(IGNORED) / sizeof(IGNORED[0]); ++i) {
+        const corruption_t* c = &IGNORED[i];
+        memcpy(state, good, size);
+        corrupt(state, size, c);
+        err_t err = wn_state_load(nes, state, size);
+        wines_run_frame(nes);
+        wn_state_save(nes, after, size);
+        if (err != ERR_OK || memcmp(after, expected, size) != 0) {
+            fprintf(stderr, "FAIL %s: error %d\n", c->name, err);
+            ++failed;
+        }
+    }
+    wn_state_load(nes, good, size);
+    free(state);
+    free(expected);
+    free(after);
+    return failed;
+}
+
+static bool hash_equal(const frame_hash_t* a, const frame_hash_t* b) {
+    return a->frame == b->frame && a->ram == b->ram && a->vram == b->vram;
+}
+
+/**
+ * Runs a frame and hashes it, the frame buffer only when the frame was rendered: it is not part of the state
+ */
+static void run_hashed(wines_t* nes, frame_hash_t* out) {
+    wines_run_frame(nes);
+    frame_hash(nes, FRAME_HASH_FRAME | FRAME_HASH_RAM | FRAME_HASH_VRAM, out);
+    if (!nes->ppu->frame_updated) {
+        out->frame = 0;
+    }
+}
+
+/**
+ * Every state of a run loads back to the same bytes, and the frames after it replay identically
+ */
+static int test_round_trip(wines_t* nes, size_t size) {
+    uint8_t* states = malloc(size * ROUND_TRIP_FRAMES);
+    uint8_t* after = malloc(size);
+    frame_hash_t hashes[ROUND_TRIP_FRAMES];
+    for (int i = 0; i < ROUND_TRIP_FRAMES; ++i) {
+        wn_state_save(nes, states + i * size, size);
+        run_hashed(nes, &hashes[i]);
+    }
+
+    int failed = 0;
+    for (int start = 0; start < ROUND_TRIP_FRAMES; ++start) {
+        const uint8_t* state = states + start * size;
+        err_t err = wn_state_load(nes, state, size);
+        wn_state_save(nes, after, size);
+        if (err != ERR_OK || memcmp(after, state, size) != 0) {
+            fprintf(stderr, "FAIL round trip: state of frame %d changed by loading it\n", start);
+            ++failed;
+            continue;
+        }
+        for (int i = start; i < ROUND_TRIP_FRAMES; ++i) {
+            frame_hash_t hash;
+            run_hashed(nes, &hash);
+            if (!hash_equal(&hash, &hashes[i])) {
+                fprintf(stderr, "FAIL round trip: frame %d differs after loading frame %d\n", i, start);
+                ++failed;
+                break;
+            }
+        }
+    }
+    free(states);
+    free(after);
+    return failed;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <rom>\n", argv[0]);
+        return 2;
+    }
+    wines_t* nes;
+    if (wines_create(argv[1], &nes) != ERR_OK) {
+        fprintf(stderr, "Cannot load %s\n", argv[1]);
+        return 2;
+    }
+    size_t size = wn_state_size(nes);
+    int failed = test_round_trip(nes, size);
+
+    uint8_t* good = malloc(size);
+    wn_state_save(nes, good, size);
+    failed += test_rejected(nes, good, size);
+    if (wn_state_load(nes, good, size) != ERR_OK) {
+        fprintf(stderr, "FAIL intact state\n");
+        ++failed;
+    }
+    failed += test_ignored(nes, good, size);
+
+    free(good);
+    wines_destroy(nes);
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}